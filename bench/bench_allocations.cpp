@@ -0,0 +1,49 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "bench_common.hpp"
+
+// Replaces the global allocation functions to count the allocations.
+// Kept apart from the rest, for the compiler not to see them mismatched with free.
+namespace
+{
+    auto allocations = std::atomic<std::uint64_t>{0};
+}  // namespace
+
+auto operator new(std::size_t const size) -> void*
+{
+    allocations.fetch_add(1u, std::memory_order_relaxed);
+    if (auto* const ptr = std::malloc(size != 0u ? size : 1u))
+    {
+        return ptr;
+    }
+
+    throw std::bad_alloc{};
+}
+
+auto operator new(std::size_t const size, std::nothrow_t const&) noexcept -> void*
+{
+    allocations.fetch_add(1u, std::memory_order_relaxed);
+    return std::malloc(size != 0u ? size : 1u);
+}
+
+void operator delete(void* const ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* const ptr, std::size_t /* size */) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* const ptr, std::nothrow_t const&) noexcept
+{
+    std::free(ptr);
+}
+
+auto usb_asio::bench::allocation_count() noexcept -> std::uint64_t
+{
+    return allocations.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,61 @@
+#include "bench_common.hpp"
+
+#include <span>
+
+namespace usb_asio::bench
+{
+    void report_allocations(
+        benchmark::State& state,
+        std::string const& name,
+        std::uint64_t const first_allocation,
+        std::uint64_t const items)
+    {
+        auto const count = allocation_count() - first_allocation;
+        state.counters[name] = benchmark::Counter{
+            items != 0u ? static_cast<double>(count) / static_cast<double>(items) : 0.0,
+            benchmark::Counter::kAvgThreads,
+        };
+    }
+
+    auto event_handling_name(usb_event_handling const event_handling) -> char const*
+    {
+        switch (event_handling)
+        {
+        case usb_event_handling::event_thread:
+            return "event_thread";
+        case usb_event_handling::reactor:
+            return "reactor";
+        case usb_event_handling::busy_poll:
+            return "busy_poll";
+        }
+
+        return "unknown";
+    }
+
+    auto completion_policy_name(usb_completion_policy const policy) -> char const*
+    {
+        switch (policy)
+        {
+        case usb_completion_policy::post:
+            return "post";
+        case usb_completion_policy::dispatch:
+            return "dispatch";
+        case usb_completion_policy::direct:
+            return "direct";
+        }
+
+        return "unknown";
+    }
+
+    sim_bench_device::sim_bench_device(asio::io_context& ioc, usb_service_options const& options)
+      : usb_sim_opened_device{ioc, {.first_product_id = 0x0b00, .iso_packet_size = iso_packet_size}, options}
+    {
+        // Not to measure the simulator zeroing the buffers.
+        for (auto const endpoint : {bulk_in_endpoint, iso_in_endpoint})
+        {
+            sim_device().set_in_source(endpoint, [](std::span<std::byte> const buffer) {
+                return buffer.size();
+            });
+        }
+    }
+}  // namespace usb_asio::bench
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <benchmark/benchmark.h>
+#include <usb_asio/simulator/usb_sim_opened_device.hpp>
+#include <usb_asio/simulator/usb_simulator.hpp>
+#include <usb_asio/usb_asio.hpp>
+
+namespace usb_asio::bench
+{
+    // Endpoints of the simulated device, on interface 0.
+    inline constexpr auto bulk_in_endpoint = sim::usb_sim_opened_device::bulk_in_endpoint;
+    inline constexpr auto bulk_out_endpoint = sim::usb_sim_opened_device::bulk_out_endpoint;
+    inline constexpr auto iso_in_endpoint = sim::usb_sim_opened_device::iso_in_endpoint;
+    inline constexpr auto iso_packet_size = std::size_t{1024};
+
+    // Heap allocations made by the process so far, counted by the replaced operator new.
+    [[nodiscard]] auto allocation_count() noexcept -> std::uint64_t;
+
+    // Sets the allocations made since first_allocation, per item, as a counter.
+    void report_allocations(
+        benchmark::State& state,
+        std::string const& name,
+        std::uint64_t first_allocation,
+        std::uint64_t items);
+
+    template <typename Enum>
+    [[nodiscard]] constexpr auto enum_arg(Enum const value) noexcept -> std::int64_t
+    {
+        return static_cast<std::int64_t>(value);
+    }
+
+    [[nodiscard]] auto event_handling_name(usb_event_handling event_handling) -> char const*;
+
+    [[nodiscard]] auto completion_policy_name(usb_completion_policy policy) -> char const*;
+
+    // The simulated device of a benchmark thread, its IN endpoints filling buffers without writing them.
+    class sim_bench_device : public sim::usb_sim_opened_device
+    {
+      public:
+        sim_bench_device(asio::io_context& ioc, usb_service_options const& options);
+    };
+}  // namespace usb_asio::bench
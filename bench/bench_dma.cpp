@@ -0,0 +1,95 @@
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+#include "bench_common.hpp"
+
+namespace usb_asio::bench
+{
+    namespace
+    {
+        enum class dma_resource_kind
+        {
+            // Plain heap memory, for reference.
+            heap,
+            usb_dma_resource,
+            usb_dma_pool_resource,
+        };
+
+        // Allocates and frees transfer buffers, keeping a few of them alive like a ring of transfers would.
+        // The simulator's DMA memory is page-aligned heap memory, so usb_dma_resource's figures only
+        // reflect its own overhead, not the cost of mapping memory of a real device.
+        void dma_allocate(benchmark::State& state)
+        {
+            auto const kind = static_cast<dma_resource_kind>(state.range(0));
+            auto const size = static_cast<std::size_t>(state.range(1));
+            constexpr auto alignment = std::size_t{64};
+            constexpr auto num_live = std::size_t{8};
+            state.SetLabel(
+                kind == dma_resource_kind::heap               ? "heap"
+                : kind == dma_resource_kind::usb_dma_resource ? "usb_dma_resource"
+                                                              : "usb_dma_pool_resource");
+
+            auto ioc = asio::io_context{};
+            auto device = sim_bench_device{ioc, usb_service_options{}};
+            // Without a backup resource, failing to allocate DMA memory throws.
+            auto dma_resource = usb_asio::usb_dma_resource{device.device(), std::pmr::get_default_resource(), nullptr};
+            auto dma_pool_resource = usb_asio::usb_dma_pool_resource{device.device()};
+
+            auto* const resource = [&]() -> std::pmr::memory_resource* {
+                switch (kind)
+                {
+                case dma_resource_kind::heap:
+                    return std::pmr::new_delete_resource();
+                case dma_resource_kind::usb_dma_resource:
+                    return &dma_resource;
+                case dma_resource_kind::usb_dma_pool_resource:
+                    return &dma_pool_resource;
+                }
+                return nullptr;
+            }();
+
+            auto live = std::vector<void*>(num_live, nullptr);
+            auto next = std::size_t{0};
+            auto const cycle = [&]() {
+                auto*& slot = live[next++ % num_live];
+                if (slot != nullptr)
+                {
+                    resource->deallocate(slot, size, alignment);
+                }
+                slot = resource->allocate(size, alignment);
+                benchmark::DoNotOptimize(slot);
+            };
+
+            for (auto i = std::size_t{0}; i < num_live; ++i)
+            {
+                cycle();
+            }
+
+            auto const first_allocation = allocation_count();
+            for (auto _ : state)
+            {
+                cycle();
+            }
+
+            state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+            report_allocations(state, "heap_allocs_per_allocation", first_allocation, state.iterations());
+
+            for (auto* const ptr : live)
+            {
+                resource->deallocate(ptr, size, alignment);
+            }
+        }
+    }  // namespace
+
+    BENCHMARK(dma_allocate)
+        ->ArgsProduct({
+            {
+                enum_arg(dma_resource_kind::heap),
+                enum_arg(dma_resource_kind::usb_dma_resource),
+                enum_arg(dma_resource_kind::usb_dma_pool_resource),
+            },
+            {512, 16 << 10, 64 << 10},
+        })
+        ->ArgNames({"resource", "size"});
+}  // namespace usb_asio::bench
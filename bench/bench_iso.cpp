@@ -0,0 +1,136 @@
+#include <atomic>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "bench_common.hpp"
+
+namespace usb_asio::bench
+{
+    namespace
+    {
+        // Reads of a single isochronous transfer, the cost of turning the packet descriptors
+        // into results growing with the number of packets.
+        void iso_transfer_packets(benchmark::State& state)
+        {
+            auto const num_packets = static_cast<std::size_t>(state.range(0));
+
+            auto ioc = asio::io_context{};
+            // Keeps run_one waiting for the completions.
+            auto const work = asio::require(ioc.get_executor(), asio::execution::outstanding_work.tracked);
+            auto device = sim_bench_device{ioc, usb_service_options{}};
+            auto transfer = usb_in_isochronous_transfer{device.device(), iso_in_endpoint, num_packets, iso_packet_size};
+
+            auto buffer = std::vector<std::byte>(num_packets * iso_packet_size);
+            auto done = std::atomic<bool>{false};
+            auto ec = error_code{};
+            auto transferred = std::size_t{0};
+            auto on_read = [&](error_code const& result_ec, std::span<usb_iso_packet_transfer_result const> const results) {
+                ec = result_ec;
+                for (auto const& result : results)
+                {
+                    transferred += result.transferred;
+                }
+                done.store(true, std::memory_order_release);
+            };
+
+            auto const read = [&]() {
+                done.store(false, std::memory_order_relaxed);
+                transfer.async_read_some(asio::buffer(buffer), on_read);
+                while (!done.load(std::memory_order_acquire))
+                {
+                    ioc.run_one();
+                }
+            };
+
+            read();
+
+            auto const first_allocation = allocation_count();
+            for (auto _ : state)
+            {
+                read();
+            }
+
+            auto const num_read_packets = state.iterations() * num_packets;
+            state.SetItemsProcessed(static_cast<std::int64_t>(num_read_packets));
+            state.SetBytesProcessed(static_cast<std::int64_t>(num_read_packets * iso_packet_size));
+            report_allocations(state, "allocs_per_packet", first_allocation, num_read_packets);
+            benchmark::DoNotOptimize(transferred);
+
+            if (ec)
+            {
+                state.SkipWithError(ec.message().c_str());
+            }
+        }
+
+        // Reads of a usb_iso_in_stream keeping 4 transfers in flight.
+        void iso_stream_packets(benchmark::State& state)
+        {
+            auto const num_packets = static_cast<std::size_t>(state.range(0));
+            constexpr auto num_transfers = std::size_t{4};
+
+            auto ioc = asio::io_context{};
+            // Keeps run_one waiting for the completions.
+            auto const work = asio::require(ioc.get_executor(), asio::execution::outstanding_work.tracked);
+            auto device = sim_bench_device{ioc, usb_service_options{}};
+            auto stream = usb_iso_in_stream{device.device(), iso_in_endpoint, num_transfers, num_packets, iso_packet_size};
+
+            auto done = std::atomic<bool>{false};
+            auto ec = error_code{};
+            auto transferred = std::size_t{0};
+            auto on_packets = [&](error_code const& result_ec, std::span<usb_iso_packet const> const packets) {
+                ec = result_ec;
+                for (auto const& packet : packets)
+                {
+                    transferred += packet.payload.size();
+                }
+                done.store(true, std::memory_order_release);
+            };
+
+            auto const read = [&]() {
+                done.store(false, std::memory_order_relaxed);
+                stream.async_read_packets(on_packets);
+                while (!done.load(std::memory_order_acquire))
+                {
+                    ioc.run_one();
+                }
+            };
+
+            read();
+
+            auto const first_allocation = allocation_count();
+            for (auto _ : state)
+            {
+                read();
+            }
+
+            auto const num_read_packets = state.iterations() * num_packets;
+            state.SetItemsProcessed(static_cast<std::int64_t>(num_read_packets));
+            state.SetBytesProcessed(static_cast<std::int64_t>(num_read_packets * iso_packet_size));
+            report_allocations(state, "allocs_per_packet", first_allocation, num_read_packets);
+            benchmark::DoNotOptimize(transferred);
+
+            if (ec)
+            {
+                state.SkipWithError(ec.message().c_str());
+            }
+
+            // The transfers must be done before the device closes.
+            stream.cancel();
+            for (auto i = std::size_t{0}; i < num_transfers; ++i)
+            {
+                read();
+            }
+        }
+    }  // namespace
+
+    BENCHMARK(iso_transfer_packets)
+        ->RangeMultiplier(4)
+        ->Range(8, 128)
+        ->ArgName("packets");
+
+    BENCHMARK(iso_stream_packets)
+        ->RangeMultiplier(4)
+        ->Range(8, 128)
+        ->ArgName("packets");
+}  // namespace usb_asio::bench
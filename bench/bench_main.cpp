@@ -0,0 +1,6 @@
+#include <benchmark/benchmark.h>
+
+// usb_asio_bench runs against usb_asio::simulator: the figures are the overhead of usb_asio
+// (and of the simulator), not of a real host controller.
+// --benchmark_format=json (or --benchmark_out=<file>) writes the results as JSON.
+BENCHMARK_MAIN();
@@ -0,0 +1,272 @@
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench_common.hpp"
+
+namespace usb_asio::bench
+{
+    namespace
+    {
+        using buffer_type = std::array<std::byte, 512>;
+
+        // Handler bringing its own allocator, which bypasses the recycled handler memory.
+        struct heap_allocated_handler
+        {
+            using allocator_type = std::allocator<void>;
+
+            std::atomic<bool>* done;
+            error_code* ec;
+
+            [[nodiscard]] auto get_allocator() const noexcept -> allocator_type
+            {
+                return {};
+            }
+
+            void operator()(error_code const& result_ec, std::size_t /* transferred */) const
+            {
+                *ec = result_ec;
+                done->store(true, std::memory_order_release);
+            }
+        };
+
+        // Submits reads one after the other, timing submission to handler invocation.
+        // Handlers run on the event thread with the direct policy (unless events are handled
+        // by the reactor), and on the io_context otherwise.
+        void submit_to_complete(benchmark::State& state)
+        {
+            auto const event_handling = static_cast<usb_event_handling>(state.range(0));
+            auto const policy = static_cast<usb_completion_policy>(state.range(1));
+            state.SetLabel(std::string{event_handling_name(event_handling)} + "/" + completion_policy_name(policy));
+
+            auto ioc = asio::io_context{};
+            // Keeps run_one waiting for the completions.
+            auto const work = asio::require(ioc.get_executor(), asio::execution::outstanding_work.tracked);
+            auto device = sim_bench_device{ioc, usb_service_options{.event_handling = event_handling}};
+            auto transfer = usb_in_bulk_transfer{device.device(), bulk_in_endpoint};
+            transfer.set_completion_policy(policy);
+
+            auto buffer = buffer_type{};
+            auto done = std::atomic<bool>{false};
+            auto ec = error_code{};
+            auto on_read = [&](error_code const& result_ec, std::size_t /* transferred */) {
+                ec = result_ec;
+                done.store(true, std::memory_order_release);
+                done.notify_one();
+            };
+
+            auto const on_event_thread = policy == usb_completion_policy::direct
+                                         && event_handling != usb_event_handling::reactor;
+            auto const read = [&]() {
+                done.store(false, std::memory_order_relaxed);
+                transfer.async_read_some(asio::buffer(buffer), on_read);
+                if (on_event_thread)
+                {
+                    done.wait(false, std::memory_order_acquire);
+                }
+                else
+                {
+                    while (!done.load(std::memory_order_acquire))
+                    {
+                        ioc.run_one();
+                    }
+                }
+            };
+
+            // Warms up the handler memory.
+            read();
+
+            auto const first_allocation = allocation_count();
+            for (auto _ : state)
+            {
+                read();
+            }
+
+            report_allocations(state, "allocs_per_transfer", first_allocation, state.iterations());
+            if (ec)
+            {
+                state.SkipWithError(ec.message().c_str());
+            }
+        }
+
+        // Keeps a number of reads in flight on a device of its own per thread, resubmitting
+        // each one from its completion handler.
+        void transfer_throughput(benchmark::State& state)
+        {
+            auto const depth = static_cast<std::size_t>(state.range(0));
+            auto const event_handling = static_cast<usb_event_handling>(state.range(1));
+            constexpr auto batch_size = std::size_t{1024};
+            state.SetLabel(event_handling_name(event_handling));
+
+            auto ioc = asio::io_context{};
+            // Keeps run_one waiting for the completions.
+            auto const work = asio::require(ioc.get_executor(), asio::execution::outstanding_work.tracked);
+            auto device = sim_bench_device{ioc, usb_service_options{.event_handling = event_handling}};
+
+            auto transfers = std::vector<std::unique_ptr<usb_in_bulk_transfer>>{};
+            auto buffers = std::vector<buffer_type>(depth);
+            for (auto i = std::size_t{0}; i < depth; ++i)
+            {
+                transfers.push_back(std::make_unique<usb_in_bulk_transfer>(device.device(), bulk_in_endpoint));
+            }
+
+            auto submitted = std::size_t{0};
+            auto completed = std::size_t{0};
+            auto ec = error_code{};
+            auto const submit = [&](std::size_t const index, auto const& self) -> void {
+                ++submitted;
+                auto on_read = [&, index](error_code const& result_ec, std::size_t /* transferred */) {
+                    ++completed;
+                    ec = result_ec ? result_ec : ec;
+                    if (!result_ec && submitted < batch_size)
+                    {
+                        self(index, self);
+                    }
+                };
+                transfers[index]->async_read_some(asio::buffer(buffers[index]), on_read);
+            };
+
+            auto const run_batch = [&]() {
+                submitted = 0;
+                completed = 0;
+                for (auto i = std::size_t{0}; i < depth; ++i)
+                {
+                    submit(i, submit);
+                }
+
+                while (completed < submitted)
+                {
+                    ioc.run_one();
+                }
+            };
+
+            run_batch();
+
+            auto const first_allocation = allocation_count();
+            for (auto _ : state)
+            {
+                run_batch();
+            }
+
+            auto const num_transfers = state.iterations() * batch_size;
+            state.SetItemsProcessed(static_cast<std::int64_t>(num_transfers));
+            state.counters["transfers_per_thread"] = benchmark::Counter{
+                static_cast<double>(num_transfers),
+                benchmark::Counter::kIsRate | benchmark::Counter::kAvgThreads,
+            };
+            // The allocation count is process-wide, only meaningful with a single thread.
+            if (state.threads() == 1)
+            {
+                report_allocations(state, "allocs_per_transfer", first_allocation, num_transfers);
+            }
+
+            if (ec)
+            {
+                state.SkipWithError(ec.message().c_str());
+            }
+        }
+
+        // Allocations per transfer depending on where the memory of the handler comes from.
+        // 0: the recycled handler memory. 1: the same, with a handler larger than its initial block.
+        // 2: the handler's associated allocator, bypassing the recycled memory.
+        void handler_allocations(benchmark::State& state)
+        {
+            auto const handler_kind = state.range(0);
+            state.SetLabel(handler_kind == 0 ? "recycled" : handler_kind == 1 ? "oversized" : "associated_allocator");
+
+            auto ioc = asio::io_context{};
+            // Keeps run_one waiting for the completions.
+            auto const work = asio::require(ioc.get_executor(), asio::execution::outstanding_work.tracked);
+            auto device = sim_bench_device{ioc, usb_service_options{}};
+            auto transfer = usb_in_bulk_transfer{device.device(), bulk_in_endpoint};
+
+            auto buffer = buffer_type{};
+            auto done = std::atomic<bool>{false};
+            auto ec = error_code{};
+            auto small_handler = [&](error_code const& result_ec, std::size_t /* transferred */) {
+                ec = result_ec;
+                done.store(true, std::memory_order_release);
+            };
+            auto oversized_handler = [&, padding = std::array<std::byte, 2 * handler_memory::initial_capacity>{}](
+                                         error_code const& result_ec, std::size_t /* transferred */) {
+                static_cast<void>(padding);
+                ec = result_ec;
+                done.store(true, std::memory_order_release);
+            };
+            auto heap_handler = heap_allocated_handler{&done, &ec};
+
+            auto const run = [&](auto& handler) {
+                auto const read = [&]() {
+                    done.store(false, std::memory_order_relaxed);
+                    transfer.async_read_some(asio::buffer(buffer), handler);
+                    while (!done.load(std::memory_order_acquire))
+                    {
+                        ioc.run_one();
+                    }
+                };
+
+                read();
+
+                auto const first_allocation = allocation_count();
+                for (auto _ : state)
+                {
+                    read();
+                }
+
+                report_allocations(state, "allocs_per_transfer", first_allocation, state.iterations());
+            };
+
+            switch (handler_kind)
+            {
+            case 0:
+                run(small_handler);
+                break;
+            case 1:
+                run(oversized_handler);
+                break;
+            default:
+                run(heap_handler);
+                break;
+            }
+
+            if (ec)
+            {
+                state.SkipWithError(ec.message().c_str());
+            }
+        }
+    }  // namespace
+
+    BENCHMARK(submit_to_complete)
+        ->ArgsProduct({
+            {
+                enum_arg(usb_event_handling::event_thread),
+                enum_arg(usb_event_handling::reactor),
+                enum_arg(usb_event_handling::busy_poll),
+            },
+            {
+                enum_arg(usb_completion_policy::post),
+                enum_arg(usb_completion_policy::dispatch),
+                enum_arg(usb_completion_policy::direct),
+            },
+        })
+        ->ArgNames({"event_handling", "policy"});
+
+    BENCHMARK(transfer_throughput)
+        ->ArgsProduct({
+            {1, 4, 16},
+            {
+                enum_arg(usb_event_handling::event_thread),
+                enum_arg(usb_event_handling::reactor),
+            },
+        })
+        ->ArgNames({"depth", "event_handling"})
+        ->ThreadRange(1, 8)
+        ->UseRealTime();
+
+    BENCHMARK(handler_allocations)
+        ->DenseRange(0, 2)
+        ->ArgName("handler");
+}  // namespace usb_asio::bench
@@ -12,10 +12,16 @@ class UsbAsio(ConanFile):
     options = {
         "asio": ["boost", "standalone"],
         "examples": [True, False],
+        "bench": [True, False],
+        "tests": [True, False],
+        "transfer_metrics": [True, False],
     }
     default_options = {
         "asio": "boost",
         "examples": False,
+        "bench": False,
+        "tests": False,
+        "transfer_metrics": False,
     }
     requires = (
         "libusb/1.0.23",
@@ -27,29 +33,43 @@ class UsbAsio(ConanFile):
 
     def requirements(self):
         if self.options.asio == "boost":
-            self.requires("boost/1.74.0")
+            self.requires("boost/1.77.0")
         else:
-            self.requires("asio/1.17.0")
+            self.requires("asio/1.19.2")
 
         if self.options.examples:
             self.requires("fmt/7.0.1")
 
+        if self.options.bench:
+            self.requires("benchmark/1.7.1")
+
     def build(self):
-        if self.options.examples:
+        if self.options.examples or self.options.bench or self.options.tests:
             cmake = CMake(self)
             cmake.definitions["USB_ASIO_USE_STANDALONE_ASIO"] \
                 = self.options.asio == "standalone"
+            cmake.definitions["USB_ASIO_BUILD_BENCHMARKS"] = self.options.bench
+            cmake.definitions["USB_ASIO_BUILD_TESTS"] = self.options.tests
+            cmake.definitions["USB_ASIO_ENABLE_TRANSFER_METRICS"] = self.options.transfer_metrics
             cmake.configure()
             cmake.build()
 
+            if self.options.tests:
+                cmake.test()
+
     def package(self):
         self.copy("*.hpp", dst="include", src="include")
 
     def package_id(self):
         del self.info.options.examples
+        del self.info.options.bench
+        del self.info.options.tests
 
         self.info.header_only()
 
     def package_info(self):
         if self.options.asio == "standalone":
-            self.cpp_info.defines = ["USB_ASIO_USE_STANDALONE_ASIO"]
+            self.cpp_info.defines.append("USB_ASIO_USE_STANDALONE_ASIO")
+
+        if self.options.transfer_metrics:
+            self.cpp_info.defines.append("USB_ASIO_ENABLE_TRANSFER_METRICS")
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+#include <usb_asio/usb_asio.hpp>
+
+using usb_asio::asio::io_context;
+using usb_asio::list_usb_devices;
+using usb_asio::make_usb_service;
+using usb_asio::usb_busy_poll_options;
+using usb_asio::usb_completion_policy;
+using usb_asio::usb_device;
+using usb_asio::usb_event_handling;
+using usb_asio::usb_in_interrupt_transfer;
+using usb_asio::usb_interface;
+using usb_asio::usb_service_options;
+
+// Measures the submit to completion latency of reads from an interrupt IN endpoint,
+// with the libusb events handled by a blocking event thread, then by a busy-polling one.
+// Completion handlers run on the event thread, so that only the event handling is measured.
+//
+// usage: example_event_latency <vid> <pid> <interface> <endpoint> [reads]
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    auto measure(
+        usb_event_handling const event_handling,
+        std::uint16_t const vendor_id,
+        std::uint16_t const product_id,
+        std::uint8_t const interface_number,
+        std::uint8_t const endpoint,
+        std::size_t const num_reads)
+        -> std::vector<clock::duration>
+    {
+        auto ioc = io_context{};
+        make_usb_service(ioc, usb_service_options{
+            .event_handling = event_handling,
+            .busy_poll = usb_busy_poll_options{},
+        });
+
+        auto dev = usb_device{ioc};
+        for (auto const& dev_info : list_usb_devices(ioc))
+        {
+            auto const desc = dev_info.device_descriptor();
+            if (desc.idVendor == vendor_id && desc.idProduct == product_id)
+            {
+                dev.open(dev_info);
+                break;
+            }
+        }
+
+        if (!dev.is_open())
+        {
+            fmt::print(stderr, "Device {:04x}:{:04x} not found\n", vendor_id, product_id);
+            std::exit(EXIT_FAILURE);
+        }
+
+        auto interface = usb_interface{dev, interface_number};
+        auto transfer = usb_in_interrupt_transfer{dev, endpoint};
+        transfer.set_completion_policy(usb_completion_policy::direct);
+
+        auto buffer = std::array<std::byte, 1024>{};
+        auto latencies = std::vector<clock::duration>{};
+        latencies.reserve(num_reads);
+
+        auto submitted = clock::time_point{};
+        auto read = [&](auto& self) -> void {
+            submitted = clock::now();
+            auto on_read = [&](auto const& ec, std::size_t) {
+                latencies.push_back(clock::now() - submitted);
+                if (!ec && latencies.size() < num_reads)
+                {
+                    self(self);
+                }
+            };
+            transfer.async_read_some(usb_asio::asio::buffer(buffer), on_read);
+        };
+        read(read);
+
+        ioc.run();
+        interface.unclaim();
+
+        return latencies;
+    }
+
+    void print_latencies(std::string const& name, std::vector<clock::duration>& latencies)
+    {
+        if (latencies.empty())
+        {
+            return;
+        }
+
+        std::ranges::sort(latencies);
+        auto const percentile = [&](double const p) {
+            auto const index = static_cast<std::size_t>(p * static_cast<double>(latencies.size() - 1u));
+            return std::chrono::duration_cast<std::chrono::microseconds>(latencies[index]).count();
+        };
+
+        fmt::print(
+            "{:<12} reads {:>7}; p50 {:>6} us; p99 {:>6} us; p99.9 {:>6} us; max {:>6} us\n",
+            name,
+            latencies.size(),
+            percentile(0.5),
+            percentile(0.99),
+            percentile(0.999),
+            percentile(1.0));
+    }
+}  // namespace
+
+auto main(int const argc, char const* const* const argv) -> int
+{
+    if (argc < 5)
+    {
+        fmt::print(stderr, "usage: {} <vid> <pid> <interface> <endpoint> [reads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    auto const vendor_id = static_cast<std::uint16_t>(std::stoul(argv[1], nullptr, 16));
+    auto const product_id = static_cast<std::uint16_t>(std::stoul(argv[2], nullptr, 16));
+    auto const interface_number = static_cast<std::uint8_t>(std::stoul(argv[3], nullptr, 0));
+    auto const endpoint = static_cast<std::uint8_t>(std::stoul(argv[4], nullptr, 0));
+    auto const num_reads = argc > 5 ? std::stoul(argv[5]) : std::size_t{10'000};
+
+    auto blocking = measure(
+        usb_event_handling::event_thread,
+        vendor_id,
+        product_id,
+        interface_number,
+        endpoint,
+        num_reads);
+    print_latencies("blocking", blocking);
+
+    auto busy_poll = measure(
+        usb_event_handling::busy_poll,
+        vendor_id,
+        product_id,
+        interface_number,
+        endpoint,
+        num_reads);
+    print_latencies("busy-poll", busy_poll);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <concepts>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "usb_asio/asio.hpp"
+#include "usb_asio/error.hpp"
+#include "usb_asio/handler_memory.hpp"
+#include "usb_asio/usb_transfer_metrics.hpp"
+
+namespace usb_asio
+{
+    // How the completion handler of an operation is invoked once libusb reports its completion.
+    enum class usb_completion_policy
+    {
+        // Posted to the handler's associated executor.
+        post,
+        // Invoked right away when libusb events are handled by a thread running the handler's
+        // associated executor (see usb_event_handling::reactor), posted otherwise.
+        dispatch,
+        // Invoked right away on the thread handling libusb events, whatever the handler's
+        // associated executor. The handler must be quick, thread-safe and must not throw.
+        // Handlers with a cancellation slot are dispatched instead: the slot must be cleared
+        // on the thread it is signalled from.
+        direct,
+    };
+
+    template <typename Executor, typename Signature>
+    class completion_handler;
+
+    // Type-erased completion handler of an asynchronous operation on a libusb callback.
+    // Invoking it releases the handler storage and posts the handler
+    // to its associated executor (unless the completion policy says otherwise),
+    // keeping the I/O executor busy until then.
+    // The operation can be made cancellable through the handler's associated
+    // cancellation slot with on_cancellation.
+    template <typename Executor, typename... Args>
+    class completion_handler<Executor, void(Args...)>
+    {
+      public:
+        completion_handler() = default;
+
+        template <std::invocable<Args...> T>
+        completion_handler(
+            Executor const& executor,
+            T&& handler,
+            handler_memory& memory,
+            usb_completion_policy const policy = usb_completion_policy::post)
+        {
+            auto const trackedEx = asio::prefer(executor, asio::execution::outstanding_work.tracked);
+            auto const trackedCompletionEx = asio::prefer(
+                asio::get_associated_executor(handler, executor),
+                asio::execution::outstanding_work.tracked);
+            // Unless the handler brings its own allocator, the handler and the completion
+            // posted for it are stored in the recycled slot of the I/O object.
+            auto const alloc = asio::get_associated_allocator(
+                handler,
+                handler_allocator<void>{memory});
+
+            using impl_type = handler_impl<
+                std::decay_t<T>,
+                std::decay_t<decltype(trackedEx)>,
+                std::decay_t<decltype(trackedCompletionEx)>,
+                std::decay_t<decltype(alloc)>>;
+            using impl_alloc_traits = typename std::allocator_traits<
+                std::decay_t<decltype(alloc)>>::template rebind_traits<impl_type>;
+
+            auto impl_alloc = typename impl_alloc_traits::allocator_type{alloc};
+            auto* const impl = impl_alloc_traits::allocate(impl_alloc, 1);
+            try
+            {
+                impl_alloc_traits::construct(
+                    impl_alloc,
+                    impl,
+                    trackedEx,
+                    trackedCompletionEx,
+                    alloc,
+                    policy,
+                    std::forward<T>(handler));
+            }
+            catch (...)
+            {
+                impl_alloc_traits::deallocate(impl_alloc, impl, 1);
+                throw;
+            }
+
+            impl_ = impl;
+
+#ifdef USB_ASIO_HAS_CANCELLATION_SLOT
+            impl_->slot = asio::get_associated_cancellation_slot(impl->handler);
+#endif
+        }
+
+        completion_handler(completion_handler const&) = delete;
+
+        completion_handler(completion_handler&& other) noexcept
+          : impl_{std::exchange(other.impl_, nullptr)}
+        {
+        }
+
+        ~completion_handler() noexcept
+        {
+            reset();
+        }
+
+        void operator()(Args... args)
+        {
+            std::exchange(impl_, nullptr)->complete(false, std::move(args)...);
+        }
+
+        // Completes from within the initiating function, where the handler
+        // must never run inline: always posts, whatever the completion policy.
+        void complete_immediately(Args... args)
+        {
+            std::exchange(impl_, nullptr)->complete(true, std::move(args)...);
+        }
+
+        void reset() noexcept
+        {
+            if (impl_ != nullptr)
+            {
+                clear_slot(impl_->slot);
+                std::exchange(impl_, nullptr)->destroy();
+            }
+        }
+
+        // Installs fn(asio::cancellation_type) to be called when the handler's associated
+        // cancellation slot is signalled, until the handler runs or is destroyed.
+        // Does nothing when the handler has no slot, or without cancellation support in asio.
+        template <typename Fn>
+        void on_cancellation([[maybe_unused]] Fn&& fn)
+        {
+#ifdef USB_ASIO_HAS_CANCELLATION_SLOT
+            if (impl_ != nullptr && impl_->slot.is_connected())
+            {
+                impl_->slot.template emplace<std::decay_t<Fn>>(std::forward<Fn>(fn));
+            }
+#endif
+        }
+
+        // Records when the handler runs in the transfer metrics, see USB_ASIO_ENABLE_TRANSFER_METRICS.
+        void time_handler([[maybe_unused]] detail::handler_timer const& timer) noexcept
+        {
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+            if (impl_ != nullptr)
+            {
+                impl_->timer = timer;
+            }
+#endif
+        }
+
+        [[nodiscard]] explicit operator bool() const noexcept
+        {
+            return impl_ != nullptr;
+        }
+
+        auto operator=(completion_handler const&) = delete;
+
+        auto operator=(completion_handler&& other) noexcept -> completion_handler&
+        {
+            reset();
+            impl_ = std::exchange(other.impl_, nullptr);
+
+            return *this;
+        }
+
+      private:
+#ifdef USB_ASIO_HAS_CANCELLATION_SLOT
+        using cancellation_slot_type = asio::cancellation_slot;
+#else
+        struct cancellation_slot_type
+        {
+            [[nodiscard]] auto is_connected() const noexcept -> bool
+            {
+                return false;
+            }
+
+            void clear() noexcept { }
+        };
+#endif
+
+        static void clear_slot(cancellation_slot_type& slot) noexcept
+        {
+            if (slot.is_connected())
+            {
+                slot.clear();
+            }
+        }
+
+        struct erased_handler
+        {
+            cancellation_slot_type slot;
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+            detail::handler_timer timer;
+#endif
+
+            // Both of these free the handler storage.
+            virtual void complete(bool immediate, Args&&... args) = 0;
+
+            virtual void destroy() noexcept = 0;
+
+          protected:
+            ~erased_handler() noexcept = default;
+        };
+
+        template <typename T,
+                  typename TrackedExecutor,
+                  typename TrackedCompletionExecutor,
+                  typename Alloc>
+        struct handler_impl final : erased_handler
+        {
+            TrackedExecutor executor;
+            TrackedCompletionExecutor completion_executor;
+            Alloc alloc;
+            usb_completion_policy policy;
+            T handler;
+
+            template <typename Handler>
+            handler_impl(
+                TrackedExecutor const& executor,
+                TrackedCompletionExecutor const& completion_executor,
+                Alloc const& alloc,
+                usb_completion_policy const policy,
+                Handler&& handler)
+              : executor{executor}
+              , completion_executor{completion_executor}
+              , alloc{alloc}
+              , policy{policy}
+              , handler{std::forward<Handler>(handler)} { }
+
+            void complete(bool const immediate, Args&&... args) override
+            {
+                // Move everything out and release the storage before posting,
+                // so that the slot can be reused for the posted completion
+                // and then again by an operation started from within the handler.
+                auto const work = std::move(executor);
+                auto const ex = std::move(completion_executor);
+                auto const handler_alloc = alloc;
+                auto completion_policy = immediate ? usb_completion_policy::post : policy;
+                if (completion_policy == usb_completion_policy::direct && this->slot.is_connected())
+                {
+                    // Clearing the slot from the libusb event thread would race with its signal.
+                    completion_policy = usb_completion_policy::dispatch;
+                }
+                auto completion = [slot = this->slot,
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+                                   timer = this->timer,
+#endif
+                                   fn = std::bind_front(std::move(handler), std::move(args)...)]() mutable {
+                    // The cancellation slot is cleared where the handler runs, which is where
+                    // it is signalled from. Until then, a cancellation only targets
+                    // an operation that already completed.
+                    clear_slot(slot);
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+                    timer.handler_invoked();
+#endif
+                    std::move(fn)();
+                };
+                destroy();
+
+                switch (completion_policy)
+                {
+                case usb_completion_policy::direct:
+                    completion();
+                    break;
+                case usb_completion_policy::dispatch:
+                    dispatch_with_allocator(ex, std::move(completion), handler_alloc);
+                    break;
+                case usb_completion_policy::post:
+                default:
+                    post_with_allocator(ex, std::move(completion), handler_alloc);
+                    break;
+                }
+            }
+
+            void destroy() noexcept override
+            {
+                using alloc_traits = typename std::allocator_traits<Alloc>::template rebind_traits<handler_impl>;
+
+                auto impl_alloc = typename alloc_traits::allocator_type{alloc};
+                alloc_traits::destroy(impl_alloc, this);
+                alloc_traits::deallocate(impl_alloc, this, 1);
+            }
+        };
+
+        erased_handler* impl_ = nullptr;
+    };
+}  // namespace usb_asio
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "usb_asio/asio.hpp"
+
+namespace usb_asio
+{
+    // Single-slot storage for the completion handler of an asynchronous operation.
+    // At most one handler of a given I/O object is allocated at any point in time,
+    // so the memory can be recycled from one operation to the next.
+    // Allocations that do not fit (or arrive while the slot is taken) fall back to the heap.
+    // The slot may outlive its handler_memory: a completion still queued in an executor
+    // when the I/O object is destroyed frees it when it is done with it.
+    class handler_memory
+    {
+      public:
+        static constexpr auto initial_capacity = std::size_t{256};
+
+        handler_memory() noexcept = default;
+
+        handler_memory(handler_memory const&) = delete;
+
+        handler_memory(handler_memory&&) = delete;
+
+        ~handler_memory() noexcept
+        {
+            if (block_ != nullptr
+                && block_->state.exchange(block_state::orphaned, std::memory_order_acq_rel) == block_state::idle)
+            {
+                free_block(block_);
+            }
+        }
+
+        [[nodiscard]] auto allocate(std::size_t const size) -> void*
+        {
+            // Only this object touches its block while it is idle.
+            if (block_ == nullptr
+                || (block_->capacity < size && block_->state.load(std::memory_order_acquire) == block_state::idle))
+            {
+                // Grow the recycled block, it is kept around for the next operations.
+                if (block_ != nullptr)
+                {
+                    free_block(std::exchange(block_, nullptr));
+                }
+                block_ = allocate_block(std::max(size, initial_capacity), block_state::idle);
+            }
+
+            auto expected = block_state::idle;
+            if (block_->capacity >= size
+                && block_->state.compare_exchange_strong(expected, block_state::in_use, std::memory_order_acq_rel))
+            {
+                return block_ + 1;
+            }
+
+            return allocate_block(size, block_state::unpooled) + 1;
+        }
+
+        static void deallocate(void* const ptr) noexcept
+        {
+            auto* const block = static_cast<block_header*>(ptr) - 1;
+
+            auto expected = block_state::in_use;
+            if (block->state.load(std::memory_order_relaxed) == block_state::unpooled
+                || !block->state.compare_exchange_strong(expected, block_state::idle, std::memory_order_acq_rel))
+            {
+                // Either not the slot, or the slot of a destroyed handler_memory.
+                free_block(block);
+            }
+        }
+
+        auto operator=(handler_memory const&) = delete;
+
+        auto operator=(handler_memory&&) = delete;
+
+      private:
+        enum class block_state
+        {
+            idle,
+            in_use,
+            orphaned,
+            unpooled,
+        };
+
+        struct alignas(std::max_align_t) block_header
+        {
+            std::atomic<block_state> state;
+            std::size_t capacity;
+        };
+
+        block_header* block_ = nullptr;
+
+        [[nodiscard]] static auto allocate_block(std::size_t const capacity, block_state const state)
+            -> block_header*
+        {
+            return ::new (::operator new(sizeof(block_header) + capacity)) block_header{{state}, capacity};
+        }
+
+        static void free_block(block_header* const block) noexcept
+        {
+            block->~block_header();
+            ::operator delete(block);
+        }
+    };
+
+    template <typename T>
+    class handler_allocator
+    {
+      public:
+        using value_type = T;
+
+        explicit handler_allocator(handler_memory& memory) noexcept
+          : memory_{&memory} { }
+
+        template <typename U>
+        handler_allocator(handler_allocator<U> const& other) noexcept
+          : memory_{other.memory_}
+        {
+        }
+
+        [[nodiscard]] auto allocate(std::size_t const n) -> T*
+        {
+            if constexpr (alignof(T) > alignof(std::max_align_t))
+            {
+                return std::allocator<T>{}.allocate(n);
+            }
+            else
+            {
+                return static_cast<T*>(memory_->allocate(sizeof(T) * n));
+            }
+        }
+
+        void deallocate(T* const ptr, std::size_t const n) noexcept
+        {
+            if constexpr (alignof(T) > alignof(std::max_align_t))
+            {
+                std::allocator<T>{}.deallocate(ptr, n);
+            }
+            else
+            {
+                handler_memory::deallocate(ptr);
+            }
+        }
+
+        friend auto operator==(handler_allocator const&, handler_allocator const&) noexcept
+            -> bool = default;
+
+      private:
+        template <typename>
+        friend class handler_allocator;
+
+        handler_memory* memory_;
+    };
+
+    // Attaches an allocator to a nullary function object, so that asio uses it
+    // to allocate the operation wrapping the function when it is posted.
+    template <typename Fn, typename Alloc>
+    class allocator_bound_fn
+    {
+      public:
+        using allocator_type = Alloc;
+
+        allocator_bound_fn(Fn&& fn, Alloc const& alloc)
+          : fn_{std::move(fn)}
+          , alloc_{alloc}
+        {
+        }
+
+        [[nodiscard]] auto get_allocator() const noexcept -> allocator_type
+        {
+            return alloc_;
+        }
+
+        void operator()()
+        {
+            std::move(fn_)();
+        }
+
+      private:
+        Fn fn_;
+        Alloc alloc_;
+    };
+
+    // Submits fn to the executor through submit (asio::post or asio::dispatch),
+    // allocating the operation with alloc.
+    // Type-erased executors drop the allocator and allocate internally, so when they
+    // wrap an io_context executor (by far the most common case), that one is used directly.
+    template <typename Executor, typename Fn, typename Alloc, typename Submit>
+    void submit_with_allocator(Executor const& executor, Fn&& fn, Alloc const& alloc, Submit&& submit)
+    {
+        using io_executor = asio::io_context::executor_type;
+        using tracked_io_executor = std::decay_t<decltype(asio::prefer(
+            std::declval<io_executor>(),
+            asio::execution::outstanding_work.tracked))>;
+
+        auto bound_fn = allocator_bound_fn{std::forward<Fn>(fn), alloc};
+
+        if constexpr (requires { executor.template target<io_executor>(); })
+        {
+            if (auto const* const io_ex = executor.template target<tracked_io_executor>())
+            {
+                submit(*io_ex, std::move(bound_fn));
+                return;
+            }
+
+            if (auto const* const io_ex = executor.template target<io_executor>())
+            {
+                submit(*io_ex, std::move(bound_fn));
+                return;
+            }
+        }
+
+        submit(executor, std::move(bound_fn));
+    }
+
+    template <typename Executor, typename Fn, typename Alloc>
+    void post_with_allocator(Executor const& executor, Fn&& fn, Alloc const& alloc)
+    {
+        submit_with_allocator(executor, std::forward<Fn>(fn), alloc, [](auto const& ex, auto&& bound_fn) {
+            asio::post(ex, std::move(bound_fn));
+        });
+    }
+
+    // Runs fn right away when called from a thread running the executor, posts it otherwise.
+    template <typename Executor, typename Fn, typename Alloc>
+    void dispatch_with_allocator(Executor const& executor, Fn&& fn, Alloc const& alloc)
+    {
+        submit_with_allocator(executor, std::forward<Fn>(fn), alloc, [](auto const& ex, auto&& bound_fn) {
+            asio::dispatch(ex, std::move(bound_fn));
+        });
+    }
+}  // namespace usb_asio
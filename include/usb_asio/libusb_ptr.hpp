@@ -36,7 +36,7 @@ namespace usb_asio
           : libusb_ref_ptr{} { }
 
         libusb_ref_ptr(pointer const ptr) noexcept
-          : ptr_{ref_libusb_fn(ptr)}
+          : ptr_{ptr != nullptr ? ref_libusb_fn(ptr) : nullptr}
         {
         }
 
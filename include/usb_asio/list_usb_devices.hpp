@@ -7,6 +7,7 @@
 
 #include "usb_asio/asio.hpp"
 #include "usb_asio/error.hpp"
+#include "usb_asio/usb_descriptor_tree.hpp"
 #include "usb_asio/usb_device_info.hpp"
 #include "usb_asio/usb_service.hpp"
 
@@ -44,6 +45,8 @@ namespace usb_asio
             std::back_inserter(result),
             [](auto const handle) { return usb_device_info{handle}; });
 
+        detail::retain_descriptor_trees(context, std::span{device_handles, num_devices});
+
         return result;
     }
 
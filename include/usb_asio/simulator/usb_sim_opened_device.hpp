@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "usb_asio/simulator/usb_simulator.hpp"
+#include "usb_asio/usb_asio.hpp"
+
+namespace usb_asio::sim
+{
+    namespace detail
+    {
+        inline auto next_opened_device_index = std::atomic<std::uint16_t>{0};
+    }
+
+    struct usb_sim_opened_device_config
+    {
+        // Each device gets a product id of its own, counting up from this one.
+        std::uint16_t first_product_id = 0x0c00;
+        std::size_t iso_packet_size = 192;
+    };
+
+    // A simulated device with a bulk IN, a bulk OUT and an isochronous IN endpoint on interface 0,
+    // opened on an io_context with that interface claimed. Each instance plugs its own device,
+    // so that tests and benchmark threads do not see each other's devices.
+    class usb_sim_opened_device
+    {
+      public:
+        static constexpr auto bulk_in_endpoint = std::uint8_t{0x81};
+        static constexpr auto bulk_out_endpoint = std::uint8_t{0x02};
+        static constexpr auto iso_in_endpoint = std::uint8_t{0x83};
+
+        usb_sim_opened_device(
+            asio::io_context& ioc,
+            usb_sim_opened_device_config const& config,
+            usb_service_options const& options = {})
+          : product_id_{static_cast<std::uint16_t>(
+              config.first_product_id + detail::next_opened_device_index.fetch_add(1u, std::memory_order_relaxed))}
+          , sim_device_{make_config(product_id_, config.iso_packet_size)}
+          , device_{open_device(ioc, options, product_id_)}
+          , interface_{device_, 0}
+        {
+        }
+
+        usb_sim_opened_device(usb_sim_opened_device const&) = delete;
+
+        ~usb_sim_opened_device() noexcept = default;
+
+        [[nodiscard]] auto device() noexcept -> usb_device&
+        {
+            return device_;
+        }
+
+        [[nodiscard]] auto sim_device() noexcept -> usb_sim_device&
+        {
+            return sim_device_;
+        }
+
+        auto operator=(usb_sim_opened_device const&) = delete;
+
+      private:
+        [[nodiscard]] static auto make_config(std::uint16_t const product_id, std::size_t const iso_packet_size)
+            -> usb_sim_device_config
+        {
+            return usb_sim_device_config{
+                .vendor_id = 0x1209,
+                .product_id = product_id,
+                .interfaces = {{
+                    .number = 0,
+                    .alt_settings = {{
+                        {.address = bulk_in_endpoint},
+                        {.address = bulk_out_endpoint},
+                        {
+                            .address = iso_in_endpoint,
+                            .type = usb_transfer_type::isochronous,
+                            .max_packet_size = static_cast<std::uint16_t>(iso_packet_size),
+                            .interval = 1,
+                        },
+                    }},
+                }},
+            };
+        }
+
+        [[nodiscard]] static auto open_device(
+            asio::io_context& ioc,
+            usb_service_options const& options,
+            std::uint16_t const product_id)
+            -> usb_device
+        {
+            make_usb_service(ioc, options);
+            for (auto const& info : list_usb_devices(ioc))
+            {
+                if (info.device_descriptor().idProduct == product_id)
+                {
+                    return usb_device{ioc, info};
+                }
+            }
+
+            throw std::runtime_error{"simulated device not found"};
+        }
+
+        std::uint16_t product_id_;
+        usb_sim_device sim_device_;
+        usb_device device_;
+        usb_interface interface_;
+    };
+}  // namespace usb_asio::sim
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "usb_asio/flags.hpp"
+#include "usb_asio/simulator/usb_simulator.hpp"
+
+// Replays recorded device sessions on simulated devices: transfers submitted to the device
+// complete like the recorded ones did, with the recorded data and status, so that code on top
+// of usb_asio can be run and benchmarked on production traffic without the hardware.
+namespace usb_asio::sim
+{
+    enum class usb_sim_replay_timing
+    {
+        // Transfers take as long as they took when recorded.
+        original,
+        // Transfers complete as soon as they are submitted.
+        as_fast_as_possible,
+    };
+
+    // A transfer of a recording, as replayed.
+    struct usb_sim_recorded_transfer
+    {
+        // Endpoint address, 0 for control transfers.
+        std::uint8_t endpoint = 0;
+        usb_transfer_type type = usb_transfer_type::bulk;
+        // Time the endpoint spent on it: from its submission, or from the previous completion on
+        // the endpoint if later, to its completion. Unknown if the submission was not recorded.
+        std::optional<std::chrono::nanoseconds> duration = {};
+        usb_sim_response response = {};
+    };
+
+    // The transfers of a device read from a pcap file of usbmon records (LINKTYPE_USB_LINUX or
+    // LINKTYPE_USB_LINUX_MMAPPED), as written by usb_asio::usb_capture or captured from usbmon.
+    // Payloads truncated by the capture are replayed padded with zeros. Transfers that timed out
+    // or were cancelled are replayed as the device NAKing for as long as it did, since it is up
+    // to the host to time them out or cancel them again.
+    class usb_sim_recording
+    {
+      public:
+        // Takes the transfers of the device at bus_number and device_address, or of the first device
+        // with transfers on other endpoints than endpoint 0 when device_address is 0.
+        // Throws std::runtime_error if the file cannot be read or is not a usbmon capture.
+        [[nodiscard]] static auto load(
+            std::filesystem::path const& path,
+            std::uint8_t bus_number = 0,
+            std::uint8_t device_address = 0)
+            -> usb_sim_recording;
+
+        [[nodiscard]] auto bus_number() const noexcept -> std::uint8_t
+        {
+            return bus_number_;
+        }
+
+        [[nodiscard]] auto device_address() const noexcept -> std::uint8_t
+        {
+            return device_address_;
+        }
+
+        // In completion order.
+        [[nodiscard]] auto transfers() const noexcept -> std::span<usb_sim_recorded_transfer const>
+        {
+            return transfers_;
+        }
+
+        // A device with a single interface holding every recorded endpoint, for when the configuration
+        // of the recorded device is not at hand. Its vendor and product ids are 0.
+        [[nodiscard]] auto device_config() const -> usb_sim_device_config;
+
+        // Queues the recorded completions on the endpoints of the device, answering its next transfers
+        // in order. Recorded durations replace the latency and bandwidth of the endpoints.
+        void replay(usb_sim_device& device, usb_sim_replay_timing timing = usb_sim_replay_timing::original) const;
+
+      private:
+        std::uint8_t bus_number_ = 0;
+        std::uint8_t device_address_ = 0;
+        std::vector<usb_sim_recorded_transfer> transfers_;
+    };
+}  // namespace usb_asio::sim
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "usb_asio/flags.hpp"
+
+// In-process USB device simulator, implementing the libusb API.
+// Linking usb_asio::simulator instead of libusb makes everything in usb_asio
+// (devices, transfers, hotplug, the event handling of usb_service...) target simulated
+// devices, so that code using usb_asio can be tested and benchmarked without hardware.
+// The simulated devices are global to the process, like the real ones.
+namespace usb_asio::sim
+{
+    namespace detail
+    {
+        struct sim_device;
+    }
+
+    struct usb_sim_endpoint
+    {
+        std::uint8_t address = 0;
+        usb_transfer_type type = usb_transfer_type::bulk;
+        std::uint16_t max_packet_size = 512;
+        // Packets per burst, super speed devices only.
+        std::uint8_t max_burst = 1;
+        std::uint8_t interval = 0;
+        // Time between the start of a transfer and its completion, on top of the time
+        // it takes to move its data.
+        std::chrono::nanoseconds latency = {};
+        // Unlimited when 0. Transfers on an endpoint run one after the other.
+        std::uint64_t bytes_per_second = 0;
+    };
+
+    struct usb_sim_interface
+    {
+        std::uint8_t number = 0;
+        std::uint8_t interface_class = 0xff;
+        // Endpoints of each alt setting, starting with alt setting 0.
+        std::vector<std::vector<usb_sim_endpoint>> alt_settings = {{}};
+    };
+
+    struct usb_sim_device_config
+    {
+        std::uint16_t vendor_id = 0;
+        std::uint16_t product_id = 0;
+        std::uint8_t device_class = 0;
+        usb_speed speed = usb_speed::high;
+        std::uint8_t bus_number = 1;
+        // Ports from the root hub to the device.
+        std::vector<std::uint8_t> port_numbers = {1};
+        std::uint8_t configuration_value = 1;
+        std::vector<usb_sim_interface> interfaces = {};
+    };
+
+    enum class usb_sim_response_type
+    {
+        // IN transfers get the data, overflowing if it does not fit.
+        // OUT transfers only move as many bytes as the data has.
+        data,
+        // The endpoint halts, the transfer completes with a stall.
+        stall,
+        // The device NAKs for nak_duration, then handles the transfer with the next response.
+        // Transfers with a shorter timeout time out. A transfer timing out or cancelled
+        // before then leaves that response to the next one.
+        nak,
+        // Bus error.
+        error,
+    };
+
+    struct usb_sim_response
+    {
+        usb_sim_response_type type = usb_sim_response_type::data;
+        std::vector<std::byte> data = {};
+        std::chrono::nanoseconds nak_duration = {};
+        // How long the transfer takes once started, instead of the endpoint's latency and bandwidth.
+        std::optional<std::chrono::nanoseconds> duration = {};
+        // Bytes of the data going to each isochronous packet, the data fills the packets in order otherwise.
+        std::vector<std::size_t> packet_lengths = {};
+    };
+
+    // Sources and sinks run on the thread submitting the transfer, from within libusb_submit_transfer.
+    // They may script the device (queue responses, set sources and sinks, unplug it), but must not
+    // submit transfers on their own endpoint, whose submissions wait for them.
+
+    // Fills the buffer of an IN transfer (or isochronous packet), returns the number of bytes written.
+    using usb_sim_in_source = std::function<std::size_t(std::span<std::byte>)>;
+    // Receives the data of an OUT transfer (or isochronous packet).
+    using usb_sim_out_sink = std::function<void(std::span<std::byte const>)>;
+
+    // A simulated device, plugged in from construction until unplugged or destroyed.
+    // Transfers are handled in the order they are submitted, with the responses queued
+    // on their endpoint (control transfers use endpoint 0), falling back to the endpoint's
+    // source or sink: IN transfers are filled with zeros and OUT data is dropped by default.
+    // Thread-safe.
+    class usb_sim_device
+    {
+      public:
+        explicit usb_sim_device(usb_sim_device_config config);
+
+        usb_sim_device(usb_sim_device const&) = delete;
+
+        usb_sim_device(usb_sim_device&& other) noexcept = default;
+
+        ~usb_sim_device() noexcept;
+
+        // Pending transfers complete with usb_transfer_errc::no_device, and using the device
+        // fails with usb_errc::no_device from then on. Hotplug monitors see it leave.
+        void unplug() noexcept;
+
+        [[nodiscard]] auto is_plugged() const noexcept -> bool;
+
+        void queue_response(std::uint8_t endpoint_address, usb_sim_response response);
+
+        void set_in_source(std::uint8_t endpoint_address, usb_sim_in_source source);
+
+        void set_out_sink(std::uint8_t endpoint_address, usb_sim_out_sink sink);
+
+        // Transfers completed on the endpoint so far, whatever their status.
+        [[nodiscard]] auto completed_transfers(std::uint8_t endpoint_address) const -> std::size_t;
+
+        auto operator=(usb_sim_device const&) = delete;
+
+        auto operator=(usb_sim_device&& other) noexcept -> usb_sim_device&;
+
+      private:
+        std::shared_ptr<detail::sim_device> state_;
+    };
+}  // namespace usb_asio::sim
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+
+namespace usb_asio::detail
+{
+    // Base of the state an I/O object shares with the transfers it keeps in flight.
+    // The state is deleted by whoever lets go of it last: the I/O object closing it,
+    // a transfer completing, or a completion handler invoked outside the lock (which
+    // still allocates the posted completion from the state's handler memory).
+    template <typename Derived>
+    class transfer_owner
+    {
+      public:
+        std::mutex mutex;
+        std::size_t in_flight = 0;
+        bool closed = false;
+
+        // Invokes the handler without holding the lock, keeping the state alive meanwhile.
+        template <typename Handler, typename... Args>
+        void invoke_unlocked(
+            std::unique_lock<std::mutex>& lock,
+            Handler& handler,
+            bool const immediate,
+            Args const&... args)
+        {
+            ++delivering_;
+            lock.unlock();
+            if (immediate)
+            {
+                handler.complete_immediately(args...);
+            }
+            else
+            {
+                handler(args...);
+            }
+            lock.lock();
+            --delivering_;
+        }
+
+        // Deletes the state once it is closed and nothing uses it anymore.
+        // Expects the lock to be held, and releases it in that case.
+        void release(std::unique_lock<std::mutex>& lock) noexcept
+        {
+            if (closed && in_flight == 0 && delivering_ == 0)
+            {
+                lock.unlock();
+                delete static_cast<Derived*>(this);
+            }
+        }
+
+      private:
+        std::size_t delivering_ = 0;
+    };
+}  // namespace usb_asio::detail
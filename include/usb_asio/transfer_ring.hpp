@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include <libusb.h>
+#include "usb_asio/completion_handler.hpp"
+#include "usb_asio/error.hpp"
+#include "usb_asio/handler_memory.hpp"
+#include "usb_asio/libusb_ptr.hpp"
+#include "usb_asio/transfer_owner.hpp"
+#include "usb_asio/usb_service.hpp"
+
+namespace usb_asio::detail
+{
+    enum class ring_slot_state
+    {
+        idle,
+        in_flight,
+        completed,
+        lent,
+    };
+
+    // A transfer of a transfer_ring, with its buffer.
+    // Derived slots add the results the stream hands out.
+    template <typename Owner>
+    struct ring_slot
+    {
+        Owner* owner;
+        libusb_ptr<::libusb_transfer, &::libusb_free_transfer> transfer;
+        std::pmr::vector<std::byte> buffer;
+        ring_slot_state state = ring_slot_state::idle;
+        error_code ec = {};
+
+        ring_slot(
+            Owner* const owner,
+            int const num_iso_packets,
+            std::size_t const buffer_size,
+            std::pmr::memory_resource* const mem_resource)
+          : owner{owner}
+          , transfer{::libusb_alloc_transfer(num_iso_packets)}
+          , buffer(buffer_size, mem_resource)
+        {
+            if (transfer == nullptr)
+            {
+                throw std::bad_alloc{};
+            }
+        }
+    };
+
+    // Ring of transfers kept submitted on an endpoint, handed out in submission order,
+    // shared by the streams. Derived (the stream's state) fills the transfers in and provides:
+    // - clear_results(Slot&), for slots handed out without having completed,
+    // - on_completed(Slot&, libusb_transfer const&), with the mutex held,
+    // - deliver(Slot&, lock, immediate), handing the completed head slot to a pending handler if any,
+    // - reset_handlers(), dropping the pending handlers once closed.
+    template <typename Derived, typename Slot>
+    class transfer_ring : public transfer_owner<Derived>
+    {
+      public:
+        std::vector<Slot> slots;
+        std::size_t head = 0;
+        bool started = false;
+        bool streaming = false;
+        handler_memory memory;
+        usb_completion_policy policy = usb_completion_policy::post;
+
+        transfer_ring(
+            std::size_t const num_transfers,
+            int const num_iso_packets,
+            std::size_t const buffer_size,
+            std::pmr::memory_resource* const mem_resource)
+        {
+            if (num_transfers == 0)
+            {
+                throw std::invalid_argument{"A stream needs at least one transfer"};
+            }
+
+            // Never reallocated, the transfers point to their slot.
+            slots.reserve(num_transfers);
+            for (auto i = std::size_t{0}; i < num_transfers; ++i)
+            {
+                slots.emplace_back(static_cast<Derived*>(this), num_iso_packets, buffer_size, mem_resource);
+            }
+        }
+
+        transfer_ring(transfer_ring const&) = delete;
+        auto operator=(transfer_ring const&) = delete;
+
+        // The functions below expect the mutex to be held.
+
+        void start(error_code& ec) noexcept
+        {
+            ec.clear();
+            started = true;
+            streaming = true;
+
+            // Keep the ring order, starting from the next slot to be handed out.
+            for (auto i = std::size_t{0}; i < slots.size(); ++i)
+            {
+                auto& s = slots[(head + i) % slots.size()];
+                if (s.state == ring_slot_state::idle)
+                {
+                    submit(s);
+                    if (s.ec)
+                    {
+                        ec = s.ec;
+                        return;
+                    }
+                }
+            }
+        }
+
+        void start_once() noexcept
+        {
+            if (!started)
+            {
+                auto ec = error_code{};
+                start(ec);
+            }
+        }
+
+        void stop() noexcept
+        {
+            streaming = false;
+            for (auto& s : slots)
+            {
+                if (s.state == ring_slot_state::in_flight)
+                {
+                    ::libusb_cancel_transfer(s.transfer.get());
+                }
+            }
+        }
+
+        void release_lent_slot() noexcept
+        {
+            auto& lent = slots[(head + slots.size() - 1) % slots.size()];
+            if (lent.state == ring_slot_state::lent)
+            {
+                recycle(lent);
+            }
+        }
+
+        // Hands the head slot out until the next read.
+        void lend_head() noexcept
+        {
+            slots[head].state = ring_slot_state::lent;
+            head = (head + 1) % slots.size();
+        }
+
+        // Resubmits the head slot right away.
+        void recycle_head() noexcept
+        {
+            auto& s = slots[head];
+            head = (head + 1) % slots.size();
+            recycle(s);
+        }
+
+        // Immediate deliveries happen from within the initiating function.
+        void try_deliver(std::unique_lock<std::mutex>& lock, bool const immediate)
+        {
+            auto& s = slots[head];
+            if (s.state == ring_slot_state::idle && !streaming)
+            {
+                // Nothing will ever complete in this slot once stopped,
+                // hand it out empty instead of waiting forever.
+                s.ec = usb_transfer_errc::cancelled;
+                derived().clear_results(s);
+                s.state = ring_slot_state::completed;
+            }
+
+            if (s.state == ring_slot_state::completed)
+            {
+                derived().deliver(s, lock, immediate);
+            }
+        }
+
+        // Called by the I/O object instead of deleting the state.
+        // In-flight transfers and handlers being invoked keep it alive until they are done.
+        void close() noexcept
+        {
+            auto lock = std::unique_lock{this->mutex};
+            this->closed = true;
+            derived().reset_handlers();
+            stop();
+            this->release(lock);
+        }
+
+        static void completion_callback(::libusb_transfer* const transfer) noexcept
+        {
+            detail::count_handled_event();
+
+            auto& s = *static_cast<Slot*>(transfer->user_data);
+            auto* const self = s.owner;
+            auto lock = std::unique_lock{self->mutex};
+
+            --self->in_flight;
+            s.state = ring_slot_state::completed;
+            s.ec = transfer->status == ::LIBUSB_TRANSFER_COMPLETED
+                       ? error_code{}
+                       : error_code{static_cast<usb_transfer_errc>(transfer->status)};
+            if (s.ec && s.ec != usb_transfer_errc::timeout)
+            {
+                self->streaming = false;
+            }
+            self->on_completed(s, *transfer);
+
+            if (!self->closed)
+            {
+                self->try_deliver(lock, false);
+            }
+            self->release(lock);
+        }
+
+      private:
+        [[nodiscard]] auto derived() noexcept -> Derived&
+        {
+            return static_cast<Derived&>(*this);
+        }
+
+        void submit(Slot& s) noexcept
+        {
+            libusb_try(s.ec, &::libusb_submit_transfer, s.transfer.get());
+
+            if (s.ec)
+            {
+                // Handed out as a failed transfer.
+                derived().clear_results(s);
+                s.state = ring_slot_state::completed;
+                streaming = false;
+            }
+            else
+            {
+                s.state = ring_slot_state::in_flight;
+                ++this->in_flight;
+            }
+        }
+
+        void recycle(Slot& s) noexcept
+        {
+            s.state = ring_slot_state::idle;
+            if (streaming && !this->closed)
+            {
+                submit(s);
+            }
+        }
+    };
+}  // namespace usb_asio::detail
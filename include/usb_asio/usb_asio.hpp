@@ -1,12 +1,27 @@
 #pragma once
 
 #include "usb_asio/asio.hpp"
+#include "usb_asio/completion_handler.hpp"
 #include "usb_asio/error.hpp"
 #include "usb_asio/flags.hpp"
+#include "usb_asio/handler_memory.hpp"
 #include "usb_asio/list_usb_devices.hpp"
+#include "usb_asio/usb_bulk_in_stream.hpp"
+#include "usb_asio/usb_capture.hpp"
+#include "usb_asio/usb_descriptor_tree.hpp"
 #include "usb_asio/usb_device.hpp"
+#include "usb_asio/usb_device_enumerator.hpp"
 #include "usb_asio/usb_device_info.hpp"
+#include "usb_asio/usb_dma_pool_resource.hpp"
 #include "usb_asio/usb_dma_resource.hpp"
+#include "usb_asio/usb_endpoint.hpp"
+#include "usb_asio/usb_event_reactor.hpp"
+#include "usb_asio/usb_hotplug_monitor.hpp"
 #include "usb_asio/usb_interface.hpp"
+#include "usb_asio/usb_iso_in_stream.hpp"
+#include "usb_asio/usb_pipe.hpp"
 #include "usb_asio/usb_service.hpp"
+#include "usb_asio/usb_thread_scheduling.hpp"
 #include "usb_asio/usb_transfer.hpp"
+#include "usb_asio/usb_transfer_batch.hpp"
+#include "usb_asio/usb_transfer_metrics.hpp"
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <libusb.h>
+#include "usb_asio/asio.hpp"
+#include "usb_asio/completion_handler.hpp"
+#include "usb_asio/error.hpp"
+#include "usb_asio/transfer_ring.hpp"
+#include "usb_asio/usb_device.hpp"
+#include "usb_asio/usb_transfer.hpp"
+
+namespace usb_asio
+{
+    // Continuous reader of a bulk IN endpoint.
+    // Keeps a ring of transfers submitted on the endpoint, so that it never idles between
+    // a completion and the next read. Filled buffers are handed out in submission order.
+    // Transfer sizes should be a multiple of the endpoint's max packet size.
+    template <typename Executor = asio::any_io_executor>
+    class basic_usb_bulk_in_stream
+    {
+      public:
+        using executor_type = Executor;
+        using buffer_handler_sig = void(error_code, std::span<std::byte const>);
+        using read_handler_sig = void(error_code, std::size_t);
+
+        template <typename OtherExecutor>
+        basic_usb_bulk_in_stream(
+            executor_type const& executor,
+            basic_usb_device<OtherExecutor>& device,
+            std::uint8_t const endpoint,
+            std::size_t const num_transfers,
+            std::size_t const transfer_size,
+            std::chrono::milliseconds const timeout = usb_no_timeout,
+            std::pmr::memory_resource* const mem_resource = std::pmr::get_default_resource())
+          : executor_{executor}
+          , state_{new stream_state{
+                device.handle(),
+                endpoint,
+                num_transfers,
+                transfer_size,
+                timeout,
+                mem_resource,
+            }}
+        {
+        }
+
+        template <std::convertible_to<executor_type> OtherExecutor>
+        basic_usb_bulk_in_stream(
+            basic_usb_device<OtherExecutor>& device,
+            std::uint8_t const endpoint,
+            std::size_t const num_transfers,
+            std::size_t const transfer_size,
+            std::chrono::milliseconds const timeout = usb_no_timeout,
+            std::pmr::memory_resource* const mem_resource = std::pmr::get_default_resource())
+          : basic_usb_bulk_in_stream{
+              device.get_executor(),
+              device,
+              endpoint,
+              num_transfers,
+              transfer_size,
+              timeout,
+              mem_resource,
+          }
+        {
+        }
+
+        basic_usb_bulk_in_stream(basic_usb_bulk_in_stream const&) = delete;
+
+        basic_usb_bulk_in_stream(basic_usb_bulk_in_stream&& other) noexcept
+          : executor_{other.executor_}
+          , state_{std::exchange(other.state_, nullptr)}
+        {
+        }
+
+        ~basic_usb_bulk_in_stream() noexcept
+        {
+            if (state_ != nullptr)
+            {
+                // In-flight transfers keep the state alive until they complete.
+                state_->close();
+            }
+        }
+
+        // Submits every transfer that is not in flight.
+        // Called implicitly by the first read.
+        void start()
+        {
+            try_with_ec([&](auto& ec) {
+                start(ec);
+            });
+        }
+
+        void start(error_code& ec) noexcept
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            state_->start(ec);
+        }
+
+        // Stops resubmitting transfers and cancels those in flight.
+        // They are still handed out in order, with usb_transfer_errc::cancelled.
+        void cancel() noexcept
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            state_->stop();
+        }
+
+        [[nodiscard]] auto is_streaming() const noexcept -> bool
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            return state_->streaming;
+        }
+
+        [[nodiscard]] auto num_transfers() const noexcept -> std::size_t
+        {
+            return state_->slots.size();
+        }
+
+        [[nodiscard]] auto transfer_size() const noexcept -> std::size_t
+        {
+            return state_->transfer_size;
+        }
+
+        [[nodiscard]] auto completion_policy() const noexcept -> usb_completion_policy
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            return state_->policy;
+        }
+
+        // Applies to the operations started afterwards.
+        void set_completion_policy(usb_completion_policy const policy) noexcept
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            state_->policy = policy;
+        }
+
+        [[nodiscard]] auto get_executor() const noexcept -> executor_type
+        {
+            return executor_;
+        }
+
+        // Completes with the next filled transfer buffer, without copying.
+        // The buffer stays valid until the next read, which resubmits its transfer.
+        // Transfers that fail with anything but a timeout stop the stream,
+        // call start() to resume it once the endpoint is recovered.
+        template <typename CompletionToken = asio::default_completion_token_t<executor_type>>
+        auto async_read_buffer(CompletionToken&& token = {})
+        {
+            return asio::async_initiate<CompletionToken, buffer_handler_sig>(
+                [](auto completion_handler, stream_state* const state, executor_type const& executor) {
+                    auto lock = std::unique_lock{state->mutex};
+                    state->buffer_handler = buffer_handler_t{
+                        executor,
+                        std::move(completion_handler),
+                        state->memory,
+                        state->policy,
+                    };
+                    state->release_lent_slot();
+                    state->start_once();
+                    state->try_deliver(lock, true);
+                },
+                std::forward<CompletionToken>(token),
+                state_,
+                executor_);
+        }
+
+        // Copies the data of the next filled transfers into the buffer.
+        // A transfer is resubmitted as soon as all of its data has been consumed.
+        template <typename CompletionToken = asio::default_completion_token_t<executor_type>>
+        auto async_read_some(asio::mutable_buffer const buffer, CompletionToken&& token = {})
+        {
+            return asio::async_initiate<CompletionToken, read_handler_sig>(
+                [](auto completion_handler, stream_state* const state, executor_type const& executor, asio::mutable_buffer const buffer) {
+                    auto lock = std::unique_lock{state->mutex};
+                    state->read_handler = read_handler_t{
+                        executor,
+                        std::move(completion_handler),
+                        state->memory,
+                        state->policy,
+                    };
+                    state->read_buffer = buffer;
+                    state->release_lent_slot();
+                    state->start_once();
+                    state->try_deliver(lock, true);
+                },
+                std::forward<CompletionToken>(token),
+                state_,
+                executor_,
+                buffer);
+        }
+
+        auto operator=(basic_usb_bulk_in_stream const&) = delete;
+
+        auto operator=(basic_usb_bulk_in_stream&& other) noexcept -> basic_usb_bulk_in_stream&
+        {
+            if (this != &other)
+            {
+                if (state_ != nullptr)
+                {
+                    state_->close();
+                }
+
+                executor_ = other.executor_;
+                state_ = std::exchange(other.state_, nullptr);
+            }
+
+            return *this;
+        }
+
+      private:
+        using buffer_handler_t = completion_handler<Executor, buffer_handler_sig>;
+        using read_handler_t = completion_handler<Executor, read_handler_sig>;
+
+        struct stream_state;
+
+        struct slot : detail::ring_slot<stream_state>
+        {
+            using detail::ring_slot<stream_state>::ring_slot;
+
+            std::size_t length = 0;
+            std::size_t consumed = 0;
+        };
+
+        struct stream_state : detail::transfer_ring<stream_state, slot>
+        {
+            std::size_t transfer_size;
+            buffer_handler_t buffer_handler;
+            read_handler_t read_handler;
+            asio::mutable_buffer read_buffer;
+
+            stream_state(
+                ::libusb_device_handle* const device_handle,
+                std::uint8_t const endpoint,
+                std::size_t const num_transfers,
+                std::size_t const transfer_size,
+                std::chrono::milliseconds const timeout,
+                std::pmr::memory_resource* const mem_resource)
+              : detail::transfer_ring<stream_state, slot>{num_transfers, 0, transfer_size, mem_resource}
+              , transfer_size{transfer_size}
+            {
+                for (auto& s : this->slots)
+                {
+                    ::libusb_fill_bulk_transfer(
+                        s.transfer.get(),
+                        device_handle,
+                        endpoint,
+                        reinterpret_cast<unsigned char*>(s.buffer.data()),
+                        static_cast<int>(s.buffer.size()),
+                        &stream_state::completion_callback,
+                        &s,
+                        static_cast<unsigned>(timeout.count()));
+                }
+            }
+
+            // The functions below expect the mutex to be held.
+
+            void clear_results(slot& s) noexcept
+            {
+                s.length = 0;
+                s.consumed = 0;
+            }
+
+            void on_completed(slot& s, ::libusb_transfer const& transfer) noexcept
+            {
+                s.length = static_cast<std::size_t>(transfer.actual_length);
+                s.consumed = 0;
+            }
+
+            void deliver(slot& s, std::unique_lock<std::mutex>& lock, bool const immediate)
+            {
+                if (buffer_handler)
+                {
+                    auto const ec = s.ec;
+                    auto const data = std::span<std::byte const>{s.buffer.data(), s.length};
+                    this->lend_head();
+
+                    auto handler = std::move(buffer_handler);
+                    this->invoke_unlocked(lock, handler, immediate, ec, data);
+                }
+                else if (read_handler)
+                {
+                    auto const ec = s.ec;
+                    auto const remaining = std::span{s.buffer}.subspan(s.consumed, s.length - s.consumed);
+                    auto const n = std::min(remaining.size(), read_buffer.size());
+                    std::memcpy(read_buffer.data(), remaining.data(), n);
+                    s.consumed += n;
+
+                    if (s.consumed == s.length)
+                    {
+                        this->recycle_head();
+                    }
+
+                    auto handler = std::move(read_handler);
+                    this->invoke_unlocked(lock, handler, immediate, ec, n);
+                }
+            }
+
+            void reset_handlers() noexcept
+            {
+                buffer_handler.reset();
+                read_handler.reset();
+            }
+        };
+
+        executor_type executor_;
+        stream_state* state_;
+    };
+
+    using usb_bulk_in_stream = basic_usb_bulk_in_stream<>;
+}  // namespace usb_asio
@@ -0,0 +1,628 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <libusb.h>
+#include "usb_asio/asio.hpp"
+#include "usb_asio/error.hpp"
+
+namespace usb_asio
+{
+    struct usb_capture_options
+    {
+        // pcap file written, replaced if it exists.
+        std::filesystem::path path;
+        // Payload bytes kept per record, the rest is truncated.
+        std::size_t snap_length = 64;
+        // Isochronous packet descriptors kept per record.
+        std::size_t max_iso_descriptors = 16;
+        // Captures one transfer submission (and its completion) out of sample_every, none if 0.
+        std::uint32_t sample_every = 1;
+        // Records buffered before the writer thread gets to them. Records that do not fit are dropped.
+        std::size_t ring_slots = 4096;
+        // How often the writer thread writes the buffered records out.
+        std::chrono::milliseconds flush_interval = std::chrono::milliseconds{100};
+    };
+
+    namespace detail
+    {
+        // Bounded multi-producer single-consumer queue of fixed-size slots, never blocking the producers
+        // (see Dmitry Vyukov's bounded MPMC queue).
+        class capture_ring
+        {
+          public:
+            capture_ring(std::size_t const num_slots, std::size_t const slot_capacity)
+              : mask_{std::bit_ceil(std::max(num_slots, std::size_t{2})) - 1u}
+              , slot_capacity_{slot_capacity}
+              , slots_(mask_ + 1u)
+              , storage_(slots_.size() * slot_capacity_)
+            {
+                for (auto i = std::size_t{0}; i < slots_.size(); ++i)
+                {
+                    slots_[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            [[nodiscard]] auto slot_capacity() const noexcept -> std::size_t
+            {
+                return slot_capacity_;
+            }
+
+            // Writes a record of at most slot_capacity bytes with fill(std::span<std::byte>) -> size.
+            // Returns false, without calling fill, if the ring is full.
+            template <typename Fill>
+            auto try_push(Fill&& fill) noexcept -> bool
+            {
+                auto position = enqueue_position_.load(std::memory_order_relaxed);
+                while (true)
+                {
+                    auto& slot = slots_[position & mask_];
+                    auto const sequence = slot.sequence.load(std::memory_order_acquire);
+                    if (sequence == position)
+                    {
+                        if (enqueue_position_.compare_exchange_weak(position, position + 1u, std::memory_order_relaxed))
+                        {
+                            break;
+                        }
+                    }
+                    else if (sequence < position)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        position = enqueue_position_.load(std::memory_order_relaxed);
+                    }
+                }
+
+                auto const index = position & mask_;
+                slots_[index].size = fill(std::span{storage_.data() + index * slot_capacity_, slot_capacity_});
+                slots_[index].sequence.store(position + 1u, std::memory_order_release);
+                return true;
+            }
+
+            // Passes the records to consume(std::span<std::byte const>) in order, up to the first one
+            // still being written. Only one thread may pop.
+            template <typename Consume>
+            void pop_all(Consume&& consume)
+            {
+                while (true)
+                {
+                    auto const index = dequeue_position_ & mask_;
+                    auto& slot = slots_[index];
+                    if (slot.sequence.load(std::memory_order_acquire) != dequeue_position_ + 1u)
+                    {
+                        return;
+                    }
+
+                    consume(std::span<std::byte const>{storage_.data() + index * slot_capacity_, slot.size});
+                    slot.sequence.store(dequeue_position_ + mask_ + 1u, std::memory_order_release);
+                    ++dequeue_position_;
+                }
+            }
+
+          private:
+            struct slot
+            {
+                std::atomic<std::size_t> sequence = 0;
+                std::size_t size = 0;
+            };
+
+            std::size_t mask_;
+            std::size_t slot_capacity_;
+            std::vector<slot> slots_;
+            std::vector<std::byte> storage_;
+            alignas(64) std::atomic<std::size_t> enqueue_position_ = 0;
+            alignas(64) std::size_t dequeue_position_ = 0;
+        };
+
+        // Linux usbmon binary record header, as read by Wireshark for LINKTYPE_USB_LINUX_MMAPPED.
+        struct usbmon_packet
+        {
+            std::uint64_t id;
+            char type;
+            std::uint8_t transfer_type;
+            std::uint8_t endpoint;
+            std::uint8_t device_address;
+            std::uint16_t bus_number;
+            char flag_setup;
+            char flag_data;
+            std::int64_t ts_sec;
+            std::int32_t ts_usec;
+            std::int32_t status;
+            std::uint32_t length;
+            std::uint32_t captured_length;
+            union
+            {
+                std::uint8_t setup[8];
+                struct
+                {
+                    std::int32_t error_count;
+                    std::int32_t num_descriptors;
+                } iso;
+            } s;
+            std::int32_t interval;
+            std::int32_t start_frame;
+            std::uint32_t transfer_flags;
+            std::uint32_t num_descriptors;
+        };
+        static_assert(sizeof(usbmon_packet) == 64);
+
+        struct usbmon_iso_descriptor
+        {
+            std::int32_t status;
+            std::uint32_t offset;
+            std::uint32_t length;
+            std::uint32_t padding;
+        };
+        static_assert(sizeof(usbmon_iso_descriptor) == 16);
+
+        struct pcap_record_header
+        {
+            std::uint32_t ts_sec;
+            std::uint32_t ts_usec;
+            std::uint32_t captured_length;
+            std::uint32_t length;
+        };
+
+        enum class usbmon_event : char
+        {
+            submit = 'S',
+            complete = 'C',
+            submit_error = 'E',
+        };
+
+        // Statuses are Linux errnos, whatever the system capturing.
+        [[nodiscard]] constexpr auto usbmon_status(::libusb_transfer_status const status) noexcept -> std::int32_t
+        {
+            switch (status)
+            {
+            case ::LIBUSB_TRANSFER_COMPLETED:
+                return 0;
+            case ::LIBUSB_TRANSFER_TIMED_OUT:
+                return -110;  // ETIMEDOUT
+            case ::LIBUSB_TRANSFER_CANCELLED:
+                return -2;  // ENOENT
+            case ::LIBUSB_TRANSFER_STALL:
+                return -32;  // EPIPE
+            case ::LIBUSB_TRANSFER_NO_DEVICE:
+                return -19;  // ENODEV
+            case ::LIBUSB_TRANSFER_OVERFLOW:
+                return -75;  // EOVERFLOW
+            case ::LIBUSB_TRANSFER_ERROR:
+            default:
+                return -71;  // EPROTO
+            }
+        }
+
+        [[nodiscard]] constexpr auto usbmon_status(::libusb_error const error) noexcept -> std::int32_t
+        {
+            switch (error)
+            {
+            case ::LIBUSB_ERROR_INVALID_PARAM:
+                return -22;  // EINVAL
+            case ::LIBUSB_ERROR_NO_DEVICE:
+                return -19;  // ENODEV
+            case ::LIBUSB_ERROR_BUSY:
+                return -16;  // EBUSY
+            case ::LIBUSB_ERROR_NO_MEM:
+                return -12;  // ENOMEM
+            case ::LIBUSB_ERROR_NOT_SUPPORTED:
+                return -38;  // ENOSYS
+            default:
+                return -5;  // EIO
+            }
+        }
+
+        [[nodiscard]] constexpr auto usbmon_transfer_type(std::uint8_t const type) noexcept -> std::uint8_t
+        {
+            switch (type)
+            {
+            case ::LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
+                return 0;
+            case ::LIBUSB_TRANSFER_TYPE_INTERRUPT:
+                return 1;
+            case ::LIBUSB_TRANSFER_TYPE_CONTROL:
+                return 2;
+            default:
+                return 3;
+            }
+        }
+    }  // namespace detail
+
+    // Writes the transfers that usb_asio submits to a pcap file in the format of Linux usbmon
+    // (LINKTYPE_USB_LINUX_MMAPPED), which Wireshark can open, without needing access to usbmon.
+    // Records are queued in a lock-free ring by the threads submitting and completing transfers,
+    // and written out by a background thread: a full ring drops records rather than waiting.
+    // Passed to the usb_service with usb_service_options::capture.
+    class usb_capture
+    {
+      public:
+        explicit usb_capture(usb_capture_options const& options)
+          : file_{std::fopen(options.path.string().c_str(), "wb")}
+          , snap_length_{options.snap_length}
+          , max_iso_descriptors_{options.max_iso_descriptors}
+          , flush_interval_{options.flush_interval}
+          , sample_every_{options.sample_every}
+          , ring_{
+                options.ring_slots,
+                sizeof(detail::pcap_record_header)
+                    + sizeof(detail::usbmon_packet)
+                    + options.max_iso_descriptors * sizeof(detail::usbmon_iso_descriptor)
+                    + options.snap_length,
+            }
+        {
+            if (file_ == nullptr)
+            {
+                throw system_error{error_code{errno, asio::error::get_system_category()}};
+            }
+
+            write_file_header();
+            writer_thread_ = std::jthread{[this](std::stop_token const& stop_token) { run_writer(stop_token); }};
+        }
+
+        usb_capture(usb_capture const&) = delete;
+
+        usb_capture(usb_capture&&) = delete;
+
+        // Writes out the records queued so far.
+        ~usb_capture() noexcept
+        {
+            writer_thread_.request_stop();
+            writer_thread_.join();
+        }
+
+        // Applies to the transfers submitted afterwards, 0 pauses the capture.
+        void set_sample_every(std::uint32_t const sample_every) noexcept
+        {
+            sample_every_.store(sample_every, std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] auto sample_every() const noexcept -> std::uint32_t
+        {
+            return sample_every_.load(std::memory_order_relaxed);
+        }
+
+        // Records queued for writing.
+        [[nodiscard]] auto captured() const noexcept -> std::uint64_t
+        {
+            return captured_.load(std::memory_order_relaxed);
+        }
+
+        // Records dropped because the ring was full.
+        [[nodiscard]] auto dropped() const noexcept -> std::uint64_t
+        {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+        // First error writing the file, after which records are discarded.
+        [[nodiscard]] auto write_error() const noexcept -> error_code
+        {
+            auto const error = write_errno_.load(std::memory_order_relaxed);
+            return error != 0 ? error_code{error, asio::error::get_system_category()} : error_code{};
+        }
+
+        // Whether the transfer being submitted is captured, used by transfers.
+        [[nodiscard]] auto sample() noexcept -> bool
+        {
+            auto const sample_every = sample_every_.load(std::memory_order_relaxed);
+            return sample_every == 1u
+                   || (sample_every != 0u && sample_counter_.fetch_add(1u, std::memory_order_relaxed) % sample_every == 0u);
+        }
+
+        // Queues a record of the transfer, used by transfers.
+        void record(
+            detail::usbmon_event const event,
+            ::libusb_transfer const* const transfer,
+            std::uint16_t const bus_number,
+            std::uint8_t const device_address,
+            std::int32_t const status) noexcept
+        {
+            auto const pushed = ring_.try_push([&](std::span<std::byte> const slot) {
+                return write_record(slot, event, transfer, bus_number, device_address, status);
+            });
+
+            (pushed ? captured_ : dropped_).fetch_add(1u, std::memory_order_relaxed);
+        }
+
+        auto operator=(usb_capture const&) = delete;
+
+        auto operator=(usb_capture&&) = delete;
+
+      private:
+        static constexpr auto linktype_usb_linux_mmapped = std::uint32_t{220};
+
+        struct file_closer
+        {
+            void operator()(std::FILE* const file) const noexcept
+            {
+                std::fclose(file);
+            }
+        };
+
+        std::unique_ptr<std::FILE, file_closer> file_;
+        std::size_t snap_length_;
+        std::size_t max_iso_descriptors_;
+        std::chrono::milliseconds flush_interval_;
+        std::atomic<std::uint32_t> sample_every_;
+        std::atomic<std::uint64_t> sample_counter_ = 0;
+        std::atomic<std::uint64_t> captured_ = 0;
+        std::atomic<std::uint64_t> dropped_ = 0;
+        std::atomic<int> write_errno_ = 0;
+        detail::capture_ring ring_;
+        std::mutex writer_mutex_;
+        std::condition_variable_any writer_wakeup_;
+        // Last, stopped before the rest is destroyed.
+        std::jthread writer_thread_;
+
+        void write_file_header()
+        {
+            struct
+            {
+                std::uint32_t magic = 0xa1b2c3d4u;
+                std::uint16_t version_major = 2;
+                std::uint16_t version_minor = 4;
+                std::int32_t this_zone = 0;
+                std::uint32_t sigfigs = 0;
+                std::uint32_t snap_length = 0;
+                std::uint32_t linktype = linktype_usb_linux_mmapped;
+            } header;
+            header.snap_length = static_cast<std::uint32_t>(ring_.slot_capacity() - sizeof(detail::pcap_record_header));
+
+            write(std::as_bytes(std::span{&header, 1}));
+        }
+
+        void write(std::span<std::byte const> const data) noexcept
+        {
+            if (write_errno_.load(std::memory_order_relaxed) != 0)
+            {
+                return;
+            }
+
+            if (std::fwrite(data.data(), 1, data.size(), file_.get()) != data.size())
+            {
+                write_errno_.store(errno != 0 ? errno : EIO, std::memory_order_relaxed);
+            }
+        }
+
+        void run_writer(std::stop_token const& stop_token) noexcept
+        {
+            auto const consume = [this](std::span<std::byte const> const record) { write(record); };
+
+            while (!stop_token.stop_requested())
+            {
+                ring_.pop_all(consume);
+                std::fflush(file_.get());
+
+                auto lock = std::unique_lock{writer_mutex_};
+                writer_wakeup_.wait_for(lock, stop_token, flush_interval_, []() { return false; });
+            }
+
+            ring_.pop_all(consume);
+            std::fflush(file_.get());
+        }
+
+        // Writes the pcap record header, the usbmon header, the isochronous packet descriptors
+        // and the payload, truncated to fit in the slot.
+        [[nodiscard]] auto write_record(
+            std::span<std::byte> const slot,
+            detail::usbmon_event const event,
+            ::libusb_transfer const* const transfer,
+            std::uint16_t const bus_number,
+            std::uint8_t const device_address,
+            std::int32_t const status) const noexcept
+            -> std::size_t
+        {
+            auto const is_control = transfer->type == ::LIBUSB_TRANSFER_TYPE_CONTROL;
+            auto const is_isochronous = transfer->type == ::LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+            auto const setup_size = static_cast<int>(LIBUSB_CONTROL_SETUP_SIZE);
+            auto const has_setup = is_control && transfer->buffer != nullptr && transfer->length >= setup_size;
+            auto const endpoint = has_setup
+                                      ? static_cast<std::uint8_t>(transfer->buffer[0] & LIBUSB_ENDPOINT_IN)
+                                      : transfer->endpoint;
+            auto const is_in = (endpoint & LIBUSB_ENDPOINT_IN) != 0u;
+
+            // Control transfers carry the setup packet in front of their data.
+            auto const* const data = has_setup ? transfer->buffer + setup_size : transfer->buffer;
+            auto const requested_length = static_cast<std::size_t>(std::max(
+                has_setup ? transfer->length - setup_size : transfer->length,
+                0));
+            auto const num_packets = is_isochronous ? static_cast<std::size_t>(transfer->num_iso_packets) : 0u;
+            auto const num_descriptors = std::min(num_packets, max_iso_descriptors_);
+
+            auto header = detail::usbmon_packet{};
+            header.id = reinterpret_cast<std::uintptr_t>(transfer);
+            header.type = static_cast<char>(event);
+            header.transfer_type = detail::usbmon_transfer_type(transfer->type);
+            header.endpoint = endpoint;
+            header.device_address = device_address;
+            header.bus_number = bus_number;
+            header.flag_setup = '-';
+            header.status = status;
+            header.num_descriptors = static_cast<std::uint32_t>(num_descriptors);
+
+            auto data_length = std::size_t{0};
+            switch (event)
+            {
+            case detail::usbmon_event::submit:
+                header.length = static_cast<std::uint32_t>(requested_length);
+                header.flag_data = is_in ? '<' : 0;
+                data_length = is_in ? 0u : requested_length;
+                if (has_setup)
+                {
+                    header.flag_setup = 0;
+                    std::memcpy(header.s.setup, transfer->buffer, sizeof(header.s.setup));
+                }
+                break;
+            case detail::usbmon_event::complete:
+            {
+                auto actual_length = static_cast<std::size_t>(std::max(transfer->actual_length, 0));
+                if (is_isochronous)
+                {
+                    actual_length = 0;
+                    for (auto i = std::size_t{0}; i < num_packets; ++i)
+                    {
+                        actual_length += transfer->iso_packet_desc[i].actual_length;
+                    }
+                }
+
+                header.length = static_cast<std::uint32_t>(actual_length);
+                header.flag_data = is_in ? 0 : '>';
+                // Isochronous packets are where they were requested, not packed.
+                data_length = !is_in ? 0u : is_isochronous ? requested_length : actual_length;
+                break;
+            }
+            case detail::usbmon_event::submit_error:
+                header.length = static_cast<std::uint32_t>(requested_length);
+                header.flag_data = is_in ? '<' : '>';
+                break;
+            }
+
+            if (data == nullptr)
+            {
+                data_length = 0;
+            }
+
+            auto const timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch());
+            header.ts_sec = static_cast<std::int64_t>(timestamp.count() / 1'000'000);
+            header.ts_usec = static_cast<std::int32_t>(timestamp.count() % 1'000'000);
+
+            // The slot has room for both.
+            auto const descriptors_size = num_descriptors * sizeof(detail::usbmon_iso_descriptor);
+            auto const captured_length = std::min(data_length, snap_length_);
+            header.captured_length = static_cast<std::uint32_t>(captured_length);
+
+            auto* out = slot.data() + sizeof(detail::pcap_record_header) + sizeof(header);
+            if (is_isochronous)
+            {
+                auto errors = std::int32_t{0};
+                auto offset = std::uint32_t{0};
+                for (auto i = std::size_t{0}; i < num_packets; ++i)
+                {
+                    auto const& packet = transfer->iso_packet_desc[i];
+                    auto const completed = event == detail::usbmon_event::complete;
+                    if (completed && packet.status != ::LIBUSB_TRANSFER_COMPLETED)
+                    {
+                        ++errors;
+                    }
+
+                    if (i < num_descriptors)
+                    {
+                        auto const descriptor = detail::usbmon_iso_descriptor{
+                            .status = completed ? detail::usbmon_status(packet.status) : 0,
+                            .offset = offset,
+                            .length = completed ? packet.actual_length : packet.length,
+                            .padding = 0,
+                        };
+                        std::memcpy(out, &descriptor, sizeof(descriptor));
+                        out += sizeof(descriptor);
+                    }
+                    offset += packet.length;
+                }
+
+                header.s.iso.error_count = errors;
+                header.s.iso.num_descriptors = static_cast<std::int32_t>(num_packets);
+            }
+
+            if (captured_length != 0u)
+            {
+                std::memcpy(out, data, captured_length);
+            }
+
+            auto const record_header = detail::pcap_record_header{
+                .ts_sec = static_cast<std::uint32_t>(header.ts_sec),
+                .ts_usec = static_cast<std::uint32_t>(header.ts_usec),
+                .captured_length = static_cast<std::uint32_t>(sizeof(header) + descriptors_size + captured_length),
+                .length = static_cast<std::uint32_t>(
+                    sizeof(header) + num_packets * sizeof(detail::usbmon_iso_descriptor) + data_length),
+            };
+            std::memcpy(slot.data(), &record_header, sizeof(record_header));
+            std::memcpy(slot.data() + sizeof(record_header), &header, sizeof(header));
+
+            return sizeof(record_header) + record_header.captured_length;
+        }
+    };
+
+    namespace detail
+    {
+        // Records the submissions and completions of a transfer in the usb_capture of its service, if any.
+        class capture_tap
+        {
+          public:
+            capture_tap() noexcept = default;
+
+            capture_tap(usb_capture* const capture, ::libusb_device_handle* const device_handle) noexcept
+              : capture_{device_handle != nullptr ? capture : nullptr}
+            {
+                if (capture_ != nullptr)
+                {
+                    auto* const device = ::libusb_get_device(device_handle);
+                    bus_number_ = ::libusb_get_bus_number(device);
+                    device_address_ = ::libusb_get_device_address(device);
+                }
+            }
+
+            // Right before libusb_submit_transfer, which may complete the transfer before returning.
+            void submitting(::libusb_transfer const* const transfer) noexcept
+            {
+                sampled_ = capture_ != nullptr && capture_->sample();
+                if (sampled_)
+                {
+                    capture_->record(usbmon_event::submit, transfer, bus_number_, device_address_, -115);  // EINPROGRESS
+                }
+            }
+
+            void submitted(::libusb_transfer const* const transfer, error_code const& ec) noexcept
+            {
+                // Without the completion to race with when the submission failed.
+                if (ec && sampled_)
+                {
+                    sampled_ = false;
+                    capture_->record(
+                        usbmon_event::submit_error,
+                        transfer,
+                        bus_number_,
+                        device_address_,
+                        usbmon_status(static_cast<::libusb_error>(ec.value())));
+                }
+            }
+
+            void completed(::libusb_transfer const* const transfer) noexcept
+            {
+                if (std::exchange(sampled_, false))
+                {
+                    capture_->record(
+                        usbmon_event::complete,
+                        transfer,
+                        bus_number_,
+                        device_address_,
+                        usbmon_status(transfer->status));
+                }
+            }
+
+          private:
+            usb_capture* capture_ = nullptr;
+            std::uint16_t bus_number_ = 0;
+            std::uint8_t device_address_ = 0;
+            bool sampled_ = false;
+        };
+    }  // namespace detail
+}  // namespace usb_asio
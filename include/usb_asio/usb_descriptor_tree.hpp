@@ -0,0 +1,487 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include <libusb.h>
+#include "usb_asio/asio.hpp"
+#include "usb_asio/error.hpp"
+#include "usb_asio/flags.hpp"
+#include "usb_asio/libusb_ptr.hpp"
+#include "usb_asio/usb_device_info.hpp"
+#include "usb_asio/usb_service.hpp"
+
+namespace usb_asio
+{
+    struct usb_endpoint_descriptor
+    {
+        std::uint8_t address = 0;
+        std::uint8_t attributes = 0;
+        // Raw wMaxPacketSize, see packet_size.
+        std::uint16_t max_packet_size = 0;
+        std::uint8_t interval = 0;
+        // Packets per burst, from the super speed endpoint companion descriptor (1 without one).
+        std::uint8_t max_burst = 1;
+        // Bursts per service interval of super speed isochronous endpoints (1 otherwise).
+        std::uint8_t mult = 1;
+        // From the super speed endpoint companion descriptor of periodic endpoints (0 without one).
+        std::uint16_t bytes_per_interval = 0;
+
+        [[nodiscard]] auto number() const noexcept -> std::uint8_t
+        {
+            return static_cast<std::uint8_t>(address & LIBUSB_ENDPOINT_ADDRESS_MASK);
+        }
+
+        [[nodiscard]] auto direction() const noexcept -> usb_transfer_direction
+        {
+            return static_cast<usb_transfer_direction>(address & LIBUSB_ENDPOINT_DIR_MASK);
+        }
+
+        [[nodiscard]] auto transfer_type() const noexcept -> usb_transfer_type
+        {
+            return static_cast<usb_transfer_type>(attributes & LIBUSB_TRANSFER_TYPE_MASK);
+        }
+
+        // Size of a single packet, without the high speed high-bandwidth bits.
+        [[nodiscard]] auto packet_size() const noexcept -> std::size_t
+        {
+            return max_packet_size & 0x7ffu;
+        }
+
+        // Bytes a periodic endpoint moves per service interval: up to 3 packets for high speed
+        // high-bandwidth endpoints, bursts times mult for super speed ones.
+        [[nodiscard]] auto bytes_per_service_interval() const noexcept -> std::size_t
+        {
+            if (bytes_per_interval != 0)
+            {
+                return bytes_per_interval;
+            }
+
+            auto const high_bandwidth_multiplier = ((max_packet_size >> 11) & 0x3u) + 1u;
+            return packet_size() * high_bandwidth_multiplier * max_burst * mult;
+        }
+    };
+
+    struct usb_alt_setting_descriptor
+    {
+        std::uint8_t interface_number = 0;
+        std::uint8_t alt_setting = 0;
+        std::uint8_t interface_class = 0;
+        std::uint8_t interface_subclass = 0;
+        std::uint8_t interface_protocol = 0;
+        std::uint8_t interface_string_index = 0;
+        // Range of the endpoints in usb_descriptor_tree.
+        std::uint32_t first_endpoint = 0;
+        std::uint32_t num_endpoints = 0;
+    };
+
+    struct usb_interface_descriptor
+    {
+        std::uint8_t number = 0;
+        // Range of the alt settings in usb_descriptor_tree.
+        std::uint32_t first_alt_setting = 0;
+        std::uint32_t num_alt_settings = 0;
+    };
+
+    struct usb_config_descriptor
+    {
+        std::uint8_t config_value = 0;
+        std::uint8_t attributes = 0;
+        // In units of 2 mA (8 mA for super speed devices).
+        std::uint8_t max_power = 0;
+        std::uint8_t config_string_index = 0;
+        // Range of the interfaces in usb_descriptor_tree.
+        std::uint32_t first_interface = 0;
+        std::uint32_t num_interfaces = 0;
+    };
+
+    // Parsed copy of the device descriptor and of all the configuration descriptors
+    // of a device, stored flat: every level of the tree is a single array, and nodes
+    // refer to the range of their children in the next one.
+    // Built once, it answers queries without going through libusb nor allocating.
+    // Class-specific (extra) descriptors are not kept, use the libusb descriptors for these.
+    class usb_descriptor_tree
+    {
+      public:
+        explicit usb_descriptor_tree(usb_device_info const& info)
+        {
+            try_with_ec([&](auto& ec) {
+                build(info, ec);
+            });
+        }
+
+        usb_descriptor_tree(usb_device_info const& info, error_code& ec)
+        {
+            build(info, ec);
+        }
+
+        [[nodiscard]] auto device_descriptor() const noexcept -> ::libusb_device_descriptor const&
+        {
+            return device_descriptor_;
+        }
+
+        [[nodiscard]] auto configs() const noexcept -> std::span<usb_config_descriptor const>
+        {
+            return configs_;
+        }
+
+        [[nodiscard]] auto interfaces(usb_config_descriptor const& config) const noexcept
+            -> std::span<usb_interface_descriptor const>
+        {
+            return std::span{interfaces_}.subspan(config.first_interface, config.num_interfaces);
+        }
+
+        [[nodiscard]] auto alt_settings(usb_interface_descriptor const& interface) const noexcept
+            -> std::span<usb_alt_setting_descriptor const>
+        {
+            return std::span{alt_settings_}.subspan(interface.first_alt_setting, interface.num_alt_settings);
+        }
+
+        [[nodiscard]] auto endpoints(usb_alt_setting_descriptor const& alt_setting) const noexcept
+            -> std::span<usb_endpoint_descriptor const>
+        {
+            return std::span{endpoints_}.subspan(alt_setting.first_endpoint, alt_setting.num_endpoints);
+        }
+
+        [[nodiscard]] auto find_config(std::uint8_t const config_value) const noexcept
+            -> usb_config_descriptor const*
+        {
+            for (auto const& config : configs_)
+            {
+                if (config.config_value == config_value)
+                {
+                    return &config;
+                }
+            }
+
+            return nullptr;
+        }
+
+        // Looks into the first configuration when config_value is not given.
+        [[nodiscard]] auto find_alt_setting(
+            std::uint8_t const interface_number,
+            std::uint8_t const alt_setting = 0,
+            std::optional<std::uint8_t> const config_value = std::nullopt) const noexcept
+            -> usb_alt_setting_descriptor const*
+        {
+            auto const* const config = config_value ? find_config(*config_value)
+                                       : configs_.empty() ? nullptr
+                                                          : &configs_.front();
+            if (config == nullptr)
+            {
+                return nullptr;
+            }
+
+            for (auto const& interface : interfaces(*config))
+            {
+                if (interface.number != interface_number)
+                {
+                    continue;
+                }
+
+                for (auto const& setting : alt_settings(interface))
+                {
+                    if (setting.alt_setting == alt_setting)
+                    {
+                        return &setting;
+                    }
+                }
+            }
+
+            return nullptr;
+        }
+
+        // First endpoint of the given type and direction, e.g. the bulk IN endpoint of an interface.
+        [[nodiscard]] auto find_endpoint(
+            std::uint8_t const interface_number,
+            usb_transfer_type const transfer_type,
+            usb_transfer_direction const direction,
+            std::uint8_t const alt_setting = 0,
+            std::optional<std::uint8_t> const config_value = std::nullopt) const noexcept
+            -> usb_endpoint_descriptor const*
+        {
+            auto const* const setting = find_alt_setting(interface_number, alt_setting, config_value);
+            if (setting == nullptr)
+            {
+                return nullptr;
+            }
+
+            for (auto const& endpoint : endpoints(*setting))
+            {
+                if (endpoint.transfer_type() == transfer_type && endpoint.direction() == direction)
+                {
+                    return &endpoint;
+                }
+            }
+
+            return nullptr;
+        }
+
+      private:
+        ::libusb_device_descriptor device_descriptor_ = {};
+        std::vector<usb_config_descriptor> configs_;
+        std::vector<usb_interface_descriptor> interfaces_;
+        std::vector<usb_alt_setting_descriptor> alt_settings_;
+        std::vector<usb_endpoint_descriptor> endpoints_;
+
+        void build(usb_device_info const& info, error_code& ec)
+        {
+            device_descriptor_ = info.device_descriptor(ec);
+            if (ec) { return; }
+
+            configs_.reserve(device_descriptor_.bNumConfigurations);
+            for (auto index = std::uint8_t{0}; index < device_descriptor_.bNumConfigurations; ++index)
+            {
+                auto const config = info.config_descriptor(index, ec);
+                if (ec) { return; }
+
+                add_config(*config);
+            }
+        }
+
+        void add_config(::libusb_config_descriptor const& config)
+        {
+            configs_.push_back(usb_config_descriptor{
+                .config_value = config.bConfigurationValue,
+                .attributes = config.bmAttributes,
+                .max_power = config.MaxPower,
+                .config_string_index = config.iConfiguration,
+                .first_interface = static_cast<std::uint32_t>(interfaces_.size()),
+                .num_interfaces = config.bNumInterfaces,
+            });
+
+            for (auto const& interface : std::span{config.interface, config.bNumInterfaces})
+            {
+                auto const settings = std::span{
+                    interface.altsetting,
+                    static_cast<std::size_t>(interface.num_altsetting),
+                };
+
+                interfaces_.push_back(usb_interface_descriptor{
+                    .number = settings.empty() ? std::uint8_t{0} : settings.front().bInterfaceNumber,
+                    .first_alt_setting = static_cast<std::uint32_t>(alt_settings_.size()),
+                    .num_alt_settings = static_cast<std::uint32_t>(settings.size()),
+                });
+
+                for (auto const& setting : settings)
+                {
+                    add_alt_setting(setting);
+                }
+            }
+        }
+
+        void add_alt_setting(::libusb_interface_descriptor const& setting)
+        {
+            alt_settings_.push_back(usb_alt_setting_descriptor{
+                .interface_number = setting.bInterfaceNumber,
+                .alt_setting = setting.bAlternateSetting,
+                .interface_class = setting.bInterfaceClass,
+                .interface_subclass = setting.bInterfaceSubClass,
+                .interface_protocol = setting.bInterfaceProtocol,
+                .interface_string_index = setting.iInterface,
+                .first_endpoint = static_cast<std::uint32_t>(endpoints_.size()),
+                .num_endpoints = setting.bNumEndpoints,
+            });
+
+            for (auto const& endpoint : std::span{setting.endpoint, setting.bNumEndpoints})
+            {
+                auto& added = endpoints_.emplace_back(usb_endpoint_descriptor{
+                    .address = endpoint.bEndpointAddress,
+                    .attributes = endpoint.bmAttributes,
+                    .max_packet_size = endpoint.wMaxPacketSize,
+                    .interval = endpoint.bInterval,
+                });
+                add_companion(added, endpoint);
+            }
+        }
+
+        static void add_companion(
+            usb_endpoint_descriptor& descriptor,
+            ::libusb_endpoint_descriptor const& endpoint) noexcept
+        {
+            using companion_ptr = libusb_ptr<
+                ::libusb_ss_endpoint_companion_descriptor,
+                &::libusb_free_ss_endpoint_companion_descriptor>;
+
+            // Only parses the extra descriptors, no context needed.
+            auto companion_handle = companion_ptr::pointer{};
+            if (::libusb_get_ss_endpoint_companion_descriptor(nullptr, &endpoint, &companion_handle) != ::LIBUSB_SUCCESS)
+            {
+                return;
+            }
+
+            auto const companion = companion_ptr{companion_handle};
+            descriptor.max_burst = static_cast<std::uint8_t>(companion->bMaxBurst + 1u);
+            descriptor.bytes_per_interval = companion->wBytesPerInterval;
+            if (descriptor.transfer_type() == usb_transfer_type::isochronous)
+            {
+                descriptor.mult = static_cast<std::uint8_t>((companion->bmAttributes & 0x3u) + 1u);
+            }
+        }
+    };
+
+    // Descriptor trees of the devices of an execution context, built on first use
+    // and shared between all their users.
+    // Trees stay cached until their device is reported gone by a usb_hotplug_monitor
+    // or a usb_device_enumerator of the same context, or evicted explicitly.
+    // Without those, the trees of departed devices are dropped when list_usb_devices
+    // next lists the devices of the context.
+    // Thread-safe.
+    class usb_descriptor_cache final : public asio::execution_context::service
+    {
+      public:
+        using tree_ptr = std::shared_ptr<usb_descriptor_tree const>;
+
+        static inline auto id = asio::execution_context::id{};
+
+        explicit usb_descriptor_cache(asio::execution_context& context)
+          : asio::execution_context::service{context}
+        {
+        }
+
+        [[nodiscard]] auto get(usb_device_info const& info) -> tree_ptr
+        {
+            return try_with_ec([&](auto& ec) {
+                return get(info, ec);
+            });
+        }
+
+        [[nodiscard]] auto get(usb_device_info const& info, error_code& ec) -> tree_ptr
+        {
+            ec.clear();
+
+            {
+                auto const lock = std::scoped_lock{mutex_};
+                if (auto const it = trees_.find(info.handle()); it != trees_.end())
+                {
+                    return tree_of(it->second);
+                }
+            }
+
+            // Built outside the lock, a concurrent query of the same device
+            // may build it too, the first one inserted wins.
+            auto built = std::make_shared<cached_tree const>(info, ec);
+            if (ec) { return nullptr; }
+
+            auto const lock = std::scoped_lock{mutex_};
+            auto const it = trees_.try_emplace(info.handle(), std::move(built)).first;
+
+            return tree_of(it->second);
+        }
+
+        // Drops the tree of the device, if cached. Users holding it keep it alive.
+        void evict(usb_device_info const& info) noexcept
+        {
+            auto evicted = std::shared_ptr<cached_tree const>{};
+
+            auto const lock = std::scoped_lock{mutex_};
+            if (auto const it = trees_.find(info.handle()); it != trees_.end())
+            {
+                // Released outside the lock.
+                evicted = std::move(it->second);
+                trees_.erase(it);
+            }
+        }
+
+        // Drops the trees of the devices missing from a listing of the connected devices.
+        void retain(std::span<usb_device_info::handle_type const> const connected)
+        {
+            // Released outside the lock.
+            auto departed = std::vector<std::shared_ptr<cached_tree const>>{};
+
+            auto const lock = std::scoped_lock{mutex_};
+            if (trees_.empty()) { return; }
+
+            auto sorted = std::vector<usb_device_info::handle_type>(connected.begin(), connected.end());
+            std::ranges::sort(sorted);
+            std::erase_if(trees_, [&](auto& entry) {
+                if (std::ranges::binary_search(sorted, entry.first))
+                {
+                    return false;
+                }
+
+                departed.push_back(std::move(entry.second));
+                return true;
+            });
+        }
+
+        void shutdown() noexcept override
+        {
+            auto const lock = std::scoped_lock{mutex_};
+            trees_.clear();
+        }
+
+      private:
+        // Keeps the device referenced, so that its handle is not reused
+        // for another device while the tree is cached.
+        struct cached_tree
+        {
+            usb_device_info device;
+            usb_descriptor_tree tree;
+
+            cached_tree(usb_device_info const& info, error_code& ec)
+              : device{info}
+              , tree{info, ec} { }
+        };
+
+        std::mutex mutex_;
+        std::unordered_map<usb_device_info::handle_type, std::shared_ptr<cached_tree const>> trees_;
+
+        [[nodiscard]] static auto tree_of(std::shared_ptr<cached_tree const> const& cached) noexcept -> tree_ptr
+        {
+            return tree_ptr{cached, &cached->tree};
+        }
+    };
+
+    namespace detail
+    {
+        // For the I/O objects that learn about departed devices.
+        // Does not create the cache when nothing was ever cached.
+        inline void evict_descriptor_tree(
+            asio::execution_context& context,
+            usb_device_info const& info) noexcept
+        {
+            if (asio::has_service<usb_descriptor_cache>(context))
+            {
+                asio::use_service<usb_descriptor_cache>(context).evict(info);
+            }
+        }
+
+        // For the listings of the connected devices.
+        // Does not create the cache when nothing was ever cached.
+        inline void retain_descriptor_trees(
+            asio::execution_context& context,
+            std::span<usb_device_info::handle_type const> const connected)
+        {
+            if (asio::has_service<usb_descriptor_cache>(context))
+            {
+                asio::use_service<usb_descriptor_cache>(context).retain(connected);
+            }
+        }
+    }  // namespace detail
+
+    // Descriptor tree of the device, shared with the other users of the execution context.
+    [[nodiscard]] inline auto usb_descriptor_tree_of(
+        asio::execution_context& context,
+        usb_device_info const& info)
+        -> std::shared_ptr<usb_descriptor_tree const>
+    {
+        return asio::use_service<usb_descriptor_cache>(context).get(info);
+    }
+
+    [[nodiscard]] inline auto usb_descriptor_tree_of(
+        asio::execution_context& context,
+        usb_device_info const& info,
+        error_code& ec)
+        -> std::shared_ptr<usb_descriptor_tree const>
+    {
+        return asio::use_service<usb_descriptor_cache>(context).get(info, ec);
+    }
+}  // namespace usb_asio
@@ -2,8 +2,10 @@
 
 #include <compare>
 #include <concepts>
+#include <cstddef>
 #include <cstdint>
 #include <span>
+#include <utility>
 
 #include <libusb.h>
 #include "usb_asio/asio.hpp"
@@ -26,6 +28,7 @@ namespace usb_asio
         explicit basic_usb_device(executor_type const& executor)
           : executor_{executor}
           , service_{&asio::use_service<service_type>(asio::query(executor, asio::execution::context))}
+          , blocking_op_executor_{service_->make_blocking_op_strand()}
         {
         }
 
@@ -52,32 +55,62 @@ namespace usb_asio
           : handle_{std::exchange(other.handle_, nullptr)}
           , executor_{other.executor_}
           , service_{other.service_}
+          , event_shard_{std::exchange(other.event_shard_, 0)}
+          , blocking_op_executor_{other.blocking_op_executor_}
         {
         }
 
+        ~basic_usb_device() noexcept
+        {
+            close();
+        }
+
         void open(usb_device_info const& info) noexcept
         {
             try_with_ec([&](auto& ec)
                         { open(info, ec); });
         }
 
+        // Opens the device on the event shard the service picks for it.
         void open(usb_device_info const& info, error_code& ec)
         {
             close();
 
+            auto const shard = service_->event_shard_of(info);
+            auto const shard_info = service_->device_in_shard(info, shard, ec);
+            if (ec) { return; }
+
             auto handle = handle_type{};
-            libusb_try(ec, &::libusb_open, info.handle(), &handle);
+            libusb_try(ec, &::libusb_open, shard_info.handle(), &handle);
             if (ec) { return; }
 
             handle_ = unique_handle_type{handle};
-            service_->notify_dev_opened();
+            event_shard_ = shard;
+            service_->notify_dev_opened(event_shard_);
+        }
+
+        // Opening can block for a while, this keeps it off the executor.
+        // The device must not be used until the operation completes.
+        template <typename CompletionToken = asio::default_completion_token_t<executor_type>>
+        auto async_open(
+            usb_device_info const& info,
+            CompletionToken&& token = {})
+        {
+            return async_try_blocking_with_ec(
+                executor_,
+                blocking_op_executor_,
+                std::forward<CompletionToken>(token),
+                [this, info](auto& ec)
+                {
+                    open(info, ec);
+                });
         }
 
         void close() noexcept
         {
             if (is_open())
             {
-                service_->notify_dev_closed();
+                service_->notify_dev_closed(event_shard_);
                 handle_.reset();
             }
         }
@@ -107,7 +140,7 @@ namespace usb_asio
         {
             return async_try_blocking_with_ec(
                 executor_,
-                service_->blocking_op_executor(),
+                blocking_op_executor_,
                 std::forward<CompletionToken>(token),
                 [configuration, handle = handle()](auto& ec)
                 {
@@ -135,7 +168,7 @@ namespace usb_asio
         {
             return async_try_blocking_with_ec(
                 executor_,
-                service_->blocking_op_executor(),
+                blocking_op_executor_,
                 std::forward<CompletionToken>(token),
                 [endpoint, handle = handle()](auto& ec)
                 {
@@ -159,7 +192,7 @@ namespace usb_asio
         {
             return async_try_blocking_with_ec(
                 executor_,
-                service_->blocking_op_executor(),
+                blocking_op_executor_,
                 std::forward<CompletionToken>(token),
                 [handle = handle()](auto& ec)
                 {
@@ -218,6 +251,23 @@ namespace usb_asio
             return executor_;
         }
 
+        [[nodiscard]] auto service() const noexcept -> service_type&
+        {
+            return *service_;
+        }
+
+        // Runs the blocking operations on the device, in order.
+        [[nodiscard]] auto blocking_op_executor() const noexcept -> asio::any_io_executor const&
+        {
+            return blocking_op_executor_;
+        }
+
+        // Shard of the service whose event thread completes the transfers of the device.
+        [[nodiscard]] auto event_shard() const noexcept -> std::size_t
+        {
+            return event_shard_;
+        }
+
         [[nodiscard]] auto is_open() const noexcept -> bool
         {
             return handle_ != nullptr;
@@ -226,9 +276,19 @@ namespace usb_asio
         template <std::convertible_to<executor_type> OtherExecutor>
         auto operator=(basic_usb_device<OtherExecutor>&& other) noexcept -> basic_usb_device&
         {
+            if (static_cast<void const*>(&other) == this)
+            {
+                return *this;
+            }
+
+            // Open devices are counted per shard: the old handle is closed on its own shard,
+            // and the shard of the new one comes along with it.
+            close();
             handle_ = std::exchange(other.handle_, nullptr);
+            event_shard_ = std::exchange(other.event_shard_, 0);
             executor_ = other.executor_;
             service_ = other.service_;
+            blocking_op_executor_ = other.blocking_op_executor_;
 
             return *this;
         }
@@ -250,6 +310,8 @@ namespace usb_asio
         unique_handle_type handle_;
         executor_type executor_;
         service_type* service_;
+        std::size_t event_shard_ = 0;
+        asio::any_io_executor blocking_op_executor_;
     };
 
     using usb_device = basic_usb_device<>;
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <compare>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <libusb.h>
+#include "usb_asio/asio.hpp"
+#include "usb_asio/error.hpp"
+#include "usb_asio/usb_descriptor_tree.hpp"
+#include "usb_asio/usb_device_info.hpp"
+#include "usb_asio/usb_service.hpp"
+
+namespace usb_asio
+{
+    // Physical location of a device: its bus and the ports leading to it from the root hub.
+    struct usb_port_path
+    {
+        // As per USB 3.0 specs and libusb documentation.
+        static constexpr auto max_depth = std::size_t{7};
+
+        std::uint8_t bus_number = 0;
+        std::uint8_t depth = 0;
+        std::array<std::uint8_t, max_depth> ports = {};
+
+        [[nodiscard]] static auto of(usb_device_info::handle_type const handle) noexcept -> usb_port_path
+        {
+            auto path = usb_port_path{};
+            path.bus_number = ::libusb_get_bus_number(handle);
+
+            auto const depth = ::libusb_get_port_numbers(
+                handle,
+                path.ports.data(),
+                static_cast<int>(path.ports.size()));
+            path.depth = depth > 0 ? static_cast<std::uint8_t>(depth) : std::uint8_t{0};
+
+            return path;
+        }
+
+        [[nodiscard]] auto port_numbers() const noexcept -> std::span<std::uint8_t const>
+        {
+            return std::span{ports}.first(depth);
+        }
+
+        friend auto operator<=>(usb_port_path const&, usb_port_path const&) = default;
+    };
+
+    struct usb_enumerated_device
+    {
+        usb_port_path path;
+        usb_device_info info;
+    };
+
+    // Valid until the next rescan.
+    struct usb_device_changes
+    {
+        std::span<usb_enumerated_device const> added;
+        std::span<usb_device_info const> removed;
+
+        [[nodiscard]] auto empty() const noexcept -> bool
+        {
+            return added.empty() && removed.empty();
+        }
+    };
+
+    // Keeps a snapshot of the connected devices and reports what changed on each rescan,
+    // for when hotplug is not available (see usb_hotplug_monitor).
+    // Devices that did not change keep their usb_device_info, so that rescanning only
+    // references the new ones, and the snapshot storage is reused across rescans.
+    // A device replaced by another one at the same port between two rescans is reported
+    // as both removed and added.
+    // Not thread-safe.
+    class usb_device_enumerator
+    {
+      public:
+        using service_type = usb_service;
+
+        explicit usb_device_enumerator(asio::execution_context& context)
+          : service_{&asio::use_service<service_type>(context)}
+        {
+        }
+
+        // Reports every connected device as added on the first call.
+        auto rescan() -> usb_device_changes
+        {
+            return try_with_ec([&](auto& ec) {
+                return rescan(ec);
+            });
+        }
+
+        // On error, nothing changes and the snapshot is kept as is.
+        auto rescan(error_code& ec) -> usb_device_changes
+        {
+            auto device_handles = static_cast<usb_device_info::handle_type*>(nullptr);
+            auto const num_devices = libusb_try(
+                ec,
+                &::libusb_get_device_list,
+                service_->handle(),
+                &device_handles);
+            if (ec) { return {}; }
+
+            auto handles_deleter = [](auto const device_handles) {
+                ::libusb_free_device_list(device_handles, true);
+            };
+            auto handles_owner = std::unique_ptr<usb_device_info::handle_type[], decltype(handles_deleter)>{
+                device_handles,
+                handles_deleter,
+            };
+
+            scanned_.clear();
+            for (auto const handle : std::span{device_handles, num_devices})
+            {
+                scanned_.emplace_back(usb_port_path::of(handle), handle);
+            }
+            std::ranges::sort(scanned_, {}, &scanned_device::first);
+
+            merge();
+
+            for (auto const& info : removed_)
+            {
+                detail::evict_descriptor_tree(service_->context(), info);
+            }
+
+            return usb_device_changes{added_, removed_};
+        }
+
+        // Sorted by path.
+        [[nodiscard]] auto devices() const noexcept -> std::span<usb_enumerated_device const>
+        {
+            return snapshot_;
+        }
+
+      private:
+        using scanned_device = std::pair<usb_port_path, usb_device_info::handle_type>;
+
+        service_type* service_;
+        std::vector<usb_enumerated_device> snapshot_;
+        std::vector<usb_enumerated_device> next_;
+        std::vector<scanned_device> scanned_;
+        std::vector<usb_enumerated_device> added_;
+        std::vector<usb_device_info> removed_;
+
+        // Merges the sorted scan into the sorted snapshot.
+        void merge()
+        {
+            added_.clear();
+            removed_.clear();
+            next_.clear();
+
+            auto old_it = snapshot_.begin();
+            auto new_it = scanned_.begin();
+
+            while (old_it != snapshot_.end() || new_it != scanned_.end())
+            {
+                auto const order = old_it == snapshot_.end()  ? std::strong_ordering::greater
+                                   : new_it == scanned_.end() ? std::strong_ordering::less
+                                                              : old_it->path <=> new_it->first;
+
+                if (order == 0 && old_it->info.handle() == new_it->second)
+                {
+                    next_.push_back(std::move(*old_it));
+                    ++old_it;
+                    ++new_it;
+                    continue;
+                }
+
+                if (order <= 0)
+                {
+                    removed_.push_back(std::move(old_it->info));
+                    ++old_it;
+                }
+
+                if (order >= 0)
+                {
+                    auto& added = next_.emplace_back(new_it->first, usb_device_info{new_it->second});
+                    added_.push_back(added);
+                    ++new_it;
+                }
+            }
+
+            std::swap(snapshot_, next_);
+            // Leaves the moved-from entries of the previous snapshot, nothing to release.
+            next_.clear();
+        }
+    };
+}  // namespace usb_asio
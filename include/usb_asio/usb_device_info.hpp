@@ -24,6 +24,9 @@ namespace usb_asio
             ::libusb_config_descriptor,
             &::libusb_free_config_descriptor>;
 
+        // Refers to no device, only good for being assigned another one.
+        usb_device_info() noexcept = default;
+
         explicit usb_device_info(handle_type const handle) noexcept
           : handle_{handle} { }
 
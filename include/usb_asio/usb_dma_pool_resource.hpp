@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "usb_asio/usb_device.hpp"
+#include "usb_asio/usb_dma_resource.hpp"
+
+namespace usb_asio
+{
+    struct usb_dma_pool_options
+    {
+        // Size of the chunks requested from the upstream resource, carved into slabs.
+        std::size_t region_size = std::size_t{1} << 20u;
+        // Size of the slabs, each one split into blocks of a single size class.
+        std::size_t slab_size = std::size_t{64} << 10u;
+        // Larger allocations bypass the pool and go to the upstream resource.
+        std::size_t largest_block = std::size_t{64} << 10u;
+    };
+
+    struct usb_dma_pool_stats
+    {
+        // Memory obtained from the upstream resource for the pool.
+        std::size_t region_bytes = 0;
+        std::size_t region_count = 0;
+        // Memory handed out, rounded up to the size classes.
+        std::size_t allocated_bytes = 0;
+        // Memory asked for by the callers.
+        std::size_t requested_bytes = 0;
+        std::size_t allocation_count = 0;
+        // Allocations too large for the pool, forwarded to the upstream resource.
+        std::size_t oversized_bytes = 0;
+        std::size_t oversized_count = 0;
+    };
+
+    // Pool of DMA memory.
+    // Carves large regions of an upstream resource (zero-copy memory of a device by default)
+    // into slabs of power of two sized blocks. Blocks are recycled through per-size-class
+    // free lists, so that allocating and freeing transfer buffers is O(1) and only hits
+    // the upstream resource when the pool needs to grow.
+    // Regions are given back to the upstream resource on destruction only.
+    // Thread-safe.
+    class usb_dma_pool_resource final : public std::pmr::memory_resource
+    {
+      public:
+        static constexpr auto smallest_block = std::size_t{64};
+        static constexpr auto region_alignment = std::size_t{4096};
+
+        template <typename Executor>
+        explicit usb_dma_pool_resource(
+            basic_usb_device<Executor>& device,
+            usb_dma_pool_options const& options = {})
+          : owned_upstream_{std::make_unique<usb_dma_resource>(device)}
+          , upstream_{owned_upstream_.get()}
+          , options_{normalize(options)} { }
+
+        explicit usb_dma_pool_resource(
+            std::pmr::memory_resource* const upstream_resource,
+            usb_dma_pool_options const& options = {})
+          : upstream_{upstream_resource}
+          , options_{normalize(options)} { }
+
+        usb_dma_pool_resource(usb_dma_pool_resource const&) = delete;
+
+        usb_dma_pool_resource(usb_dma_pool_resource&&) = delete;
+
+        ~usb_dma_pool_resource() noexcept override
+        {
+            release();
+        }
+
+        // Gives all the regions back to the upstream resource,
+        // invalidating every block allocated from the pool.
+        void release() noexcept
+        {
+            auto const lock = std::scoped_lock{mutex_};
+
+            for (auto const& region : regions_)
+            {
+                upstream_->deallocate(region.data, region.size, region_alignment);
+            }
+            regions_.clear();
+            free_lists_.fill(nullptr);
+            current_ = {};
+
+            auto const oversized_bytes = stats_.oversized_bytes;
+            auto const oversized_count = stats_.oversized_count;
+            stats_ = {};
+            stats_.oversized_bytes = oversized_bytes;
+            stats_.oversized_count = oversized_count;
+        }
+
+        [[nodiscard]] auto stats() const noexcept -> usb_dma_pool_stats
+        {
+            auto const lock = std::scoped_lock{mutex_};
+            return stats_;
+        }
+
+        [[nodiscard]] auto options() const noexcept -> usb_dma_pool_options const&
+        {
+            return options_;
+        }
+
+        [[nodiscard]] auto upstream_resource() const noexcept -> std::pmr::memory_resource*
+        {
+            return upstream_;
+        }
+
+        auto operator=(usb_dma_pool_resource const&) = delete;
+
+        auto operator=(usb_dma_pool_resource&&) = delete;
+
+      private:
+        static constexpr auto max_size_classes = std::size_t{32};
+
+        struct free_block
+        {
+            free_block* next;
+        };
+
+        struct region
+        {
+            std::byte* data;
+            std::size_t size;
+        };
+
+        // Part of the newest region that is not carved into slabs yet.
+        struct region_tail
+        {
+            std::byte* data = nullptr;
+            std::size_t size = 0;
+        };
+
+        std::unique_ptr<usb_dma_resource> owned_upstream_;
+        std::pmr::memory_resource* upstream_;
+        usb_dma_pool_options options_;
+        mutable std::mutex mutex_;
+        std::array<free_block*, max_size_classes> free_lists_ = {};
+        std::vector<region> regions_;
+        region_tail current_;
+        usb_dma_pool_stats stats_;
+
+        [[nodiscard]] static auto normalize(usb_dma_pool_options options) -> usb_dma_pool_options
+        {
+            options.largest_block = std::bit_ceil(std::max(options.largest_block, smallest_block));
+            options.slab_size = std::bit_ceil(std::max(options.slab_size, options.largest_block));
+            options.region_size = std::max(options.region_size, options.slab_size);
+            // Keep the regions a whole number of slabs.
+            options.region_size = (options.region_size + options.slab_size - 1u) / options.slab_size * options.slab_size;
+
+            if (std::countr_zero(options.largest_block) >= static_cast<int>(max_size_classes))
+            {
+                throw std::invalid_argument{"Largest DMA pool block is too large"};
+            }
+
+            return options;
+        }
+
+        [[nodiscard]] static auto block_size_for(std::size_t const bytes, std::size_t const alignment) noexcept
+            -> std::size_t
+        {
+            // Blocks are aligned to their size (up to the region alignment),
+            // so rounding up to the alignment satisfies it.
+            return std::bit_ceil(std::max({bytes, alignment, smallest_block}));
+        }
+
+        [[nodiscard]] auto is_pooled(std::size_t const block_size, std::size_t const alignment) const noexcept
+            -> bool
+        {
+            return block_size <= options_.largest_block && alignment <= region_alignment;
+        }
+
+        [[nodiscard]] static auto size_class_of(std::size_t const block_size) noexcept -> std::size_t
+        {
+            return static_cast<std::size_t>(std::countr_zero(block_size));
+        }
+
+        // Expects mutex_ to be held.
+        void carve_slab(std::size_t const block_size)
+        {
+            if (current_.size < options_.slab_size)
+            {
+                // The remainder of the previous region is always a whole number of slabs,
+                // so nothing is lost here.
+                auto* const data = static_cast<std::byte*>(
+                    upstream_->allocate(options_.region_size, region_alignment));
+                try
+                {
+                    regions_.push_back(region{data, options_.region_size});
+                }
+                catch (...)
+                {
+                    upstream_->deallocate(data, options_.region_size, region_alignment);
+                    throw;
+                }
+
+                current_ = region_tail{data, options_.region_size};
+                stats_.region_bytes += options_.region_size;
+                ++stats_.region_count;
+            }
+
+            auto* const slab = current_.data;
+            current_.data += options_.slab_size;
+            current_.size -= options_.slab_size;
+
+            // Thread the blocks of the slab in address order.
+            auto& free_list = free_lists_[size_class_of(block_size)];
+            for (auto offset = options_.slab_size; offset >= block_size; offset -= block_size)
+            {
+                auto* const block = ::new (slab + offset - block_size) free_block{free_list};
+                free_list = block;
+            }
+        }
+
+        [[nodiscard]] auto do_allocate(
+            std::size_t const bytes,
+            std::size_t const alignment) -> void* override
+        {
+            auto const block_size = block_size_for(bytes, alignment);
+
+            if (!is_pooled(block_size, alignment))
+            {
+                // The upstream resource is not necessarily thread-safe.
+                auto const lock = std::scoped_lock{mutex_};
+                auto* const ptr = upstream_->allocate(bytes, alignment);
+                stats_.oversized_bytes += bytes;
+                ++stats_.oversized_count;
+
+                return ptr;
+            }
+
+            auto const lock = std::scoped_lock{mutex_};
+
+            auto& free_list = free_lists_[size_class_of(block_size)];
+            if (free_list == nullptr)
+            {
+                carve_slab(block_size);
+            }
+
+            auto* const block = std::exchange(free_list, free_list->next);
+
+            stats_.allocated_bytes += block_size;
+            stats_.requested_bytes += bytes;
+            ++stats_.allocation_count;
+
+            return block;
+        }
+
+        void do_deallocate(
+            void* const ptr,
+            std::size_t const bytes,
+            std::size_t const alignment) noexcept override
+        {
+            auto const block_size = block_size_for(bytes, alignment);
+
+            if (!is_pooled(block_size, alignment))
+            {
+                auto const lock = std::scoped_lock{mutex_};
+                upstream_->deallocate(ptr, bytes, alignment);
+                stats_.oversized_bytes -= bytes;
+                --stats_.oversized_count;
+
+                return;
+            }
+
+            auto const lock = std::scoped_lock{mutex_};
+
+            auto& free_list = free_lists_[size_class_of(block_size)];
+            free_list = ::new (ptr) free_block{free_list};
+
+            stats_.allocated_bytes -= block_size;
+            stats_.requested_bytes -= bytes;
+            --stats_.allocation_count;
+        }
+
+        [[nodiscard]] auto do_is_equal(
+            std::pmr::memory_resource const& other) const noexcept
+            -> bool override
+        {
+            return static_cast<std::pmr::memory_resource const*>(this)
+                   == &other;
+        }
+    };
+}  // namespace usb_asio
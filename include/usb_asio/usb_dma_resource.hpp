@@ -1,9 +1,11 @@
 #pragma once
 
-#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <memory_resource>
-#include <vector>
+#include <new>
+#include <unordered_set>
+#include <utility>
 
 #include <libusb.h>
 #include "usb_asio/usb_device.hpp"
@@ -40,7 +42,7 @@ namespace usb_asio
 
       private:
         device_handle_type device_handle_;
-        std::pmr::vector<void*> allocated_dma_chunks_;
+        std::pmr::unordered_set<void*> allocated_dma_chunks_;
         std::pmr::memory_resource* backup_resource_;
 
         [[nodiscard]] auto do_allocate(
@@ -67,7 +69,7 @@ namespace usb_asio
                     if (backup_resource_ != nullptr)
                     {
                         // Store the pointer, so we know that it didn't come from the backup resource.
-                        allocated_dma_chunks_.push_back(ptr);
+                        allocated_dma_chunks_.insert(ptr);
                     }
 
                     return ptr;
@@ -89,12 +91,7 @@ namespace usb_asio
         {
             if (backup_resource_ != nullptr)
             {
-                if (auto const iter = std::ranges::find(allocated_dma_chunks_, ptr);
-                    iter != allocated_dma_chunks_.end())
-                {
-                    allocated_dma_chunks_.erase(iter);
-                }
-                else
+                if (allocated_dma_chunks_.erase(ptr) == 0)
                 {
                     backup_resource_->deallocate(ptr, bytes, alignment);
                     return;
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#include <libusb.h>
+#include "usb_asio/asio.hpp"
+#include "usb_asio/error.hpp"
+#include "usb_asio/flags.hpp"
+#include "usb_asio/usb_descriptor_tree.hpp"
+#include "usb_asio/usb_device.hpp"
+#include "usb_asio/usb_interface.hpp"
+#include "usb_asio/usb_transfer.hpp"
+
+namespace usb_asio
+{
+    // Endpoint of a claimed interface, described by its descriptor.
+    // Knows the packet and burst sizes of the endpoint, and creates transfers
+    // and buffers sized accordingly: IN buffers that are not a whole number of packets
+    // overflow (babble) when the device sends a full packet at the end, and transfers
+    // that are not a whole number of bursts waste bus time on super speed devices.
+    // The device must outlive the endpoint.
+    template <
+        usb_transfer_type transfer_type_,
+        usb_transfer_direction transfer_direction_,
+        typename Executor = asio::any_io_executor>
+    class basic_usb_endpoint
+    {
+        static_assert(
+            transfer_type_ == usb_transfer_type::bulk
+                || transfer_type_ == usb_transfer_type::interrupt
+                || transfer_type_ == usb_transfer_type::isochronous,
+            "Only bulk, interrupt and isochronous endpoints are supported");
+
+      public:
+        using executor_type = Executor;
+        using device_type = basic_usb_device<executor_type>;
+        using transfer_type_t = basic_usb_transfer<transfer_type_, transfer_direction_, executor_type>;
+        using buffer_type = std::pmr::vector<std::byte>;
+
+        static constexpr auto transfer_type = transfer_type_;
+        static constexpr auto transfer_direction = transfer_direction_;
+
+        // Throws usb_errc::invalid_param when the interface is not claimed on the device,
+        // or when the descriptor is not of an endpoint of this type and direction.
+        template <typename InterfaceExecutor>
+        basic_usb_endpoint(
+            device_type& device,
+            basic_usb_interface<InterfaceExecutor> const& interface,
+            usb_endpoint_descriptor const& descriptor)
+          : device_{&device}
+          , interface_number_{interface.number()}
+          , descriptor_{descriptor}
+        {
+            if (!interface.is_claimed()
+                || interface.device_handle() != device.handle()
+                || descriptor.transfer_type() != transfer_type
+                || descriptor.direction() != transfer_direction)
+            {
+                throw system_error{make_error_code(usb_errc::invalid_param)};
+            }
+        }
+
+        // Uses the first endpoint of this type and direction of the given alt setting
+        // of the interface. Throws usb_errc::not_found when there is none.
+        template <typename InterfaceExecutor>
+        basic_usb_endpoint(
+            device_type& device,
+            basic_usb_interface<InterfaceExecutor> const& interface,
+            usb_descriptor_tree const& descriptors,
+            std::uint8_t const alt_setting = 0)
+          : basic_usb_endpoint{
+              device,
+              interface,
+              find_descriptor(descriptors, interface.number(), alt_setting),
+          }
+        {
+        }
+
+        [[nodiscard]] auto address() const noexcept -> std::uint8_t
+        {
+            return descriptor_.address;
+        }
+
+        [[nodiscard]] auto interface_number() const noexcept -> std::uint8_t
+        {
+            return interface_number_;
+        }
+
+        [[nodiscard]] auto descriptor() const noexcept -> usb_endpoint_descriptor const&
+        {
+            return descriptor_;
+        }
+
+        [[nodiscard]] auto max_packet_size() const noexcept -> std::size_t
+        {
+            return descriptor_.packet_size();
+        }
+
+        // Packets per burst, 1 below super speed.
+        [[nodiscard]] auto max_burst() const noexcept -> std::size_t
+        {
+            return descriptor_.max_burst;
+        }
+
+        [[nodiscard]] auto burst_size() const noexcept -> std::size_t
+        {
+            return max_packet_size() * max_burst();
+        }
+
+        // Bytes per service interval, the size to give to every isochronous packet.
+        // Taken from the descriptor of this alt setting: libusb_get_max_iso_packet_size
+        // looks the address up in the first alt setting having it, usually a zero-bandwidth one.
+        // clang-format off
+        [[nodiscard]] auto max_iso_packet_size() const noexcept -> std::size_t
+        requires (transfer_type == usb_transfer_type::isochronous)
+        // clang-format on
+        {
+            return descriptor_.bytes_per_service_interval();
+        }
+
+        // Smallest whole number of bursts holding at least the given size,
+        // one burst at least.
+        [[nodiscard]] auto buffer_size_for(std::size_t const bytes) const noexcept -> std::size_t
+        {
+            auto const granularity = std::max(burst_size(), std::size_t{1});
+            auto const bursts = std::max((bytes + granularity - 1u) / granularity, std::size_t{1});
+            return bursts * granularity;
+        }
+
+        [[nodiscard]] auto make_buffer(
+            std::size_t const min_bytes,
+            std::pmr::memory_resource* const mem_resource = std::pmr::get_default_resource()) const
+            -> buffer_type
+        {
+            return buffer_type(buffer_size_for(min_bytes), mem_resource);
+        }
+
+        // clang-format off
+        [[nodiscard]] auto make_transfer(
+            std::chrono::milliseconds const timeout = usb_no_timeout) const
+            -> transfer_type_t
+        requires (transfer_type != usb_transfer_type::isochronous)
+        // clang-format on
+        {
+            return transfer_type_t{device_->get_executor(), *device_, address(), timeout};
+        }
+
+        // Every packet is given the endpoint's max_iso_packet_size.
+        // clang-format off
+        [[nodiscard]] auto make_transfer(
+            std::size_t const num_packets,
+            std::chrono::milliseconds const timeout = usb_no_timeout) const
+            -> transfer_type_t
+        requires (transfer_type == usb_transfer_type::isochronous)
+        // clang-format on
+        {
+            return transfer_type_t{
+                device_->get_executor(),
+                *device_,
+                address(),
+                num_packets,
+                max_iso_packet_size(),
+                timeout,
+            };
+        }
+
+        // Buffer for an isochronous transfer of the given number of packets.
+        // clang-format off
+        [[nodiscard]] auto make_iso_buffer(
+            std::size_t const num_packets,
+            std::pmr::memory_resource* const mem_resource = std::pmr::get_default_resource()) const
+            -> buffer_type
+        requires (transfer_type == usb_transfer_type::isochronous)
+        // clang-format on
+        {
+            return buffer_type(num_packets * max_iso_packet_size(), mem_resource);
+        }
+
+        [[nodiscard]] auto get_executor() const noexcept -> executor_type
+        {
+            return device_->get_executor();
+        }
+
+      private:
+        device_type* device_;
+        std::uint8_t interface_number_;
+        usb_endpoint_descriptor descriptor_;
+
+        [[nodiscard]] static auto find_descriptor(
+            usb_descriptor_tree const& descriptors,
+            std::uint8_t const interface_number,
+            std::uint8_t const alt_setting)
+            -> usb_endpoint_descriptor const&
+        {
+            auto const* const descriptor = descriptors.find_endpoint(
+                interface_number,
+                transfer_type,
+                transfer_direction,
+                alt_setting);
+            if (descriptor == nullptr)
+            {
+                throw system_error{make_error_code(usb_errc::not_found)};
+            }
+
+            return *descriptor;
+        }
+    };
+
+    template <typename Executor = asio::any_io_executor>
+    using basic_usb_in_bulk_endpoint = basic_usb_endpoint<
+        usb_transfer_type::bulk,
+        usb_transfer_direction::in,
+        Executor>;
+    using usb_in_bulk_endpoint = basic_usb_in_bulk_endpoint<>;
+
+    template <typename Executor = asio::any_io_executor>
+    using basic_usb_out_bulk_endpoint = basic_usb_endpoint<
+        usb_transfer_type::bulk,
+        usb_transfer_direction::out,
+        Executor>;
+    using usb_out_bulk_endpoint = basic_usb_out_bulk_endpoint<>;
+
+    template <typename Executor = asio::any_io_executor>
+    using basic_usb_in_interrupt_endpoint = basic_usb_endpoint<
+        usb_transfer_type::interrupt,
+        usb_transfer_direction::in,
+        Executor>;
+    using usb_in_interrupt_endpoint = basic_usb_in_interrupt_endpoint<>;
+
+    template <typename Executor = asio::any_io_executor>
+    using basic_usb_out_interrupt_endpoint = basic_usb_endpoint<
+        usb_transfer_type::interrupt,
+        usb_transfer_direction::out,
+        Executor>;
+    using usb_out_interrupt_endpoint = basic_usb_out_interrupt_endpoint<>;
+
+    template <typename Executor = asio::any_io_executor>
+    using basic_usb_in_isochronous_endpoint = basic_usb_endpoint<
+        usb_transfer_type::isochronous,
+        usb_transfer_direction::in,
+        Executor>;
+    using usb_in_isochronous_endpoint = basic_usb_in_isochronous_endpoint<>;
+
+    template <typename Executor = asio::any_io_executor>
+    using basic_usb_out_isochronous_endpoint = basic_usb_endpoint<
+        usb_transfer_type::isochronous,
+        usb_transfer_direction::out,
+        Executor>;
+    using usb_out_isochronous_endpoint = basic_usb_out_isochronous_endpoint<>;
+}  // namespace usb_asio
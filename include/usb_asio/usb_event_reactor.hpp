@@ -0,0 +1,256 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <libusb.h>
+#include "usb_asio/asio.hpp"
+#include "usb_asio/error.hpp"
+
+#if defined(ASIO_HAS_POSIX_STREAM_DESCRIPTOR) || defined(BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR)
+#define USB_ASIO_HAS_EVENT_REACTOR 1
+#include <poll.h>
+#endif
+
+namespace usb_asio
+{
+#ifdef USB_ASIO_HAS_EVENT_REACTOR
+    // Handles libusb events on the threads running an io_context, by watching
+    // the libusb file descriptors and timeouts with the io_context's reactor
+    // instead of blocking a dedicated thread in libusb_handle_events.
+    class usb_event_reactor
+    {
+      public:
+        using context_handle_type = ::libusb_context*;
+
+        usb_event_reactor(asio::io_context& ioc, context_handle_type const context_handle)
+          : context_handle_{context_handle}
+          , ioc_{&ioc}
+          , timer_{ioc}
+        {
+            // The timer is only re-armed once events were handled: a transfer submitted while
+            // nothing else happens would never time out without libusb signalling its timeouts
+            // through a file descriptor (timerfd).
+            if (::libusb_pollfds_handle_timeouts(context_handle_) == 0)
+            {
+                throw system_error{make_error_code(usb_errc::not_supported)};
+            }
+
+            auto const lock = std::scoped_lock{mutex_};
+
+            ::libusb_set_pollfd_notifiers(
+                context_handle_,
+                &pollfd_added_callback,
+                &pollfd_removed_callback,
+                this);
+
+            auto const pollfds = pollfds_ptr{::libusb_get_pollfds(context_handle_)};
+            for (auto pollfd = pollfds.get(); pollfd != nullptr && *pollfd != nullptr; ++pollfd)
+            {
+                add_fd((*pollfd)->fd, (*pollfd)->events);
+            }
+        }
+
+        usb_event_reactor(usb_event_reactor const&) = delete;
+
+        usb_event_reactor(usb_event_reactor&&) = delete;
+
+        ~usb_event_reactor() noexcept
+        {
+            shutdown();
+        }
+
+        void shutdown() noexcept
+        {
+            ::libusb_set_pollfd_notifiers(context_handle_, nullptr, nullptr, nullptr);
+
+            auto const lock = std::scoped_lock{mutex_};
+            active_ = false;
+
+            // The file descriptors are owned by libusb, do not close them.
+            for (auto& [fd, watched] : watched_fds_)
+            {
+                watched.descriptor.release();
+            }
+            watched_fds_.clear();
+
+            auto ec = error_code{};
+            timer_.cancel(ec);
+        }
+
+        // Events are only waited for while there are open devices,
+        // so that the io_context does not run forever without them.
+        void notify_dev_opened()
+        {
+            auto const lock = std::scoped_lock{mutex_};
+            if (open_devices_++ == 0)
+            {
+                active_ = true;
+                for (auto& [fd, watched] : watched_fds_)
+                {
+                    async_wait_fd(fd, watched);
+                }
+                update_timeout();
+            }
+        }
+
+        void notify_dev_closed() noexcept
+        {
+            auto const lock = std::scoped_lock{mutex_};
+            if (--open_devices_ == 0)
+            {
+                active_ = false;
+                for (auto& [fd, watched] : watched_fds_)
+                {
+                    auto ec = error_code{};
+                    watched.descriptor.cancel(ec);
+                    watched.waiting = false;
+                }
+
+                auto ec = error_code{};
+                timer_.cancel(ec);
+            }
+        }
+
+        auto operator=(usb_event_reactor const&) = delete;
+
+        auto operator=(usb_event_reactor&&) = delete;
+
+      private:
+        struct watched_fd
+        {
+            asio::posix::stream_descriptor descriptor;
+            short events;
+            bool waiting = false;
+        };
+
+        struct pollfds_deleter
+        {
+            void operator()(::libusb_pollfd const** const pollfds) noexcept
+            {
+                ::libusb_free_pollfds(pollfds);
+            }
+        };
+
+        using pollfds_ptr = std::unique_ptr<::libusb_pollfd const*[], pollfds_deleter>;
+
+        context_handle_type context_handle_;
+        asio::io_context* ioc_;
+        std::mutex mutex_;
+        std::map<int, watched_fd> watched_fds_;
+        asio::steady_timer timer_;
+        std::size_t open_devices_ = 0;
+        bool active_ = false;
+
+        static void pollfd_added_callback(int const fd, short const events, void* const user_data)
+        {
+            auto& self = *static_cast<usb_event_reactor*>(user_data);
+            auto const lock = std::scoped_lock{self.mutex_};
+            self.add_fd(fd, events);
+        }
+
+        static void pollfd_removed_callback(int const fd, void* const user_data)
+        {
+            // libusb closes the descriptor right after this returns,
+            // so it has to be unregistered synchronously.
+            auto& self = *static_cast<usb_event_reactor*>(user_data);
+            auto const lock = std::scoped_lock{self.mutex_};
+            if (auto const iter = self.watched_fds_.find(fd); iter != self.watched_fds_.end())
+            {
+                iter->second.descriptor.release();
+                self.watched_fds_.erase(iter);
+            }
+        }
+
+        // Expects mutex_ to be held.
+        void add_fd(int const fd, short const events)
+        {
+            auto const [iter, inserted] = watched_fds_.try_emplace(
+                fd,
+                watched_fd{asio::posix::stream_descriptor{*ioc_, fd}, events});
+
+            if (inserted && active_)
+            {
+                async_wait_fd(fd, iter->second);
+            }
+        }
+
+        // Expects mutex_ to be held.
+        void async_wait_fd(int const fd, watched_fd& watched)
+        {
+            if (watched.waiting) { return; }
+            watched.waiting = true;
+
+            auto const wait_type = (watched.events & POLLOUT) != 0
+                                       ? asio::posix::stream_descriptor::wait_write
+                                       : asio::posix::stream_descriptor::wait_read;
+
+            watched.descriptor.async_wait(
+                wait_type,
+                [this, fd](error_code const& ec) {
+                    if (ec == asio::error::operation_aborted) { return; }
+
+                    {
+                        // Re-arm before handling the events: the reactor may be edge-triggered,
+                        // and anything becoming ready while handling must not be missed.
+                        auto const lock = std::scoped_lock{mutex_};
+                        if (auto const iter = watched_fds_.find(fd); iter != watched_fds_.end())
+                        {
+                            iter->second.waiting = false;
+                            if (ec)
+                            {
+                                // Waiting again would fail right away, and so on: stop watching it.
+                                iter->second.descriptor.release();
+                                watched_fds_.erase(iter);
+                            }
+                            else if (active_)
+                            {
+                                async_wait_fd(fd, iter->second);
+                            }
+                        }
+                    }
+
+                    if (!ec)
+                    {
+                        handle_events();
+                    }
+                });
+        }
+
+        // Expects mutex_ to be held.
+        void update_timeout()
+        {
+            auto tv = ::timeval{};
+            if (::libusb_get_next_timeout(context_handle_, &tv) != 1)
+            {
+                return;
+            }
+
+            timer_.expires_after(
+                std::chrono::seconds{tv.tv_sec}
+                + std::chrono::microseconds{tv.tv_usec});
+            timer_.async_wait([this](error_code const& ec) {
+                if (ec == asio::error::operation_aborted) { return; }
+
+                handle_events();
+            });
+        }
+
+        void handle_events() noexcept
+        {
+            // Only handle what is ready, never block the io_context thread.
+            auto zero_timeout = ::timeval{};
+            ::libusb_handle_events_timeout_completed(context_handle_, &zero_timeout, nullptr);
+
+            auto const lock = std::scoped_lock{mutex_};
+            if (active_)
+            {
+                update_timeout();
+            }
+        }
+    };
+#endif
+}  // namespace usb_asio
@@ -0,0 +1,298 @@
+#pragma once
+
+#include <concepts>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include <libusb.h>
+#include "usb_asio/asio.hpp"
+#include "usb_asio/completion_handler.hpp"
+#include "usb_asio/error.hpp"
+#include "usb_asio/handler_memory.hpp"
+#include "usb_asio/usb_descriptor_tree.hpp"
+#include "usb_asio/usb_device_info.hpp"
+#include "usb_asio/usb_service.hpp"
+
+namespace usb_asio
+{
+    enum class usb_hotplug_event_type
+    {
+        arrived = ::LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED,
+        left = ::LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+    };
+
+    struct usb_hotplug_event
+    {
+        usb_hotplug_event_type type;
+        // Devices that left can only be compared to other ones,
+        // they cannot be opened nor queried for anything but their descriptors.
+        usb_device_info device;
+    };
+
+    // Unset fields match any device.
+    struct usb_hotplug_filter
+    {
+        std::optional<std::uint16_t> vendor_id = {};
+        std::optional<std::uint16_t> product_id = {};
+        std::optional<std::uint8_t> device_class = {};
+        // Also reports the devices plugged in before the monitor was created, as arrivals.
+        bool enumerate = false;
+    };
+
+    // Watches for USB devices being plugged in and out, through libusb's hotplug callbacks.
+    // Events happening while no wait is pending are queued, none is lost.
+    // Keeps libusb events handled for as long as it exists, like an open device does.
+    // Throws usb_errc::not_supported on platforms without hotplug support.
+    template <typename Executor = asio::any_io_executor>
+    class basic_usb_hotplug_monitor
+    {
+      public:
+        using executor_type = Executor;
+        using service_type = usb_service;
+        using event_handler_sig = void(error_code, usb_hotplug_event);
+
+        explicit basic_usb_hotplug_monitor(
+            executor_type const& executor,
+            usb_hotplug_filter const& filter = {})
+          : executor_{executor}
+          , state_{new monitor_state{
+                asio::use_service<service_type>(asio::query(executor, asio::execution::context)),
+            }}
+        {
+            try
+            {
+                state_->register_callback(filter);
+            }
+            catch (...)
+            {
+                delete state_;
+                throw;
+            }
+        }
+
+        template <std::derived_from<asio::execution_context> ExecutionContext>
+        explicit basic_usb_hotplug_monitor(
+            ExecutionContext& context,
+            usb_hotplug_filter const& filter = {})
+          : basic_usb_hotplug_monitor{context.get_executor(), filter}
+        {
+        }
+
+        basic_usb_hotplug_monitor(basic_usb_hotplug_monitor const&) = delete;
+
+        basic_usb_hotplug_monitor(basic_usb_hotplug_monitor&& other) noexcept
+          : executor_{other.executor_}
+          , state_{std::exchange(other.state_, nullptr)}
+        {
+        }
+
+        ~basic_usb_hotplug_monitor() noexcept
+        {
+            delete state_;
+        }
+
+        // Completes the pending wait, if any, with asio::error::operation_aborted.
+        void cancel() noexcept
+        {
+            auto lock = std::unique_lock{state_->mutex};
+            state_->abort(lock);
+        }
+
+        // Drops the events that are queued but not waited for yet.
+        void clear() noexcept
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            state_->events.clear();
+        }
+
+        [[nodiscard]] auto get_executor() const noexcept -> executor_type
+        {
+            return executor_;
+        }
+
+        // Completes with the next event matching the filter.
+        // Only one wait may be pending at a time.
+        template <typename CompletionToken = asio::default_completion_token_t<executor_type>>
+        auto async_wait_event(CompletionToken&& token = {})
+        {
+            return asio::async_initiate<CompletionToken, event_handler_sig>(
+                [](auto completion_handler, monitor_state* const state, executor_type const& executor) {
+                    auto lock = std::unique_lock{state->mutex};
+                    state->handler = event_handler_t{
+                        executor,
+                        std::move(completion_handler),
+                        state->memory,
+                    };
+
+#ifdef USB_ASIO_HAS_CANCELLATION_SLOT
+                    state->handler.on_cancellation([state](asio::cancellation_type const type) {
+                        if ((type & (asio::cancellation_type::terminal | asio::cancellation_type::partial))
+                            != asio::cancellation_type::none)
+                        {
+                            auto lock = std::unique_lock{state->mutex};
+                            state->abort(lock);
+                        }
+                    });
+#endif
+
+                    state->try_deliver(lock, true);
+                },
+                std::forward<CompletionToken>(token),
+                state_,
+                executor_);
+        }
+
+        auto operator=(basic_usb_hotplug_monitor const&) = delete;
+
+        auto operator=(basic_usb_hotplug_monitor&& other) noexcept -> basic_usb_hotplug_monitor&
+        {
+            if (this != &other)
+            {
+                delete state_;
+                executor_ = other.executor_;
+                state_ = std::exchange(other.state_, nullptr);
+            }
+
+            return *this;
+        }
+
+      private:
+        using event_handler_t = completion_handler<executor_type, event_handler_sig>;
+
+        struct monitor_state
+        {
+            usb_service& service;
+            ::libusb_hotplug_callback_handle callback_handle = {};
+            bool registered = false;
+            std::mutex mutex;
+            std::deque<usb_hotplug_event> events;
+            handler_memory memory;
+            event_handler_t handler;
+
+            explicit monitor_state(usb_service& service)
+              : service{service} { }
+
+            monitor_state(monitor_state const&) = delete;
+
+            monitor_state(monitor_state&&) = delete;
+
+            ~monitor_state() noexcept
+            {
+                if (registered)
+                {
+                    // Hotplug callbacks run under a libusb lock that deregistration takes too,
+                    // so none is running anymore once this returns.
+                    ::libusb_hotplug_deregister_callback(service.handle(), callback_handle);
+                    service.notify_dev_closed();
+                }
+            }
+
+            auto operator=(monitor_state const&) = delete;
+
+            auto operator=(monitor_state&&) = delete;
+
+            void register_callback(usb_hotplug_filter const& filter)
+            {
+                if (::libusb_has_capability(::LIBUSB_CAP_HAS_HOTPLUG) == 0)
+                {
+                    throw system_error{make_error_code(usb_errc::not_supported)};
+                }
+
+                // Registering can run the callback already, when enumerating.
+                libusb_try(
+                    &::libusb_hotplug_register_callback,
+                    service.handle(),
+                    static_cast<::libusb_hotplug_event>(
+                        ::LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | ::LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+                    static_cast<::libusb_hotplug_flag>(filter.enumerate ? ::LIBUSB_HOTPLUG_ENUMERATE : 0),
+                    filter.vendor_id ? static_cast<int>(*filter.vendor_id) : LIBUSB_HOTPLUG_MATCH_ANY,
+                    filter.product_id ? static_cast<int>(*filter.product_id) : LIBUSB_HOTPLUG_MATCH_ANY,
+                    filter.device_class ? static_cast<int>(*filter.device_class) : LIBUSB_HOTPLUG_MATCH_ANY,
+                    &hotplug_callback,
+                    static_cast<void*>(this),
+                    &callback_handle);
+                registered = true;
+
+                // Hotplug callbacks are run by the libusb event handling.
+                service.notify_dev_opened();
+            }
+
+            void abort(std::unique_lock<std::mutex>& lock) noexcept
+            {
+                if (!handler)
+                {
+                    return;
+                }
+
+                auto event_handler = std::move(handler);
+                lock.unlock();
+                event_handler(asio::error::operation_aborted, usb_hotplug_event{});
+            }
+
+            // Immediate deliveries happen from within the initiating function.
+            void try_deliver(std::unique_lock<std::mutex>& lock, bool const immediate)
+            {
+                if (!handler || events.empty())
+                {
+                    return;
+                }
+
+                auto event = std::move(events.front());
+                events.pop_front();
+
+                auto event_handler = std::move(handler);
+                lock.unlock();
+                if (immediate)
+                {
+                    event_handler.complete_immediately(error_code{}, std::move(event));
+                }
+                else
+                {
+                    event_handler(error_code{}, std::move(event));
+                }
+            }
+
+            static auto hotplug_callback(
+                ::libusb_context* /* context */,
+                ::libusb_device* const device,
+                ::libusb_hotplug_event const event,
+                void* const user_data) noexcept
+                -> int
+            {
+                detail::count_handled_event();
+
+                auto* const self = static_cast<monitor_state*>(user_data);
+                auto const type = static_cast<usb_hotplug_event_type>(event);
+                auto info = usb_device_info{device};
+
+                if (type == usb_hotplug_event_type::left)
+                {
+                    detail::evict_descriptor_tree(self->service.context(), info);
+                }
+
+                auto lock = std::unique_lock{self->mutex};
+
+                try
+                {
+                    self->events.push_back(usb_hotplug_event{type, std::move(info)});
+                    self->try_deliver(lock, false);
+                }
+                catch (...)
+                {
+                    // Out of memory, nothing better to do than dropping the event.
+                }
+
+                // Keep the callback registered.
+                return 0;
+            }
+        };
+
+        executor_type executor_;
+        monitor_state* state_;
+    };
+
+    using usb_hotplug_monitor = basic_usb_hotplug_monitor<>;
+}  // namespace usb_asio
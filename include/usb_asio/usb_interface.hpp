@@ -25,6 +25,7 @@ namespace usb_asio
         explicit basic_usb_interface(executor_type const& executor)
           : executor_{executor}
           , service_{&asio::use_service<service_type>(asio::query(executor, asio::execution::context))}
+          , blocking_op_executor_{service_->blocking_op_executor()}
         {
         }
 
@@ -78,10 +79,11 @@ namespace usb_asio
 
         template <std::convertible_to<executor_type> OtherExecutor>
         basic_usb_interface(basic_usb_interface<OtherExecutor>&& other) noexcept
-          : device_handle_{std::exchange(other.device_, nullptr)}
+          : device_handle_{std::exchange(other.device_handle_, nullptr)}
           , number_{std::exchange(other.number_, 0)}
           , executor_{other.executor_}
           , service_{other.service_}
+          , blocking_op_executor_{other.blocking_op_executor_}
         {
         }
 
@@ -137,6 +139,40 @@ namespace usb_asio
 
             device_handle_ = device.handle();
             number_ = number;
+            // Keeps the interface operations ordered with the ones of the device.
+            blocking_op_executor_ = device.blocking_op_executor();
+        }
+
+        // Claiming (and detaching the kernel driver) can block for a while,
+        // this keeps it off the executor, ordered with the other blocking operations on the device.
+        // The interface must not be used until the operation completes.
+        template <
+            typename OtherExecutor,
+            typename CompletionToken = asio::default_completion_token_t<executor_type>>
+        auto async_claim(
+            basic_usb_device<OtherExecutor>& device,
+            std::uint8_t const number,
+            CompletionToken&& token = {})
+        {
+            return async_claim(device, number, true, std::forward<CompletionToken>(token));
+        }
+
+        template <
+            typename OtherExecutor,
+            typename CompletionToken = asio::default_completion_token_t<executor_type>>
+        auto async_claim(
+            basic_usb_device<OtherExecutor>& device,
+            std::uint8_t const number,
+            bool const detach_kernel_driver,
+            CompletionToken&& token = {})
+        {
+            return async_try_blocking_with_ec(
+                executor_,
+                device.blocking_op_executor(),
+                std::forward<CompletionToken>(token),
+                [this, &device, number, detach_kernel_driver](auto& ec) {
+                    claim(device, number, detach_kernel_driver, ec);
+                });
         }
 
         void unclaim(bool const reattach_kernel_driver = true)
@@ -189,7 +225,7 @@ namespace usb_asio
         {
             return async_try_blocking_with_ec(
                 executor_,
-                service_->blocking_op_executor(),
+                blocking_op_executor_,
                 std::forward<CompletionToken>(token),
                 [this, reattach_kernel_driver](auto& ec) {
                     unclaim(reattach_kernel_driver, ec);
@@ -222,7 +258,7 @@ namespace usb_asio
         {
             return async_try_blocking_with_ec(
                 executor_,
-                service_->blocking_op_executor(),
+                blocking_op_executor_,
                 std::forward<CompletionToken>(token),
                 [this, alt_setting](auto& ec) {
                     set_alt_setting(alt_setting, ec);
@@ -267,6 +303,7 @@ namespace usb_asio
             number_ = std::exchange(other.number_, 0);
             executor_ = other.executor_;
             service_ = other.service_;
+            blocking_op_executor_ = other.blocking_op_executor_;
 
             return *this;
         }
@@ -296,10 +333,11 @@ namespace usb_asio
         }
 
       private:
-        device_handle_type device_handle_;
+        device_handle_type device_handle_ = nullptr;
         std::uint8_t number_ = 0;
         executor_type executor_;
         service_type* service_;
+        asio::any_io_executor blocking_op_executor_;
     };
 
     using usb_interface = basic_usb_interface<>;
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <libusb.h>
+#include "usb_asio/asio.hpp"
+#include "usb_asio/completion_handler.hpp"
+#include "usb_asio/error.hpp"
+#include "usb_asio/transfer_ring.hpp"
+#include "usb_asio/usb_device.hpp"
+#include "usb_asio/usb_transfer.hpp"
+
+namespace usb_asio
+{
+    struct usb_iso_packet
+    {
+        // Points into the transfer buffer, sized by the packet's actual length.
+        std::span<std::byte const> payload;
+        error_code ec;
+    };
+
+    struct usb_iso_stream_stats
+    {
+        std::uint64_t transfers = 0;
+        std::uint64_t packets = 0;
+        // Packets that completed with an error, i.e. frames whose data is lost.
+        std::uint64_t missed_frames = 0;
+        // Completions that left no transfer in flight: the endpoint went idle
+        // because buffers were not handed back fast enough.
+        std::uint64_t underruns = 0;
+    };
+
+    // Continuous reader of an isochronous IN endpoint.
+    // Keeps a ring of transfers permanently submitted on the endpoint, and hands out
+    // their packets in order. All the memory is allocated up front, nothing is
+    // reallocated once streaming.
+    template <typename Executor = asio::any_io_executor>
+    class basic_usb_iso_in_stream
+    {
+      public:
+        using executor_type = Executor;
+        using packets_handler_sig = void(error_code, std::span<usb_iso_packet const>);
+
+        template <typename OtherExecutor>
+        basic_usb_iso_in_stream(
+            executor_type const& executor,
+            basic_usb_device<OtherExecutor>& device,
+            std::uint8_t const endpoint,
+            std::size_t const num_transfers,
+            std::size_t const num_packets,
+            std::size_t const packet_size,
+            std::chrono::milliseconds const timeout = usb_no_timeout,
+            std::pmr::memory_resource* const mem_resource = std::pmr::get_default_resource())
+          : executor_{executor}
+          , state_{new stream_state{
+                device.handle(),
+                endpoint,
+                num_transfers,
+                num_packets,
+                packet_size,
+                timeout,
+                mem_resource,
+            }}
+        {
+        }
+
+        template <std::convertible_to<executor_type> OtherExecutor>
+        basic_usb_iso_in_stream(
+            basic_usb_device<OtherExecutor>& device,
+            std::uint8_t const endpoint,
+            std::size_t const num_transfers,
+            std::size_t const num_packets,
+            std::size_t const packet_size,
+            std::chrono::milliseconds const timeout = usb_no_timeout,
+            std::pmr::memory_resource* const mem_resource = std::pmr::get_default_resource())
+          : basic_usb_iso_in_stream{
+              device.get_executor(),
+              device,
+              endpoint,
+              num_transfers,
+              num_packets,
+              packet_size,
+              timeout,
+              mem_resource,
+          }
+        {
+        }
+
+        basic_usb_iso_in_stream(basic_usb_iso_in_stream const&) = delete;
+
+        basic_usb_iso_in_stream(basic_usb_iso_in_stream&& other) noexcept
+          : executor_{other.executor_}
+          , state_{std::exchange(other.state_, nullptr)}
+        {
+        }
+
+        ~basic_usb_iso_in_stream() noexcept
+        {
+            if (state_ != nullptr)
+            {
+                // In-flight transfers keep the state alive until they complete.
+                state_->close();
+            }
+        }
+
+        // Submits every transfer that is not in flight.
+        // Called implicitly by the first read.
+        void start()
+        {
+            try_with_ec([&](auto& ec) {
+                start(ec);
+            });
+        }
+
+        void start(error_code& ec) noexcept
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            state_->start(ec);
+        }
+
+        // Stops resubmitting transfers and cancels those in flight.
+        // They are still handed out in order, with usb_transfer_errc::cancelled.
+        void cancel() noexcept
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            state_->stop();
+        }
+
+        [[nodiscard]] auto is_streaming() const noexcept -> bool
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            return state_->streaming;
+        }
+
+        [[nodiscard]] auto stats() const noexcept -> usb_iso_stream_stats
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            return state_->stats;
+        }
+
+        [[nodiscard]] auto num_transfers() const noexcept -> std::size_t
+        {
+            return state_->slots.size();
+        }
+
+        [[nodiscard]] auto completion_policy() const noexcept -> usb_completion_policy
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            return state_->policy;
+        }
+
+        // Applies to the operations started afterwards.
+        void set_completion_policy(usb_completion_policy const policy) noexcept
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            state_->policy = policy;
+        }
+
+        [[nodiscard]] auto get_executor() const noexcept -> executor_type
+        {
+            return executor_;
+        }
+
+        // Completes with the packets of the next transfer.
+        // The packets stay valid until the next read, which resubmits their transfer.
+        // Isochronous endpoints do not halt, so the stream only stops on cancellation,
+        // device disconnection or submission errors.
+        template <typename CompletionToken = asio::default_completion_token_t<executor_type>>
+        auto async_read_packets(CompletionToken&& token = {})
+        {
+            return asio::async_initiate<CompletionToken, packets_handler_sig>(
+                [](auto completion_handler, stream_state* const state, executor_type const& executor) {
+                    auto lock = std::unique_lock{state->mutex};
+                    state->handler = packets_handler_t{
+                        executor,
+                        std::move(completion_handler),
+                        state->memory,
+                        state->policy,
+                    };
+                    state->release_lent_slot();
+                    state->start_once();
+                    state->try_deliver(lock, true);
+                },
+                std::forward<CompletionToken>(token),
+                state_,
+                executor_);
+        }
+
+        auto operator=(basic_usb_iso_in_stream const&) = delete;
+
+        auto operator=(basic_usb_iso_in_stream&& other) noexcept -> basic_usb_iso_in_stream&
+        {
+            if (this != &other)
+            {
+                if (state_ != nullptr)
+                {
+                    state_->close();
+                }
+
+                executor_ = other.executor_;
+                state_ = std::exchange(other.state_, nullptr);
+            }
+
+            return *this;
+        }
+
+      private:
+        using packets_handler_t = completion_handler<Executor, packets_handler_sig>;
+
+        struct stream_state;
+
+        struct slot : detail::ring_slot<stream_state>
+        {
+            using detail::ring_slot<stream_state>::ring_slot;
+
+            // Bookkeeping, kept out of the transfer memory resource (DMA memory is scarce).
+            std::vector<usb_iso_packet> packets;
+        };
+
+        struct stream_state : detail::transfer_ring<stream_state, slot>
+        {
+            std::size_t packet_size;
+            usb_iso_stream_stats stats;
+            packets_handler_t handler;
+
+            stream_state(
+                ::libusb_device_handle* const device_handle,
+                std::uint8_t const endpoint,
+                std::size_t const num_transfers,
+                std::size_t const num_packets,
+                std::size_t const packet_size,
+                std::chrono::milliseconds const timeout,
+                std::pmr::memory_resource* const mem_resource)
+              : detail::transfer_ring<stream_state, slot>{
+                  num_transfers,
+                  static_cast<int>(num_packets),
+                  num_packets * packet_size,
+                  mem_resource,
+              }
+              , packet_size{packet_size}
+            {
+                if (num_packets == 0)
+                {
+                    throw std::invalid_argument{"A stream needs at least one transfer of one packet"};
+                }
+
+                for (auto& s : this->slots)
+                {
+                    s.packets.resize(num_packets);
+                    ::libusb_fill_iso_transfer(
+                        s.transfer.get(),
+                        device_handle,
+                        endpoint,
+                        reinterpret_cast<unsigned char*>(s.buffer.data()),
+                        static_cast<int>(s.buffer.size()),
+                        static_cast<int>(num_packets),
+                        &stream_state::completion_callback,
+                        &s,
+                        static_cast<unsigned>(timeout.count()));
+                    ::libusb_set_iso_packet_lengths(
+                        s.transfer.get(),
+                        static_cast<unsigned>(packet_size));
+                }
+            }
+
+            // The functions below expect the mutex to be held.
+
+            void clear_results(slot& s) noexcept
+            {
+                for (auto& packet : s.packets)
+                {
+                    packet = usb_iso_packet{};
+                }
+            }
+
+            void on_completed(slot& s, ::libusb_transfer const& transfer) noexcept
+            {
+                // Packets are laid out back to back in the buffer, each one
+                // at a multiple of the requested packet size.
+                auto const buffer = std::span<std::byte const>{s.buffer};
+                for (auto i = std::size_t{0}; i < s.packets.size(); ++i)
+                {
+                    auto const& packet_desc = transfer.iso_packet_desc[i];
+                    auto& packet = s.packets[i];
+
+                    packet.payload = buffer.subspan(
+                        i * packet_size,
+                        static_cast<std::size_t>(packet_desc.actual_length));
+                    packet.ec = packet_desc.status == ::LIBUSB_TRANSFER_COMPLETED
+                                    ? error_code{}
+                                    : error_code{static_cast<usb_transfer_errc>(packet_desc.status)};
+
+                    if (packet.ec)
+                    {
+                        ++stats.missed_frames;
+                    }
+                }
+
+                ++stats.transfers;
+                stats.packets += s.packets.size();
+
+                if (this->streaming && this->in_flight == 0)
+                {
+                    ++stats.underruns;
+                }
+            }
+
+            void deliver(slot& s, std::unique_lock<std::mutex>& lock, bool const immediate)
+            {
+                if (!handler)
+                {
+                    return;
+                }
+
+                auto const ec = s.ec;
+                auto const packets = std::span<usb_iso_packet const>{s.packets};
+                this->lend_head();
+
+                auto packets_handler = std::move(handler);
+                this->invoke_unlocked(lock, packets_handler, immediate, ec, packets);
+            }
+
+            void reset_handlers() noexcept
+            {
+                handler.reset();
+            }
+        };
+
+        executor_type executor_;
+        stream_state* state_;
+    };
+
+    using usb_iso_in_stream = basic_usb_iso_in_stream<>;
+}  // namespace usb_asio
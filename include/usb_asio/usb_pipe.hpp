@@ -0,0 +1,587 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <libusb.h>
+#include "usb_asio/asio.hpp"
+#include "usb_asio/completion_handler.hpp"
+#include "usb_asio/error.hpp"
+#include "usb_asio/flags.hpp"
+#include "usb_asio/handler_memory.hpp"
+#include "usb_asio/libusb_ptr.hpp"
+#include "usb_asio/transfer_owner.hpp"
+#include "usb_asio/usb_device.hpp"
+#include "usb_asio/usb_transfer.hpp"
+
+namespace usb_asio
+{
+    struct usb_pipe_options
+    {
+        // Number of chunks kept in flight.
+        std::size_t num_transfers = 4;
+        // Size of the chunks a buffer is split into.
+        // Should be a multiple of the endpoint's max packet size.
+        std::size_t max_transfer_size = std::size_t{64} << 10u;
+        // Terminate writes with a zero length packet when their size is a multiple
+        // of the endpoint's max packet size (an empty write sends a zero length packet).
+        bool zero_length_packet = false;
+        // Write segments smaller than this are copied into a staging buffer,
+        // together with their neighbours, instead of being sent on their own.
+        std::size_t coalesce_threshold = 512;
+        // Size of the staging buffer of each transfer, for writes.
+        std::size_t staging_size = 4096;
+        std::chrono::milliseconds timeout = usb_no_timeout;
+        // Memory of the staging buffers, such as a usb_dma_pool_resource.
+        std::pmr::memory_resource* mem_resource = std::pmr::get_default_resource();
+    };
+
+    // Bulk or interrupt endpoint transferring whole buffers.
+    // Buffers are split into chunks, transferred in place, with several of them in flight
+    // to keep the endpoint busy. At most one operation may be outstanding at a time.
+    template <
+        usb_transfer_type transfer_type_,
+        usb_transfer_direction transfer_direction_,
+        typename Executor = asio::any_io_executor>
+    class basic_usb_pipe
+    {
+        static_assert(
+            transfer_type_ == usb_transfer_type::bulk || transfer_type_ == usb_transfer_type::interrupt,
+            "Pipes are only supported on bulk and interrupt endpoints");
+
+      public:
+        using executor_type = Executor;
+        using completion_handler_sig = void(error_code, std::size_t);
+
+        static constexpr auto transfer_type = transfer_type_;
+        static constexpr auto transfer_direction = transfer_direction_;
+
+        template <typename OtherExecutor>
+        basic_usb_pipe(
+            executor_type const& executor,
+            basic_usb_device<OtherExecutor>& device,
+            std::uint8_t const endpoint,
+            usb_pipe_options const& options = {})
+          : executor_{executor}
+          , state_{new pipe_state{device.handle(), endpoint, options}}
+        {
+        }
+
+        template <std::convertible_to<executor_type> OtherExecutor>
+        basic_usb_pipe(
+            basic_usb_device<OtherExecutor>& device,
+            std::uint8_t const endpoint,
+            usb_pipe_options const& options = {})
+          : basic_usb_pipe{device.get_executor(), device, endpoint, options}
+        {
+        }
+
+        basic_usb_pipe(basic_usb_pipe const&) = delete;
+
+        basic_usb_pipe(basic_usb_pipe&& other) noexcept
+          : executor_{other.executor_}
+          , state_{std::exchange(other.state_, nullptr)}
+        {
+        }
+
+        ~basic_usb_pipe() noexcept
+        {
+            if (state_ != nullptr)
+            {
+                // In-flight transfers keep the state alive until they complete.
+                state_->close();
+            }
+        }
+
+        // Cancels the outstanding operation, which completes with the data transferred so far.
+        void cancel() noexcept
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            state_->cancel_after(0);
+        }
+
+        [[nodiscard]] auto options() const noexcept -> usb_pipe_options const&
+        {
+            return state_->options;
+        }
+
+        [[nodiscard]] auto completion_policy() const noexcept -> usb_completion_policy
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            return state_->policy;
+        }
+
+        // Applies to the operations started afterwards.
+        void set_completion_policy(usb_completion_policy const policy) noexcept
+        {
+            auto const lock = std::scoped_lock{state_->mutex};
+            state_->policy = policy;
+        }
+
+        [[nodiscard]] auto get_executor() const noexcept -> executor_type
+        {
+            return executor_;
+        }
+
+        // Reads until the buffer is full.
+        // A short or zero length packet ends the read early, with asio::error::eof
+        // and the number of bytes received until then. Chunks in flight after it are
+        // cancelled, and anything they received is lost: only pipeline reads of
+        // data whose length is known, or use a single transfer.
+        // clang-format off
+        template <typename CompletionToken = asio::default_completion_token_t<executor_type>>
+        auto async_read_exact(asio::mutable_buffer const buffer, CompletionToken&& token = {})
+        requires (transfer_direction == usb_transfer_direction::in)
+        // clang-format on
+        {
+            return async_transfer_impl(
+                buffer,
+                std::forward<CompletionToken>(token));
+        }
+
+        // Writes the whole buffer sequence, in order, as a single USB transfer.
+        // Large segments are sent in place. Small segments, and segment tails that would
+        // end a transfer with a short packet in the middle of the sequence, are copied
+        // into staging buffers, so that the device only sees a short packet at the end.
+        // clang-format off
+        template <
+            typename ConstBufferSequence,
+            typename CompletionToken = asio::default_completion_token_t<executor_type>>
+        auto async_write_all(ConstBufferSequence const& buffers, CompletionToken&& token = {})
+        requires (transfer_direction == usb_transfer_direction::out)
+            && asio::is_const_buffer_sequence<ConstBufferSequence>::value
+        // clang-format on
+        {
+            return async_transfer_impl(
+                buffers,
+                std::forward<CompletionToken>(token));
+        }
+
+        auto operator=(basic_usb_pipe const&) = delete;
+
+        auto operator=(basic_usb_pipe&& other) noexcept -> basic_usb_pipe&
+        {
+            if (this != &other)
+            {
+                if (state_ != nullptr)
+                {
+                    state_->close();
+                }
+
+                executor_ = other.executor_;
+                state_ = std::exchange(other.state_, nullptr);
+            }
+
+            return *this;
+        }
+
+      private:
+        using completion_handler_t = completion_handler<Executor, completion_handler_sig>;
+        using unique_transfer_type = libusb_ptr<::libusb_transfer, &::libusb_free_transfer>;
+
+        struct pipe_state;
+
+        struct chunk_slot
+        {
+            pipe_state* owner;
+            unique_transfer_type transfer;
+            std::pmr::vector<std::byte> staging;
+            std::size_t offset = 0;
+            bool in_flight = false;
+        };
+
+        struct pipe_state : detail::transfer_owner<pipe_state>
+        {
+            using detail::transfer_owner<pipe_state>::in_flight;
+            using detail::transfer_owner<pipe_state>::closed;
+
+            usb_pipe_options options;
+            std::size_t max_packet_size;
+            std::vector<chunk_slot> slots;
+            handler_memory memory;
+            completion_handler_t handler;
+            usb_completion_policy policy = usb_completion_policy::post;
+
+            // Outstanding operation, its capacity is kept between operations.
+            std::vector<asio::const_buffer> segments;
+            std::size_t segment_index = 0;
+            std::size_t segment_offset = 0;
+            std::size_t size = 0;
+            std::size_t submitted = 0;
+            bool zero_length_packet_pending = false;
+            // End of the data transferred before the first failed or short chunk.
+            std::size_t failure_end = 0;
+            error_code ec;
+
+            pipe_state(
+                ::libusb_device_handle* const device_handle,
+                std::uint8_t const endpoint,
+                usb_pipe_options const& pipe_options)
+              : options{pipe_options}
+              , max_packet_size{query_max_packet_size(device_handle, endpoint)}
+            {
+                if (options.num_transfers == 0 || options.max_transfer_size == 0)
+                {
+                    throw std::invalid_argument{"A pipe needs at least one non-empty transfer"};
+                }
+
+                // Keep the chunks made of whole packets.
+                options.max_transfer_size = std::max(
+                    options.max_transfer_size / max_packet_size * max_packet_size,
+                    max_packet_size);
+                auto const staging_size = transfer_direction == usb_transfer_direction::out
+                                              ? (std::max(options.staging_size, std::size_t{1}) + max_packet_size - 1u)
+                                                    / max_packet_size * max_packet_size
+                                              : 0u;
+
+                // Never reallocated, the transfers point to their slot.
+                slots.reserve(options.num_transfers);
+                for (auto i = std::size_t{0}; i < options.num_transfers; ++i)
+                {
+                    auto& slot = slots.emplace_back(
+                        this,
+                        unique_transfer_type{::libusb_alloc_transfer(0)},
+                        std::pmr::vector<std::byte>(staging_size, options.mem_resource));
+                    if (slot.transfer == nullptr)
+                    {
+                        throw std::bad_alloc{};
+                    }
+
+                    auto* const transfer = slot.transfer.get();
+                    transfer->dev_handle = device_handle;
+                    transfer->endpoint = static_cast<unsigned char>(
+                        (endpoint & ~LIBUSB_ENDPOINT_DIR_MASK)
+                        | static_cast<unsigned>(transfer_direction));
+                    transfer->type = static_cast<unsigned char>(transfer_type);
+                    transfer->timeout = static_cast<unsigned>(options.timeout.count());
+                    transfer->callback = &completion_callback;
+                    transfer->user_data = &slot;
+                }
+            }
+
+            // The functions below expect the mutex to be held.
+
+            void start() noexcept
+            {
+                size = asio::buffer_size(segments);
+                segment_index = 0;
+                segment_offset = 0;
+                skip_consumed_segments();
+                submitted = 0;
+                zero_length_packet_pending = size == 0
+                                             && options.zero_length_packet
+                                             && transfer_direction == usb_transfer_direction::out;
+                failure_end = size;
+                ec.clear();
+
+                submit_chunks();
+            }
+
+            [[nodiscard]] auto has_more_chunks() const noexcept -> bool
+            {
+                return submitted < size || zero_length_packet_pending;
+            }
+
+            [[nodiscard]] auto is_done() const noexcept -> bool
+            {
+                return in_flight == 0 && (ec || !has_more_chunks());
+            }
+
+            void skip_consumed_segments() noexcept
+            {
+                while (segment_index < segments.size()
+                       && segment_offset == segments[segment_index].size())
+                {
+                    ++segment_index;
+                    segment_offset = 0;
+                }
+            }
+
+            [[nodiscard]] auto segment_remainder() const noexcept -> std::span<std::byte const>
+            {
+                auto const& segment = segments[segment_index];
+                return std::span{static_cast<std::byte const*>(segment.data()), segment.size()}
+                    .subspan(segment_offset);
+            }
+
+            void consume(std::size_t const length) noexcept
+            {
+                segment_offset += length;
+                submitted += length;
+                skip_consumed_segments();
+            }
+
+            // Points the transfer to the next chunk: either a part of a segment,
+            // or several (parts of) segments copied into the staging buffer.
+            void fill_next_chunk(chunk_slot& slot) noexcept
+            {
+                auto* const transfer = slot.transfer.get();
+                slot.offset = submitted;
+
+                if (size == 0)
+                {
+                    zero_length_packet_pending = false;
+                    transfer->buffer = nullptr;
+                    transfer->length = 0;
+                    return;
+                }
+
+                auto const remainder = segment_remainder();
+                auto const is_large = [&](std::span<std::byte const> const data) {
+                    return slot.staging.empty() || data.size() >= options.coalesce_threshold;
+                };
+
+                if (is_large(remainder))
+                {
+                    auto length = std::min(remainder.size(), options.max_transfer_size);
+                    if (submitted + length != size && length >= max_packet_size)
+                    {
+                        length -= length % max_packet_size;
+                    }
+
+                    if (submitted + length == size
+                        || length % max_packet_size == 0
+                        || slot.staging.empty())
+                    {
+                        transfer->buffer = reinterpret_cast<unsigned char*>(
+                            const_cast<std::byte*>(remainder.data()));
+                        transfer->length = static_cast<int>(length);
+                        consume(length);
+                        return;
+                    }
+                }
+
+                auto staged = std::size_t{0};
+                while (staged < slot.staging.size() && submitted < size)
+                {
+                    auto const data = segment_remainder();
+                    if (is_large(data) && staged % max_packet_size == 0 && staged > 0)
+                    {
+                        // Let the large segment go in place.
+                        break;
+                    }
+
+                    auto length = std::min(data.size(), slot.staging.size() - staged);
+                    if (is_large(data))
+                    {
+                        // Only top up to a packet boundary.
+                        length = std::min(length, max_packet_size - staged % max_packet_size);
+                    }
+
+                    std::memcpy(slot.staging.data() + staged, data.data(), length);
+                    staged += length;
+                    consume(length);
+                }
+
+                transfer->buffer = reinterpret_cast<unsigned char*>(slot.staging.data());
+                transfer->length = static_cast<int>(staged);
+            }
+
+            void submit_chunks() noexcept
+            {
+                for (auto& slot : slots)
+                {
+                    if (ec || !has_more_chunks()) { return; }
+                    if (slot.in_flight) { continue; }
+
+                    fill_next_chunk(slot);
+
+                    auto* const transfer = slot.transfer.get();
+                    transfer->flags = !has_more_chunks()
+                                              && options.zero_length_packet
+                                              && transfer_direction == usb_transfer_direction::out
+                                          ? ::LIBUSB_TRANSFER_ADD_ZERO_PACKET
+                                          : 0;
+
+                    auto submit_ec = error_code{};
+                    libusb_try(submit_ec, &::libusb_submit_transfer, transfer);
+                    if (submit_ec)
+                    {
+                        fail(slot.offset, submit_ec);
+                        return;
+                    }
+
+                    slot.in_flight = true;
+                    ++in_flight;
+                }
+            }
+
+            void fail(std::size_t const end, error_code const& failure_ec) noexcept
+            {
+                if (!ec || end < failure_end)
+                {
+                    failure_end = end;
+                    ec = failure_ec;
+                }
+
+                // Whatever comes after the failure would leave a hole in the buffer.
+                cancel_after(end);
+            }
+
+            void cancel_after(std::size_t const offset) noexcept
+            {
+                for (auto& slot : slots)
+                {
+                    if (slot.in_flight && slot.offset >= offset)
+                    {
+                        ::libusb_cancel_transfer(slot.transfer.get());
+                    }
+                }
+            }
+
+            // Immediate completions happen from within the initiating function.
+            void complete(std::unique_lock<std::mutex>& lock, bool const immediate)
+            {
+                auto const result_ec = ec;
+                auto const transferred = ec ? failure_end : size;
+
+                auto completion_handler = std::move(handler);
+                this->invoke_unlocked(lock, completion_handler, immediate, result_ec, transferred);
+            }
+
+            static void completion_callback(::libusb_transfer* const transfer) noexcept
+            {
+                detail::count_handled_event();
+
+                auto& slot = *static_cast<chunk_slot*>(transfer->user_data);
+                auto* const self = slot.owner;
+                auto lock = std::unique_lock{self->mutex};
+
+                slot.in_flight = false;
+                --self->in_flight;
+
+                auto const actual_length = static_cast<std::size_t>(transfer->actual_length);
+                if (transfer->status != ::LIBUSB_TRANSFER_COMPLETED)
+                {
+                    self->fail(
+                        slot.offset + actual_length,
+                        error_code{static_cast<usb_transfer_errc>(transfer->status)});
+                }
+                else if (actual_length < static_cast<std::size_t>(transfer->length))
+                {
+                    // Short packet: the device ended the transfer.
+                    self->fail(slot.offset + actual_length, asio::error::eof);
+                }
+
+                if (!self->closed)
+                {
+                    self->submit_chunks();
+
+                    if (self->is_done())
+                    {
+                        self->complete(lock, false);
+                    }
+                }
+                self->release(lock);
+            }
+
+            [[nodiscard]] static auto query_max_packet_size(
+                ::libusb_device_handle* const device_handle,
+                std::uint8_t const endpoint) noexcept
+                -> std::size_t
+            {
+                auto const max_packet_size = ::libusb_get_max_packet_size(
+                    ::libusb_get_device(device_handle),
+                    static_cast<unsigned char>(
+                        (endpoint & ~LIBUSB_ENDPOINT_DIR_MASK)
+                        | static_cast<unsigned>(transfer_direction)));
+
+                // Without it, nothing can be kept aligned to packets.
+                return max_packet_size > 0
+                           ? static_cast<std::size_t>(max_packet_size)
+                           : std::size_t{1};
+            }
+
+            // Called by the pipe instead of deleting the state.
+            // In-flight transfers and handlers being invoked keep it alive until they are done.
+            void close() noexcept
+            {
+                auto lock = std::unique_lock{this->mutex};
+                closed = true;
+                handler.reset();
+                cancel_after(0);
+                this->release(lock);
+            }
+        };
+
+        executor_type executor_;
+        pipe_state* state_;
+
+        template <typename BufferSequence, typename CompletionToken>
+        auto async_transfer_impl(BufferSequence const& buffers, CompletionToken&& token)
+        {
+            return asio::async_initiate<CompletionToken, completion_handler_sig>(
+                [](auto completion_handler, pipe_state* const state, executor_type const& executor, BufferSequence const& buffers) {
+                    auto lock = std::unique_lock{state->mutex};
+                    state->segments.assign(
+                        asio::buffer_sequence_begin(buffers),
+                        asio::buffer_sequence_end(buffers));
+                    state->handler = completion_handler_t{
+                        executor,
+                        std::move(completion_handler),
+                        state->memory,
+                        state->policy,
+                    };
+
+#ifdef USB_ASIO_HAS_CANCELLATION_SLOT
+                    state->handler.on_cancellation([state](asio::cancellation_type const type) {
+                        if ((type & (asio::cancellation_type::terminal | asio::cancellation_type::partial))
+                            != asio::cancellation_type::none)
+                        {
+                            auto const lock = std::scoped_lock{state->mutex};
+                            state->cancel_after(0);
+                        }
+                    });
+#endif
+
+                    state->start();
+
+                    if (state->is_done())
+                    {
+                        state->complete(lock, true);
+                    }
+                },
+                std::forward<CompletionToken>(token),
+                state_,
+                executor_,
+                buffers);
+        }
+    };
+
+    template <typename Executor = asio::any_io_executor>
+    using basic_usb_in_bulk_pipe = basic_usb_pipe<
+        usb_transfer_type::bulk,
+        usb_transfer_direction::in,
+        Executor>;
+    using usb_in_bulk_pipe = basic_usb_in_bulk_pipe<>;
+
+    template <typename Executor = asio::any_io_executor>
+    using basic_usb_out_bulk_pipe = basic_usb_pipe<
+        usb_transfer_type::bulk,
+        usb_transfer_direction::out,
+        Executor>;
+    using usb_out_bulk_pipe = basic_usb_out_bulk_pipe<>;
+
+    template <typename Executor = asio::any_io_executor>
+    using basic_usb_in_interrupt_pipe = basic_usb_pipe<
+        usb_transfer_type::interrupt,
+        usb_transfer_direction::in,
+        Executor>;
+    using usb_in_interrupt_pipe = basic_usb_in_interrupt_pipe<>;
+
+    template <typename Executor = asio::any_io_executor>
+    using basic_usb_out_interrupt_pipe = basic_usb_pipe<
+        usb_transfer_type::interrupt,
+        usb_transfer_direction::out,
+        Executor>;
+    using usb_out_interrupt_pipe = basic_usb_out_interrupt_pipe<>;
+}  // namespace usb_asio
@@ -1,16 +1,90 @@
 #pragma once
 
-#include <condition_variable>
-#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stop_token>
 #include <thread>
+#include <vector>
 
 #include <libusb.h>
 #include "usb_asio/asio.hpp"
 #include "usb_asio/error.hpp"
 #include "usb_asio/libusb_ptr.hpp"
+#include "usb_asio/usb_capture.hpp"
+#include "usb_asio/usb_device_info.hpp"
+#include "usb_asio/usb_event_reactor.hpp"
+#include "usb_asio/usb_thread_scheduling.hpp"
+#include "usb_asio/usb_transfer_metrics.hpp"
 
 namespace usb_asio
 {
+    enum class usb_event_handling
+    {
+        // libusb events are handled by a dedicated thread.
+        event_thread,
+        // libusb file descriptors are watched by the io_context's reactor,
+        // and events are handled on the threads running the io_context.
+        // Requires the execution context to be an io_context, POSIX, and a libusb signalling
+        // its timeouts through its file descriptors (usb_errc::not_supported otherwise).
+        reactor,
+        // Like event_thread, but the threads poll libusb without sleeping while devices are busy,
+        // saving the wakeup latency at the cost of a core each. See usb_busy_poll_options.
+        busy_poll,
+    };
+
+    struct usb_busy_poll_options
+    {
+        // How long to keep polling without sleeping after the last activity, spins for as long
+        // as devices are open by default.
+        std::chrono::nanoseconds spin_duration = std::chrono::nanoseconds::max();
+        // Longest sleep once backing off. Activity waking the thread up before then
+        // starts spinning again.
+        std::chrono::microseconds backoff = std::chrono::milliseconds{1};
+    };
+
+    struct usb_service_options
+    {
+        usb_event_handling event_handling = usb_event_handling::event_thread;
+        usb_busy_poll_options busy_poll = {};
+        // Threads running the blocking operations (configuration, reset, claiming...).
+        // Operations on a single device stay ordered whatever the number of threads.
+        std::size_t blocking_op_threads = 1;
+        // Independent libusb contexts, each with its own event thread, that the opened devices
+        // are spread over so that completions are processed on several cores.
+        // Not supported with usb_event_handling::reactor.
+        std::size_t event_shards = 1;
+        // Picks the shard of a device being opened, the result is taken modulo event_shards.
+        // Defaults to the bus number, keeping the devices of a root hub together.
+        std::function<std::size_t(usb_device_info const&)> event_shard_selector = {};
+        // Applied to every event thread, not to the threads running the io_context in reactor mode.
+        usb_thread_scheduling event_thread_scheduling = {};
+        usb_thread_scheduling blocking_op_thread_scheduling = {};
+        // Where the transfers created on the service record what they submit, see usb_capture.
+        std::shared_ptr<usb_capture> capture = {};
+    };
+
+    namespace detail
+    {
+        // Libusb callbacks handled on the current thread, so that busy polling event threads
+        // know whether a poll did anything.
+        inline thread_local std::uint64_t handled_events = 0;
+
+        // Called by every libusb callback of the I/O objects.
+        inline void count_handled_event() noexcept
+        {
+            ++handled_events;
+        }
+    }  // namespace detail
+
     class usb_service final : public asio::execution_context::service
     {
       public:
@@ -20,18 +94,57 @@ namespace usb_asio
         static inline auto id = asio::execution_context::id{};
 
         explicit usb_service(asio::execution_context& context)
+          : usb_service{context, usb_service_options{}}
+        {
+        }
+
+        // Use make_usb_service to create the service with non-default options.
+        usb_service(
+            asio::execution_context& context,
+            usb_service_options const& options,
+            asio::io_context* const reactor_context = nullptr)
           : asio::execution_context::service{context}
-          , handle_{create()}
-          , usb_event_thread_{[this](auto const& stop_token) {
-              run_usb_event_thread(stop_token);
-          }}
-          , blocking_op_thread_{[this]() { blocking_op_ioc_.run(); }}
+          , handles_{create(std::max(options.event_shards, std::size_t{1}))}
+          , event_shard_selector_{options.event_shard_selector}
+          , capture_{options.capture}
           , blocking_op_executor_{
                 asio::require(
                     blocking_op_ioc_.get_executor(),
                     asio::execution::outstanding_work_t::tracked),
             }
         {
+            if (options.event_handling == usb_event_handling::reactor && handles_.size() > 1u)
+            {
+                throw system_error{make_error_code(usb_errc::not_supported)};
+            }
+
+            // Started once the executor keeps the io_context busy, so that they do not
+            // return right away.
+            auto const num_blocking_op_threads = std::max(options.blocking_op_threads, std::size_t{1});
+            blocking_op_threads_.reserve(num_blocking_op_threads);
+            for (auto i = std::size_t{0}; i < num_blocking_op_threads; ++i)
+            {
+                blocking_op_threads_.emplace_back([this]() { blocking_op_ioc_.run(); });
+                apply_scheduling(blocking_op_threads_.back(), options.blocking_op_thread_scheduling);
+            }
+
+            if (options.event_handling == usb_event_handling::reactor)
+            {
+                create_event_reactor(reactor_context);
+            }
+            else
+            {
+                event_loops_.reserve(handles_.size());
+                for (auto const& handle : handles_)
+                {
+                    event_loops_.push_back(std::make_unique<event_loop>(
+                        handle.get(),
+                        options.event_handling == usb_event_handling::busy_poll
+                            ? std::optional{options.busy_poll}
+                            : std::nullopt));
+                    apply_scheduling(event_loops_.back()->thread(), options.event_thread_scheduling);
+                }
+            }
         }
 
         usb_service(usb_service const&) = delete;
@@ -40,13 +153,137 @@ namespace usb_asio
 
         void shutdown() noexcept override
         {
-            usb_event_thread_.request_stop();
-            usb_event_loop_cv_.notify_one();
+            for (auto const& loop : event_loops_)
+            {
+                loop->request_stop();
+            }
+
+#ifdef USB_ASIO_HAS_EVENT_REACTOR
+            if (event_reactor_ != nullptr)
+            {
+                event_reactor_->shutdown();
+            }
+#endif
         }
 
+        // The primary context, shard 0, which devices are listed and watched for on:
+        // usb_device_info always refers to one of its devices.
         [[nodiscard]] auto handle() const noexcept -> handle_type
         {
-            return handle_.get();
+            return handles_.front().get();
+        }
+
+        [[nodiscard]] auto handle(std::size_t const shard) const noexcept -> handle_type
+        {
+            return handles_[shard].get();
+        }
+
+        [[nodiscard]] auto num_event_shards() const noexcept -> std::size_t
+        {
+            return handles_.size();
+        }
+
+        [[nodiscard]] auto event_shard_of(usb_device_info const& info) const -> std::size_t
+        {
+            if (handles_.size() == 1u)
+            {
+                return 0;
+            }
+
+            auto const shard = event_shard_selector_
+                                   ? event_shard_selector_(info)
+                                   : std::size_t{info.bus_number()};
+            return shard % handles_.size();
+        }
+
+        // The same device as seen by the context of the given shard, found by its bus
+        // and address. Completes with usb_errc::no_device if it is not there anymore.
+        [[nodiscard]] auto device_in_shard(
+            usb_device_info const& info,
+            std::size_t const shard,
+            error_code& ec) const
+            -> usb_device_info
+        {
+            if (shard == 0u)
+            {
+                return info;
+            }
+
+            auto device_handles = static_cast<usb_device_info::handle_type*>(nullptr);
+            auto const num_devices = libusb_try(
+                ec,
+                &::libusb_get_device_list,
+                handle(shard),
+                &device_handles);
+            if (ec) { return {}; }
+
+            auto handles_deleter = [](auto const device_handles) {
+                ::libusb_free_device_list(device_handles, true);
+            };
+            auto handles_owner = std::unique_ptr<usb_device_info::handle_type[], decltype(handles_deleter)>{
+                device_handles,
+                handles_deleter,
+            };
+
+            auto const bus_number = info.bus_number();
+            auto const device_address = info.device_address();
+            for (auto const device_handle : std::span{device_handles, num_devices})
+            {
+                if (::libusb_get_bus_number(device_handle) == bus_number
+                    && ::libusb_get_device_address(device_handle) == device_address)
+                {
+                    return usb_device_info{device_handle};
+                }
+            }
+
+            ec = make_error_code(usb_errc::no_device);
+            return {};
+        }
+
+        // Why the threads could not be given the requested scheduling, if they could not.
+        // They run with the default one then.
+        [[nodiscard]] auto thread_scheduling_error() const noexcept -> error_code
+        {
+            return thread_scheduling_error_;
+        }
+
+        // Null without usb_service_options::capture.
+        [[nodiscard]] auto capture() const noexcept -> usb_capture*
+        {
+            return capture_.get();
+        }
+
+        // Per-endpoint transfer counters and latencies, of every endpoint a transfer was created for.
+        // Always empty unless compiled with USB_ASIO_ENABLE_TRANSFER_METRICS.
+        [[nodiscard]] auto transfer_metrics() const -> std::vector<usb_endpoint_metrics>
+        {
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+            return transfer_metrics_.snapshot();
+#else
+            return {};
+#endif
+        }
+
+        // Zeroes the transfer metrics, e.g. after warming up.
+        void reset_transfer_metrics() noexcept
+        {
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+            transfer_metrics_.reset();
+#endif
+        }
+
+        // Where transfers on the endpoint of the open device record their metrics,
+        // null if the metrics are disabled.
+        [[nodiscard]] auto endpoint_metrics(
+            [[maybe_unused]] ::libusb_device_handle* const device_handle,
+            [[maybe_unused]] std::uint8_t const endpoint)
+            -> detail::endpoint_metrics_recorder*
+        {
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+            return transfer_metrics_.endpoint(device_handle, endpoint);
+#else
+            return nullptr;
+#endif
         }
 
         [[nodiscard]] auto blocking_op_executor() noexcept
@@ -54,19 +291,37 @@ namespace usb_asio
             return blocking_op_executor_;
         }
 
-        void notify_dev_opened()
+        // Executor running blocking operations one at a time, in order,
+        // to be used for all the blocking operations on a single device.
+        [[nodiscard]] auto make_blocking_op_strand() -> asio::any_io_executor
+        {
+            return asio::make_strand(blocking_op_executor_);
+        }
+
+        void notify_dev_opened(std::size_t const shard = 0)
         {
-            auto lock = std::unique_lock{usb_event_loop_mutex_};
-            if (open_devices_.fetch_add(1) == 0)
+#ifdef USB_ASIO_HAS_EVENT_REACTOR
+            if (event_reactor_ != nullptr)
             {
-                lock.unlock();
-                usb_event_loop_cv_.notify_one();
+                event_reactor_->notify_dev_opened();
+                return;
             }
+#endif
+
+            event_loops_[shard]->notify_dev_opened();
         }
 
-        void notify_dev_closed() noexcept
+        void notify_dev_closed(std::size_t const shard = 0) noexcept
         {
-            --open_devices_;
+#ifdef USB_ASIO_HAS_EVENT_REACTOR
+            if (event_reactor_ != nullptr)
+            {
+                event_reactor_->notify_dev_closed();
+                return;
+            }
+#endif
+
+            event_loops_[shard]->notify_dev_closed();
         }
 
         auto operator=(usb_service const&) = delete;
@@ -79,40 +334,189 @@ namespace usb_asio
         }
 
       private:
-        unique_handle_type handle_;
-        std::atomic<std::size_t> open_devices_ = 0;
-        std::mutex usb_event_loop_mutex_;
-        std::condition_variable usb_event_loop_cv_;
-        std::jthread usb_event_thread_;
-        asio::io_context blocking_op_ioc_;
-        std::jthread blocking_op_thread_;
-        asio::any_io_executor blocking_op_executor_;
-
-        void run_usb_event_thread(std::stop_token const& stop_token) noexcept
+        // Idles without any open device of its shard, handles libusb events otherwise.
+        class event_loop
         {
-            while (true)
+          public:
+            event_loop(handle_type const handle, std::optional<usb_busy_poll_options> const& busy_poll)
+              : handle_{handle}
+              , busy_poll_{busy_poll}
+              , thread_{[this](auto const& stop_token) { run(stop_token); }}
+            {
+            }
+
+            void notify_dev_opened() noexcept
             {
+                if (state_.fetch_add(1u, std::memory_order_acq_rel) == 0u)
                 {
-                    auto lock = std::unique_lock{usb_event_loop_mutex_};
-                    usb_event_loop_cv_.wait(lock, [&]() {
-                        return open_devices_ > 0 || stop_token.stop_requested();
-                    });
+                    state_.notify_one();
                 }
+            }
+
+            void notify_dev_closed() noexcept
+            {
+                state_.fetch_sub(1u, std::memory_order_acq_rel);
+            }
+
+            // Wakes the thread up, see run.
+            void request_stop() noexcept
+            {
+                thread_.request_stop();
+            }
 
-                if (stop_token.stop_requested())
+            [[nodiscard]] auto thread() noexcept -> std::jthread&
+            {
+                return thread_;
+            }
+
+          private:
+            static constexpr auto stopping = std::size_t{1} << (std::numeric_limits<std::size_t>::digits - 1);
+
+            handle_type handle_;
+            std::optional<usb_busy_poll_options> busy_poll_;
+            std::chrono::steady_clock::time_point last_activity_ = {};
+            // Number of open devices, with stopping set once the thread must stop.
+            std::atomic<std::size_t> state_ = 0;
+            std::jthread thread_;
+
+            void run(std::stop_token const& stop_token) noexcept
+            {
+                auto const on_stop = std::stop_callback{stop_token, [this]() noexcept {
+                    state_.fetch_or(stopping, std::memory_order_acq_rel);
+                    state_.notify_one();
+                    // Returns from libusb_handle_events right away, even if called after this.
+                    ::libusb_interrupt_event_handler(handle_);
+                }};
+
+                while (true)
                 {
-                    break;
+                    auto const state = state_.load(std::memory_order_acquire);
+                    if ((state & stopping) != 0u)
+                    {
+                        break;
+                    }
+
+                    if (state == 0u)
+                    {
+                        state_.wait(state, std::memory_order_acquire);
+                        continue;
+                    }
+
+                    if (busy_poll_)
+                    {
+                        poll_busy(*busy_poll_);
+                    }
+                    else
+                    {
+                        ::libusb_handle_events(handle_);
+                    }
+                }
+            }
+
+            void poll_busy(usb_busy_poll_options const& options) noexcept
+            {
+                using clock = std::chrono::steady_clock;
+
+                auto const now = clock::now();
+                auto const handled_before = detail::handled_events;
+
+                if (now - last_activity_ < options.spin_duration)
+                {
+                    auto no_timeout = ::timeval{};
+                    ::libusb_handle_events_timeout_completed(handle_, &no_timeout, nullptr);
+
+                    if (detail::handled_events != handled_before)
+                    {
+                        last_activity_ = clock::now();
+                    }
+                    return;
                 }
 
-                ::libusb_handle_events(handle());
+                auto const backoff_us = options.backoff.count();
+                auto backoff = ::timeval{};
+                backoff.tv_sec = static_cast<decltype(backoff.tv_sec)>(backoff_us / 1'000'000);
+                backoff.tv_usec = static_cast<decltype(backoff.tv_usec)>(backoff_us % 1'000'000);
+                ::libusb_handle_events_timeout_completed(handle_, &backoff, nullptr);
+
+                // Returning early means something happened too, even without callbacks of ours
+                // (e.g. synchronous libusb calls): likely more is coming.
+                auto const woken_up = clock::now();
+                if (detail::handled_events != handled_before || woken_up - now < options.backoff)
+                {
+                    last_activity_ = woken_up;
+                }
             }
+        };
+
+        // Outlive the event loops using them.
+        std::vector<unique_handle_type> handles_;
+        std::function<std::size_t(usb_device_info const&)> event_shard_selector_;
+        std::shared_ptr<usb_capture> capture_;
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+        detail::transfer_metrics_registry transfer_metrics_;
+#endif
+        std::vector<std::unique_ptr<event_loop>> event_loops_;
+#ifdef USB_ASIO_HAS_EVENT_REACTOR
+        std::unique_ptr<usb_event_reactor> event_reactor_;
+#endif
+        asio::io_context blocking_op_ioc_;
+        // Joined once blocking_op_executor_ stopped keeping the io_context busy.
+        std::vector<std::jthread> blocking_op_threads_;
+        asio::any_io_executor blocking_op_executor_;
+        error_code thread_scheduling_error_;
+
+        // Keeps the first error.
+        void apply_scheduling(std::jthread& thread, usb_thread_scheduling const& scheduling) noexcept
+        {
+            auto ec = error_code{};
+            apply_thread_scheduling(thread, scheduling, ec);
+            if (ec && !thread_scheduling_error_)
+            {
+                thread_scheduling_error_ = ec;
+            }
+        }
+
+        void create_event_reactor([[maybe_unused]] asio::io_context* const reactor_context)
+        {
+#ifdef USB_ASIO_HAS_EVENT_REACTOR
+            if (reactor_context != nullptr)
+            {
+                event_reactor_ = std::make_unique<usb_event_reactor>(*reactor_context, handle());
+                return;
+            }
+#endif
+
+            throw system_error{make_error_code(usb_errc::not_supported)};
         }
 
-        [[nodiscard]] static auto create() -> unique_handle_type
+        [[nodiscard]] static auto create(std::size_t const num_handles) -> std::vector<unique_handle_type>
         {
-            auto handle = handle_type{};
-            libusb_try(&::libusb_init, &handle);
-            return unique_handle_type{handle};
+            auto handles = std::vector<unique_handle_type>{};
+            handles.reserve(num_handles);
+            for (auto i = std::size_t{0}; i < num_handles; ++i)
+            {
+                auto handle = handle_type{};
+                libusb_try(&::libusb_init, &handle);
+                handles.emplace_back(handle);
+            }
+
+            return handles;
         }
     };
+
+    // Creates the usb_service of the given execution context with non-default options.
+    // Must be called before anything else uses the service, otherwise
+    // asio::service_already_exists is thrown.
+    template <std::derived_from<asio::execution_context> ExecutionContext>
+    auto make_usb_service(ExecutionContext& context, usb_service_options const& options)
+        -> usb_service&
+    {
+        auto* reactor_context = static_cast<asio::io_context*>(nullptr);
+        if constexpr (std::derived_from<ExecutionContext, asio::io_context>)
+        {
+            reactor_context = &context;
+        }
+
+        return asio::make_service<usb_service>(context, options, reactor_context);
+    }
 }  // namespace usb_asio
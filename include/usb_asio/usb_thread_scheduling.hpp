@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "usb_asio/asio.hpp"
+#include "usb_asio/error.hpp"
+
+#if defined(__linux__)
+#define USB_ASIO_HAS_THREAD_SCHEDULING 1
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace usb_asio
+{
+    // Where and how the threads of the service run, see usb_service_options.
+    struct usb_thread_scheduling
+    {
+        // CPUs the threads may run on, any of them when empty.
+        std::vector<std::size_t> cpus = {};
+        // SCHED_FIFO priority (1 to 99), 0 keeps the default scheduling.
+        int fifo_priority = 0;
+
+        [[nodiscard]] auto is_default() const noexcept -> bool
+        {
+            return cpus.empty() && fifo_priority == 0;
+        }
+    };
+
+    // Applies what the system permits: a thread that cannot be pinned or made real-time
+    // (no CAP_SYS_NICE, RLIMIT_RTPRIO too low...) keeps running with the default scheduling,
+    // and ec tells why. Only Linux is supported, other systems give usb_errc::not_supported.
+    inline void apply_thread_scheduling(
+        std::jthread& thread,
+        usb_thread_scheduling const& scheduling,
+        error_code& ec) noexcept
+    {
+        ec = {};
+        if (scheduling.is_default())
+        {
+            return;
+        }
+
+#ifdef USB_ASIO_HAS_THREAD_SCHEDULING
+        auto const native_handle = thread.native_handle();
+
+        if (!scheduling.cpus.empty())
+        {
+            auto cpu_set = ::cpu_set_t{};
+            CPU_ZERO(&cpu_set);
+            for (auto const cpu : scheduling.cpus)
+            {
+                if (cpu < CPU_SETSIZE)
+                {
+                    CPU_SET(cpu, &cpu_set);
+                }
+            }
+
+            if (auto const result = ::pthread_setaffinity_np(native_handle, sizeof(cpu_set), &cpu_set); result != 0)
+            {
+                ec = error_code{result, asio::error::get_system_category()};
+            }
+        }
+
+        if (scheduling.fifo_priority != 0)
+        {
+            auto param = ::sched_param{};
+            param.sched_priority = scheduling.fifo_priority;
+            if (auto const result = ::pthread_setschedparam(native_handle, SCHED_FIFO, &param); result != 0 && !ec)
+            {
+                ec = error_code{result, asio::error::get_system_category()};
+            }
+        }
+#else
+        static_cast<void>(thread);
+        ec = make_error_code(usb_errc::not_supported);
+#endif
+    }
+}  // namespace usb_asio
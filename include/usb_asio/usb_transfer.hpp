@@ -8,12 +8,17 @@
 #include <ranges>
 #include <span>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 #include <libusb.h>
 #include "usb_asio/asio.hpp"
 #include "usb_asio/error.hpp"
+#include "usb_asio/completion_handler.hpp"
+#include "usb_asio/handler_memory.hpp"
+#include "usb_asio/usb_capture.hpp"
 #include "usb_asio/usb_device.hpp"
+#include "usb_asio/usb_transfer_metrics.hpp"
 
 namespace usb_asio
 {
@@ -26,18 +31,20 @@ namespace usb_asio
         usb_control_transfer_buffer(
             std::size_t const size,
             std::pmr::memory_resource* const mem_resource)
-          : data_(((size - 1u) / 2u) + 1u + LIBUSB_CONTROL_SETUP_SIZE, mem_resource) { }
+          // Counted in 16-bit words, the setup packet included.
+          : data_((size + 1u) / 2u + LIBUSB_CONTROL_SETUP_SIZE / 2u, mem_resource)
+          , size_{size} { }
 
         [[nodiscard]] auto payload() noexcept -> std::span<std::byte>
         {
             return std::as_writable_bytes(std::span{data_})
-                .subspan(LIBUSB_CONTROL_SETUP_SIZE);
+                .subspan(LIBUSB_CONTROL_SETUP_SIZE, size_);
         }
 
         [[nodiscard]] auto payload() const noexcept -> std::span<std::byte const>
         {
             return std::as_bytes(std::span{data_})
-                .subspan(LIBUSB_CONTROL_SETUP_SIZE);
+                .subspan(LIBUSB_CONTROL_SETUP_SIZE, size_);
         }
 
         [[nodiscard]] auto data() noexcept -> std::byte*
@@ -57,6 +64,7 @@ namespace usb_asio
 
       private:
         std::pmr::vector<std::uint16_t> data_;
+        std::size_t size_;
     };
 
     inline constexpr auto usb_no_timeout = std::chrono::milliseconds{0};
@@ -67,6 +75,16 @@ namespace usb_asio
         error_code ec;
     };
 
+    // Notified of the completion of transfers submitted together, see async_submit_batch.
+    class usb_transfer_batch_completion
+    {
+      public:
+        virtual void transfer_completed(error_code const& ec) noexcept = 0;
+
+      protected:
+        ~usb_transfer_batch_completion() noexcept = default;
+    };
+
     template <
         usb_transfer_type transfer_type,
         usb_transfer_direction transfer_direction>
@@ -123,6 +141,7 @@ namespace usb_asio
                 &completion_callback,
                 completion_context_.get(),
                 static_cast<unsigned>(timeout.count()));
+            attach_probes(device);
         }
 
         // clang-format off
@@ -173,6 +192,7 @@ namespace usb_asio
                 &completion_callback,
                 completion_context_.get(),
                 static_cast<unsigned>(timeout.count()));
+            attach_probes(device);
         }
 
         // clang-format off
@@ -264,6 +284,7 @@ namespace usb_asio
                 &completion_callback,
                 completion_context_.get(),
                 static_cast<unsigned>(timeout.count()));
+            attach_probes(device);
         }
 
         // clang-format off
@@ -307,6 +328,7 @@ namespace usb_asio
                 &completion_callback,
                 completion_context_.get(),
                 static_cast<unsigned>(timeout.count()));
+            attach_probes(device);
         }
 
         // clang-format off
@@ -352,6 +374,7 @@ namespace usb_asio
                 &completion_callback,
                 completion_context_.get(),
                 static_cast<unsigned>(timeout.count()));
+            attach_probes(device);
         }
 
         // clang-format off
@@ -378,6 +401,74 @@ namespace usb_asio
             return handle_.get();
         }
 
+        [[nodiscard]] auto get_executor() const noexcept -> executor_type
+        {
+            return executor_;
+        }
+
+        [[nodiscard]] auto completion_policy() const noexcept -> usb_completion_policy
+        {
+            return completion_context_->policy;
+        }
+
+        // Applies to the operations started afterwards.
+        void set_completion_policy(usb_completion_policy const policy) noexcept
+        {
+            completion_context_->policy = policy;
+        }
+
+        // Error of the last completed submission.
+        [[nodiscard]] auto last_error() const noexcept -> error_code
+        {
+            return completion_context_->last_ec;
+        }
+
+        // Result of the last completed submission, the same as passed to its completion handler.
+        [[nodiscard]] auto last_result() const noexcept -> result_type
+        {
+            return completion_context_->last_result;
+        }
+
+        // clang-format off
+        void set_buffer(asio::mutable_buffer const buffer) noexcept
+        requires (transfer_direction == usb_transfer_direction::in)
+            && (transfer_type != usb_transfer_type::control)
+        // clang-format on
+        {
+            handle()->buffer = static_cast<unsigned char*>(buffer.data());
+            handle()->length = static_cast<int>(buffer.size());
+        }
+
+        // clang-format off
+        void set_buffer(asio::const_buffer const buffer) noexcept
+        requires (transfer_direction == usb_transfer_direction::out)
+            && (transfer_type != usb_transfer_type::control)
+        // clang-format on
+        {
+            handle()->buffer = static_cast<unsigned char*>(const_cast<void*>(buffer.data()));
+            handle()->length = static_cast<int>(buffer.size());
+        }
+
+        // Submits the transfer with its current buffer, notifying the batch instead
+        // of a completion handler. Used by async_submit_batch.
+        void submit(usb_transfer_batch_completion& batch, error_code& ec) noexcept
+        {
+            completion_context_->batch = &batch;
+
+            completion_context_->probe.submitting();
+            completion_context_->capture.submitting(handle());
+            libusb_try(ec, &::libusb_submit_transfer, handle());
+            completion_context_->probe.submitted(ec);
+            completion_context_->capture.submitted(handle(), ec);
+
+            if (ec)
+            {
+                completion_context_->batch = nullptr;
+                completion_context_->last_ec = ec;
+                completion_context_->last_result = result_type{};
+            }
+        }
+
         void cancel()
         {
             try_with_ec([&](auto& ec) {
@@ -397,8 +488,7 @@ namespace usb_asio
             && (transfer_type != usb_transfer_type::control)
         // clang-format on
         {
-            handle()->buffer = static_cast<unsigned char*>(buffer.data());
-            handle()->length = static_cast<int>(buffer.size());
+            set_buffer(buffer);
 
             return async_submit_impl(std::forward<CompletionToken>(token));
         }
@@ -410,8 +500,7 @@ namespace usb_asio
             && (transfer_type != usb_transfer_type::control)
         // clang-format on
         {
-            handle()->buffer = static_cast<unsigned char*>(const_cast<void*>(buffer.data()));
-            handle()->length = static_cast<int>(buffer.size());
+            set_buffer(buffer);
 
             return async_submit_impl(std::forward<CompletionToken>(token));
         }
@@ -429,7 +518,8 @@ namespace usb_asio
         requires (transfer_type == usb_transfer_type::control)
         // clang-format on
         {
-            handle()->buffer = reinterpret_cast<unsigned char*>(buffer.data());
+            // libusb expects the setup packet in front of the payload.
+            handle()->buffer = reinterpret_cast<unsigned char*>(buffer.data() - LIBUSB_CONTROL_SETUP_SIZE);
             handle()->length = static_cast<int>(buffer.size() + LIBUSB_CONTROL_SETUP_SIZE);
 
             ::libusb_fill_control_setup(
@@ -447,79 +537,19 @@ namespace usb_asio
         }
 
       private:
-        class completion_handler_t
-        {
-          public:
-            completion_handler_t() = default;
-
-            template <
-                std::invocable<error_code, result_type> T>
-            completion_handler_t(Executor const& executor, T&& handler)
-            {
-                auto const trackedEx = asio::prefer(executor, asio::execution::outstanding_work.tracked);
-                auto const trackedCompletionEx = asio::prefer(
-                    asio::get_associated_executor(handler, executor),
-                    asio::execution::outstanding_work.tracked);
-
-                impl_ = std::make_unique<handler_impl<
-                    T,
-                    std::decay_t<decltype(trackedEx)>,
-                    std::decay_t<decltype(trackedCompletionEx)>>>(
-                    trackedEx,
-                    trackedCompletionEx,
-                    std::move(handler));
-            }
-
-            void operator()(error_code const ec, result_type result)
-            {
-                (*impl_)(ec, std::move(result));
-            }
-
-            void reset() noexcept
-            {
-                impl_.reset();
-            }
-
-          private:
-            struct erased_handler
-            {
-                virtual ~erased_handler() noexcept = default;
-
-                virtual void operator()(error_code ec, result_type&& result) = 0;
-            };
-
-            template <std::invocable<error_code, result_type> T,
-                      typename TrackedExecutor,
-                      typename TrackedCompletionExecutor>
-            struct handler_impl final : erased_handler
-            {
-                TrackedExecutor executor;
-                TrackedCompletionExecutor completion_executor;
-                T handler;
-
-                handler_impl(
-                    TrackedExecutor const& executor,
-                    TrackedCompletionExecutor const& completion_executor,
-                    T&& handler)
-                  : executor{executor}
-                  , completion_executor{completion_executor}
-                  , handler{std::move(handler)} { }
-
-                void operator()(error_code const ec, result_type&& result) override
-                {
-                    asio::post(
-                        completion_executor,
-                        std::bind_front(std::move(handler), ec, std::move(result)));
-                }
-            };
-
-            std::unique_ptr<erased_handler> impl_;
-        };
+        using completion_handler_t = completion_handler<Executor, completion_handler_sig>;
 
         struct completion_context
         {
             [[no_unique_address]] typename traits_type::result_storage_type result_storage = {};
+            handler_memory memory = {};
             completion_handler_t handler = {};
+            usb_completion_policy policy = usb_completion_policy::post;
+            usb_transfer_batch_completion* batch = nullptr;
+            error_code last_ec = {};
+            result_type last_result = {};
+            [[no_unique_address]] detail::transfer_probe probe = {};
+            detail::capture_tap capture = {};
         };
 
         unique_handle_type handle_;
@@ -528,6 +558,8 @@ namespace usb_asio
 
         static void completion_callback(handle_type const handle) noexcept
         {
+            detail::count_handled_event();
+
             auto const ec = error_code{
                 static_cast<usb_transfer_errc>(handle->status),
             };
@@ -556,8 +588,19 @@ namespace usb_asio
                 }
             }();
 
+            context.last_ec = ec;
+            context.last_result = result;
+            auto const timer = context.probe.completed(handle);
+            context.capture.completed(handle);
+
+            if (auto* const batch = std::exchange(context.batch, nullptr))
+            {
+                batch->transfer_completed(ec);
+                return;
+            }
+
+            context.handler.time_handler(timer);
             context.handler(ec, result);
-            context.handler.reset();
         }
 
         template <typename CompletionToken>
@@ -565,16 +608,38 @@ namespace usb_asio
         {
             return asio::async_initiate<CompletionToken, completion_handler_sig>(
                 [](auto completion_handler, auto const handle, auto* const context, auto const& executor) {
-                    context->handler = completion_handler_t{executor, std::move(completion_handler)};
+                    context->handler = completion_handler_t{
+                        executor,
+                        std::move(completion_handler),
+                        context->memory,
+                        context->policy,
+                    };
+
+#ifdef USB_ASIO_HAS_CANCELLATION_SLOT
+                    // A cancelled transfer still reports what was transferred before
+                    // the cancellation, which is at most a partial cancellation.
+                    context->handler.on_cancellation([handle](asio::cancellation_type const type) {
+                        if ((type & (asio::cancellation_type::terminal | asio::cancellation_type::partial))
+                            != asio::cancellation_type::none)
+                        {
+                            ::libusb_cancel_transfer(handle);
+                        }
+                    });
+#endif
 
                     auto ec = error_code{};
+                    context->probe.submitting();
+                    context->capture.submitting(handle);
                     libusb_try(ec, &::libusb_submit_transfer, handle);
+                    context->probe.submitted(ec);
+                    context->capture.submitted(handle, ec);
 
                     if (ec)
                     {
                         // Error in submission
-                        context->handler(ec, result_type{});
-                        context->handler.reset();
+                        context->last_ec = ec;
+                        context->last_result = result_type{};
+                        context->handler.complete_immediately(ec, result_type{});
                     }
                 },
                 std::forward<CompletionToken>(token),
@@ -583,6 +648,19 @@ namespace usb_asio
                 executor_);
         }
 
+        template <typename OtherExecutor>
+        void attach_probes(basic_usb_device<OtherExecutor>& device)
+        {
+            if constexpr (usb_transfer_metrics_enabled)
+            {
+                completion_context_->probe = detail::transfer_probe{
+                    device.service().endpoint_metrics(device.handle(), handle()->endpoint),
+                };
+            }
+
+            completion_context_->capture = detail::capture_tap{device.service().capture(), device.handle()};
+        }
+
         void check_is_constructed() const
         {
             if (handle_ == nullptr)
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+#include "usb_asio/asio.hpp"
+#include "usb_asio/completion_handler.hpp"
+#include "usb_asio/error.hpp"
+#include "usb_asio/handler_memory.hpp"
+#include "usb_asio/usb_transfer.hpp"
+
+namespace usb_asio
+{
+    // Shared state of the transfers submitted by one async_submit_batch call.
+    // Deletes itself once the last transfer completed.
+    template <typename Executor>
+    class usb_transfer_batch_state final : public usb_transfer_batch_completion
+    {
+      public:
+        using completion_handler_sig = void(error_code, std::size_t);
+
+        template <typename Handler>
+        usb_transfer_batch_state(
+            Executor const& executor,
+            Handler&& handler,
+            usb_completion_policy const policy,
+            std::size_t const num_transfers)
+          : handler_{executor, std::forward<Handler>(handler), memory_, policy}
+          , num_transfers_{num_transfers}
+          // The initiation holds a reference until every transfer is submitted.
+          , remaining_{num_transfers + 1u}
+        {
+        }
+
+        void transfer_completed(error_code const& ec) noexcept override
+        {
+            if (ec)
+            {
+                auto const lock = std::scoped_lock{mutex_};
+                if (!ec_) { ec_ = ec; }
+                ++failed_;
+            }
+
+            release(false);
+        }
+
+        // Immediate releases happen from within the initiating function.
+        void release(bool const immediate) noexcept
+        {
+            if (remaining_.fetch_sub(1u, std::memory_order_acq_rel) != 1u)
+            {
+                return;
+            }
+
+            // The handler posts its completion through memory_, which outlives
+            // the state if needed.
+            if (immediate)
+            {
+                handler_.complete_immediately(ec_, num_transfers_ - failed_);
+            }
+            else
+            {
+                handler_(ec_, num_transfers_ - failed_);
+            }
+            delete this;
+        }
+
+      private:
+        handler_memory memory_;
+        completion_handler<Executor, completion_handler_sig> handler_;
+        std::size_t const num_transfers_;
+        std::atomic<std::size_t> remaining_;
+        std::mutex mutex_;
+        error_code ec_;
+        std::size_t failed_ = 0;
+    };
+
+    // Submits all the transfers at once, with their current buffers (see set_buffer),
+    // and completes once all of them did, with the first error and the number of
+    // transfers that succeeded. Results of individual transfers are available through
+    // their last_error and last_result.
+    // Completion handlers and their executors are shared by the whole batch,
+    // which makes priming a streaming endpoint with many transfers cheap.
+    // The I/O executor is the default executor of the handler, an empty batch
+    // completes right away through it. The completion policy is the one of the first transfer.
+    template <
+        typename Transfer,
+        typename CompletionToken = asio::default_completion_token_t<typename Transfer::executor_type>>
+    auto async_submit_batch(
+        typename Transfer::executor_type const& executor,
+        std::span<Transfer> const transfers,
+        CompletionToken&& token = {})
+    {
+        using executor_type = typename Transfer::executor_type;
+        using state_type = usb_transfer_batch_state<executor_type>;
+
+        return asio::async_initiate<CompletionToken, typename state_type::completion_handler_sig>(
+            [](auto completion_handler, executor_type const& executor, std::span<Transfer> const transfers) {
+                if (transfers.empty())
+                {
+                    auto const completion_executor = asio::get_associated_executor(completion_handler, executor);
+                    asio::post(
+                        completion_executor,
+                        std::bind_front(std::move(completion_handler), error_code{}, std::size_t{0}));
+                    return;
+                }
+
+                auto* const state = new state_type{
+                    executor,
+                    std::move(completion_handler),
+                    transfers.front().completion_policy(),
+                    transfers.size(),
+                };
+
+                for (auto& transfer : transfers)
+                {
+                    auto ec = error_code{};
+                    transfer.submit(*state, ec);
+                    if (ec)
+                    {
+                        state->transfer_completed(ec);
+                    }
+                }
+
+                state->release(true);
+            },
+            std::forward<CompletionToken>(token),
+            executor,
+            transfers);
+    }
+
+    // Same, on the executor of the first transfer.
+    // Throws std::invalid_argument if there are no transfers to take it from.
+    template <
+        typename Transfer,
+        typename CompletionToken = asio::default_completion_token_t<typename Transfer::executor_type>>
+    auto async_submit_batch(std::span<Transfer> const transfers, CompletionToken&& token = {})
+    {
+        if (transfers.empty())
+        {
+            throw std::invalid_argument{"An empty batch needs an executor to complete on"};
+        }
+
+        return async_submit_batch(
+            transfers.front().get_executor(),
+            transfers,
+            std::forward<CompletionToken>(token));
+    }
+}  // namespace usb_asio
@@ -0,0 +1,459 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <tuple>
+#include <vector>
+
+#include <libusb.h>
+#include "usb_asio/error.hpp"
+
+namespace usb_asio
+{
+    // Transfer metrics are only collected when compiled with USB_ASIO_ENABLE_TRANSFER_METRICS,
+    // the hooks on the transfer path compile to nothing otherwise.
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+    inline constexpr auto usb_transfer_metrics_enabled = true;
+#else
+    inline constexpr auto usb_transfer_metrics_enabled = false;
+#endif
+
+    // Log-linear histogram of latencies, in the manner of HdrHistogram: values are counted
+    // in buckets of 1/16th of each power of two of nanoseconds, within 6.25% of their value.
+    // Latencies over 2^41 ns (about 36 minutes) are counted in the last bucket.
+    class usb_latency_histogram
+    {
+      public:
+        static constexpr auto sub_bucket_bits = 4u;
+        static constexpr auto sub_bucket_count = std::size_t{1} << sub_bucket_bits;
+        static constexpr auto max_magnitude = 40u;
+        static constexpr auto bucket_count = (max_magnitude - sub_bucket_bits + 2u) * sub_bucket_count;
+
+        using counts_type = std::array<std::uint64_t, bucket_count>;
+
+        [[nodiscard]] static constexpr auto bucket_of(std::uint64_t const nanoseconds) noexcept -> std::size_t
+        {
+            if (nanoseconds < sub_bucket_count)
+            {
+                return static_cast<std::size_t>(nanoseconds);
+            }
+
+            auto const magnitude = static_cast<unsigned>(std::bit_width(nanoseconds)) - 1u;
+            if (magnitude > max_magnitude)
+            {
+                return bucket_count - 1u;
+            }
+
+            auto const sub_bucket = (nanoseconds >> (magnitude - sub_bucket_bits)) & (sub_bucket_count - 1u);
+            return (magnitude - sub_bucket_bits + 1u) * sub_bucket_count + static_cast<std::size_t>(sub_bucket);
+        }
+
+        // Smallest latency counted in the bucket.
+        [[nodiscard]] static constexpr auto bucket_lower_bound(std::size_t const bucket) noexcept -> std::uint64_t
+        {
+            if (bucket < sub_bucket_count)
+            {
+                return bucket;
+            }
+
+            auto const magnitude = static_cast<unsigned>(bucket / sub_bucket_count) + sub_bucket_bits - 1u;
+            auto const sub_bucket = bucket % sub_bucket_count;
+            return (sub_bucket_count + sub_bucket) << (magnitude - sub_bucket_bits);
+        }
+
+        // Largest latency counted in the bucket (but the last one, which has no bound).
+        [[nodiscard]] static constexpr auto bucket_upper_bound(std::size_t const bucket) noexcept -> std::uint64_t
+        {
+            return bucket + 1u < bucket_count ? bucket_lower_bound(bucket + 1u) - 1u : UINT64_MAX;
+        }
+
+        usb_latency_histogram() noexcept = default;
+
+        usb_latency_histogram(counts_type const& counts, std::uint64_t const sum, std::uint64_t const max) noexcept
+          : counts_{counts}
+          , sum_{sum}
+          , max_{max}
+        {
+            for (auto const count : counts_)
+            {
+                count_ += count;
+            }
+        }
+
+        [[nodiscard]] auto count() const noexcept -> std::uint64_t
+        {
+            return count_;
+        }
+
+        [[nodiscard]] auto counts() const noexcept -> std::span<std::uint64_t const, bucket_count>
+        {
+            return counts_;
+        }
+
+        [[nodiscard]] auto max() const noexcept -> std::chrono::nanoseconds
+        {
+            return std::chrono::nanoseconds{max_};
+        }
+
+        [[nodiscard]] auto mean() const noexcept -> std::chrono::nanoseconds
+        {
+            return std::chrono::nanoseconds{count_ != 0u ? sum_ / count_ : 0u};
+        }
+
+        // Latency that the given fraction (between 0 and 1) of the values are at most,
+        // rounded up to the bucket.
+        [[nodiscard]] auto percentile(double const fraction) const noexcept -> std::chrono::nanoseconds
+        {
+            if (count_ == 0u)
+            {
+                return {};
+            }
+
+            auto const rank = std::max(
+                static_cast<std::uint64_t>(std::clamp(fraction, 0.0, 1.0) * static_cast<double>(count_) + 0.5),
+                std::uint64_t{1});
+            auto seen = std::uint64_t{0};
+            for (auto bucket = std::size_t{0}; bucket < bucket_count; ++bucket)
+            {
+                seen += counts_[bucket];
+                if (seen >= rank)
+                {
+                    return std::chrono::nanoseconds{std::min(bucket_upper_bound(bucket), max_)};
+                }
+            }
+
+            return max();
+        }
+
+      private:
+        counts_type counts_ = {};
+        std::uint64_t count_ = 0;
+        std::uint64_t sum_ = 0;
+        std::uint64_t max_ = 0;
+    };
+
+    // Snapshot of the transfers of an endpoint of a device, see usb_service::transfer_metrics.
+    struct usb_endpoint_metrics
+    {
+        std::uint8_t bus_number = 0;
+        std::uint8_t device_address = 0;
+        // Endpoint address, 0 for control transfers.
+        std::uint8_t endpoint = 0;
+        std::uint64_t submitted = 0;
+        // Submissions that libusb refused.
+        std::uint64_t submit_failures = 0;
+        // Completions, whatever their status.
+        std::uint64_t completed = 0;
+        std::uint64_t bytes = 0;
+        // Completions with an error, indexed by usb_transfer_errc.
+        std::array<std::uint64_t, 8> error_counts = {};
+        // From the submission to libusb reporting the completion.
+        usb_latency_histogram submit_to_complete;
+        // From libusb reporting the completion to the completion handler running.
+        // Transfers submitted with async_submit_batch have no handler, and are not counted.
+        usb_latency_histogram complete_to_handler;
+
+        [[nodiscard]] auto errors(usb_transfer_errc const errc) const noexcept -> std::uint64_t
+        {
+            auto const index = static_cast<std::size_t>(errc);
+            return index < error_counts.size() ? error_counts[index] : 0u;
+        }
+    };
+
+    namespace detail
+    {
+        using metrics_clock = std::chrono::steady_clock;
+
+        class atomic_latency_histogram
+        {
+          public:
+            void record(metrics_clock::duration const latency) noexcept
+            {
+                auto const nanoseconds = static_cast<std::uint64_t>(std::max(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count(),
+                    std::chrono::nanoseconds::rep{0}));
+
+                counts_[usb_latency_histogram::bucket_of(nanoseconds)].fetch_add(1u, std::memory_order_relaxed);
+                sum_.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+                auto max = max_.load(std::memory_order_relaxed);
+                while (nanoseconds > max
+                       && !max_.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) { }
+            }
+
+            [[nodiscard]] auto snapshot() const noexcept -> usb_latency_histogram
+            {
+                auto counts = usb_latency_histogram::counts_type{};
+                for (auto bucket = std::size_t{0}; bucket < counts.size(); ++bucket)
+                {
+                    counts[bucket] = counts_[bucket].load(std::memory_order_relaxed);
+                }
+
+                return usb_latency_histogram{
+                    counts,
+                    sum_.load(std::memory_order_relaxed),
+                    max_.load(std::memory_order_relaxed),
+                };
+            }
+
+            void reset() noexcept
+            {
+                for (auto& count : counts_)
+                {
+                    count.store(0u, std::memory_order_relaxed);
+                }
+                sum_.store(0u, std::memory_order_relaxed);
+                max_.store(0u, std::memory_order_relaxed);
+            }
+
+          private:
+            std::array<std::atomic<std::uint64_t>, usb_latency_histogram::bucket_count> counts_ = {};
+            std::atomic<std::uint64_t> sum_ = 0;
+            std::atomic<std::uint64_t> max_ = 0;
+        };
+
+        // Live metrics of an endpoint, updated by the transfers on it.
+        class endpoint_metrics_recorder
+        {
+          public:
+            void record_submission(bool const failed) noexcept
+            {
+                (failed ? submit_failures_ : submitted_).fetch_add(1u, std::memory_order_relaxed);
+            }
+
+            void record_completion(
+                ::libusb_transfer_status const status,
+                std::size_t const bytes,
+                metrics_clock::duration const latency) noexcept
+            {
+                completed_.fetch_add(1u, std::memory_order_relaxed);
+                bytes_.fetch_add(bytes, std::memory_order_relaxed);
+                if (status != ::LIBUSB_TRANSFER_COMPLETED
+                    && static_cast<std::size_t>(status) < error_counts_.size())
+                {
+                    error_counts_[static_cast<std::size_t>(status)].fetch_add(1u, std::memory_order_relaxed);
+                }
+                submit_to_complete_.record(latency);
+            }
+
+            void record_handler(metrics_clock::duration const latency) noexcept
+            {
+                complete_to_handler_.record(latency);
+            }
+
+            [[nodiscard]] auto snapshot() const noexcept -> usb_endpoint_metrics
+            {
+                auto metrics = usb_endpoint_metrics{
+                    .submitted = submitted_.load(std::memory_order_relaxed),
+                    .submit_failures = submit_failures_.load(std::memory_order_relaxed),
+                    .completed = completed_.load(std::memory_order_relaxed),
+                    .bytes = bytes_.load(std::memory_order_relaxed),
+                    .submit_to_complete = submit_to_complete_.snapshot(),
+                    .complete_to_handler = complete_to_handler_.snapshot(),
+                };
+                for (auto i = std::size_t{0}; i < error_counts_.size(); ++i)
+                {
+                    metrics.error_counts[i] = error_counts_[i].load(std::memory_order_relaxed);
+                }
+
+                return metrics;
+            }
+
+            void reset() noexcept
+            {
+                for (auto* const counter : {&submitted_, &submit_failures_, &completed_, &bytes_})
+                {
+                    counter->store(0u, std::memory_order_relaxed);
+                }
+                for (auto& count : error_counts_)
+                {
+                    count.store(0u, std::memory_order_relaxed);
+                }
+                submit_to_complete_.reset();
+                complete_to_handler_.reset();
+            }
+
+          private:
+            std::atomic<std::uint64_t> submitted_ = 0;
+            std::atomic<std::uint64_t> submit_failures_ = 0;
+            std::atomic<std::uint64_t> completed_ = 0;
+            std::atomic<std::uint64_t> bytes_ = 0;
+            std::array<std::atomic<std::uint64_t>, std::tuple_size_v<decltype(usb_endpoint_metrics::error_counts)>>
+                error_counts_ = {};
+            atomic_latency_histogram submit_to_complete_;
+            atomic_latency_histogram complete_to_handler_;
+        };
+
+        // Metrics of every endpoint that had a transfer created for it, owned by the usb_service.
+        // Endpoints are never removed, so that transfers can keep a pointer to theirs.
+        class transfer_metrics_registry
+        {
+          public:
+            // Null if the device is not open.
+            [[nodiscard]] auto endpoint(::libusb_device_handle* const device_handle, std::uint8_t const endpoint)
+                -> endpoint_metrics_recorder*
+            {
+                if (device_handle == nullptr)
+                {
+                    return nullptr;
+                }
+
+                auto* const device = ::libusb_get_device(device_handle);
+                auto const key = endpoint_key{
+                    ::libusb_get_bus_number(device),
+                    ::libusb_get_device_address(device),
+                    endpoint,
+                };
+
+                auto const lock = std::scoped_lock{mutex_};
+                auto& recorder = endpoints_[key];
+                if (recorder == nullptr)
+                {
+                    recorder = std::make_unique<endpoint_metrics_recorder>();
+                }
+
+                return recorder.get();
+            }
+
+            [[nodiscard]] auto snapshot() const -> std::vector<usb_endpoint_metrics>
+            {
+                auto const lock = std::scoped_lock{mutex_};
+
+                auto metrics = std::vector<usb_endpoint_metrics>{};
+                metrics.reserve(endpoints_.size());
+                for (auto const& [key, recorder] : endpoints_)
+                {
+                    auto& endpoint_metrics = metrics.emplace_back(recorder->snapshot());
+                    std::tie(endpoint_metrics.bus_number, endpoint_metrics.device_address, endpoint_metrics.endpoint)
+                        = key;
+                }
+
+                return metrics;
+            }
+
+            void reset() noexcept
+            {
+                auto const lock = std::scoped_lock{mutex_};
+                for (auto const& [key, recorder] : endpoints_)
+                {
+                    recorder->reset();
+                }
+            }
+
+          private:
+            using endpoint_key = std::tuple<std::uint8_t, std::uint8_t, std::uint8_t>;
+
+            mutable std::mutex mutex_;
+            std::map<endpoint_key, std::unique_ptr<endpoint_metrics_recorder>> endpoints_;
+        };
+
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+        // Times the wait between the completion of a transfer and its handler running.
+        class handler_timer
+        {
+          public:
+            handler_timer() noexcept = default;
+
+            handler_timer(endpoint_metrics_recorder* const recorder, metrics_clock::time_point const completed_at) noexcept
+              : recorder_{recorder}
+              , completed_at_{completed_at}
+            {
+            }
+
+            void handler_invoked() const noexcept
+            {
+                if (recorder_ != nullptr)
+                {
+                    recorder_->record_handler(metrics_clock::now() - completed_at_);
+                }
+            }
+
+          private:
+            endpoint_metrics_recorder* recorder_ = nullptr;
+            metrics_clock::time_point completed_at_ = {};
+        };
+
+        // Follows the submissions of a transfer.
+        class transfer_probe
+        {
+          public:
+            transfer_probe() noexcept = default;
+
+            explicit transfer_probe(endpoint_metrics_recorder* const recorder) noexcept
+              : recorder_{recorder}
+            {
+            }
+
+            // Right before libusb_submit_transfer, which may complete the transfer before returning.
+            void submitting() noexcept
+            {
+                submitted_at_ = metrics_clock::now();
+            }
+
+            void submitted(error_code const& ec) noexcept
+            {
+                if (recorder_ != nullptr)
+                {
+                    recorder_->record_submission(static_cast<bool>(ec));
+                }
+            }
+
+            [[nodiscard]] auto completed(::libusb_transfer const* const transfer) noexcept -> handler_timer
+            {
+                if (recorder_ == nullptr)
+                {
+                    return {};
+                }
+
+                auto const now = metrics_clock::now();
+                auto bytes = static_cast<std::size_t>(std::max(transfer->actual_length, 0));
+                if (transfer->type == ::LIBUSB_TRANSFER_TYPE_ISOCHRONOUS)
+                {
+                    bytes = 0;
+                    for (auto i = 0; i < transfer->num_iso_packets; ++i)
+                    {
+                        bytes += transfer->iso_packet_desc[i].actual_length;
+                    }
+                }
+
+                recorder_->record_completion(transfer->status, bytes, now - submitted_at_);
+                return handler_timer{recorder_, now};
+            }
+
+          private:
+            endpoint_metrics_recorder* recorder_ = nullptr;
+            metrics_clock::time_point submitted_at_ = {};
+        };
+#else
+        class handler_timer
+        {
+        };
+
+        class transfer_probe
+        {
+          public:
+            transfer_probe() noexcept = default;
+
+            explicit transfer_probe(endpoint_metrics_recorder* /* recorder */) noexcept { }
+
+            void submitting() noexcept { }
+
+            void submitted(error_code const& /* ec */) noexcept { }
+
+            [[nodiscard]] auto completed(::libusb_transfer const* /* transfer */) noexcept -> handler_timer
+            {
+                return {};
+            }
+        };
+#endif
+    }  // namespace detail
+}  // namespace usb_asio
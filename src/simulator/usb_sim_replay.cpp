@@ -0,0 +1,418 @@
+#include "usb_asio/simulator/usb_sim_replay.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include <libusb.h>
+#include "usb_asio/usb_capture.hpp"
+
+namespace usb_asio::sim
+{
+    namespace
+    {
+        using usbmon_packet = usb_asio::detail::usbmon_packet;
+        using usbmon_iso_descriptor = usb_asio::detail::usbmon_iso_descriptor;
+        using usbmon_event = usb_asio::detail::usbmon_event;
+
+        constexpr auto pcap_magic_microseconds = std::uint32_t{0xa1b2c3d4};
+        constexpr auto pcap_magic_nanoseconds = std::uint32_t{0xa1b23c4d};
+        constexpr auto linktype_usb_linux = std::uint32_t{189};
+        constexpr auto linktype_usb_linux_mmapped = std::uint32_t{220};
+        // LINKTYPE_USB_LINUX records stop before the isochronous fields.
+        constexpr auto usb_linux_header_size = std::size_t{48};
+
+        // Statuses of usbmon records, Linux errnos.
+        constexpr auto status_no_entry = -2;
+        constexpr auto status_pipe = -32;
+        constexpr auto status_overflow = -75;
+        constexpr auto status_connection_reset = -104;
+        constexpr auto status_timed_out = -110;
+
+        // Transfers cancelled or timed out without their submission recorded are replayed
+        // as NAKing until the host gives up on them again.
+        constexpr auto unknown_nak_duration = std::chrono::hours{24};
+
+        struct pcap_file_header
+        {
+            std::uint32_t magic;
+            std::uint16_t version_major;
+            std::uint16_t version_minor;
+            std::int32_t this_zone;
+            std::uint32_t sigfigs;
+            std::uint32_t snap_length;
+            std::uint32_t linktype;
+        };
+
+        struct pcap_record_header
+        {
+            std::uint32_t ts_sec;
+            std::uint32_t ts_fraction;
+            std::uint32_t captured_length;
+            std::uint32_t length;
+        };
+
+        struct usbmon_record
+        {
+            std::chrono::nanoseconds timestamp;
+            usbmon_packet header;
+            std::vector<usbmon_iso_descriptor> descriptors;
+            // Points into the file.
+            std::span<std::byte const> data;
+        };
+
+        // Reads values off a byte buffer, throwing if it is too short.
+        class reader
+        {
+          public:
+            explicit reader(std::span<std::byte const> const bytes) noexcept
+              : bytes_{bytes}
+            {
+            }
+
+            [[nodiscard]] auto empty() const noexcept -> bool
+            {
+                return bytes_.empty();
+            }
+
+            [[nodiscard]] auto size() const noexcept -> std::size_t
+            {
+                return bytes_.size();
+            }
+
+            [[nodiscard]] auto take(std::size_t const size) -> std::span<std::byte const>
+            {
+                if (size > bytes_.size())
+                {
+                    throw std::runtime_error{"truncated usbmon capture"};
+                }
+
+                auto const taken = bytes_.first(size);
+                bytes_ = bytes_.subspan(size);
+                return taken;
+            }
+
+            template <typename T>
+            [[nodiscard]] auto read(std::size_t const size = sizeof(T)) -> T
+            {
+                auto value = T{};
+                std::memcpy(&value, take(size).data(), size);
+                return value;
+            }
+
+          private:
+            std::span<std::byte const> bytes_;
+        };
+
+        [[nodiscard]] auto read_file(std::filesystem::path const& path) -> std::vector<std::byte>
+        {
+            auto file = std::ifstream{path, std::ios::binary};
+            if (!file)
+            {
+                throw std::runtime_error{"cannot open " + path.string()};
+            }
+
+            auto bytes = std::vector<std::byte>{};
+            std::transform(
+                std::istreambuf_iterator<char>{file},
+                std::istreambuf_iterator<char>{},
+                std::back_inserter(bytes),
+                [](char const c) { return static_cast<std::byte>(c); });
+            return bytes;
+        }
+
+        // Only reads captures in the byte order of this machine, which is what usbmon
+        // and usb_capture write.
+        [[nodiscard]] auto parse(std::span<std::byte const> const bytes) -> std::vector<usbmon_record>
+        {
+            auto file = reader{bytes};
+            auto const file_header = file.read<pcap_file_header>();
+            if (file_header.magic != pcap_magic_microseconds && file_header.magic != pcap_magic_nanoseconds)
+            {
+                throw std::runtime_error{"not a pcap file, or not in the byte order of this machine"};
+            }
+
+            if (file_header.linktype != linktype_usb_linux && file_header.linktype != linktype_usb_linux_mmapped)
+            {
+                throw std::runtime_error{"not a usbmon capture"};
+            }
+
+            auto const header_size = file_header.linktype == linktype_usb_linux ? usb_linux_header_size
+                                                                                : sizeof(usbmon_packet);
+            auto records = std::vector<usbmon_record>{};
+            while (!file.empty())
+            {
+                auto const record_header = file.read<pcap_record_header>();
+                auto record_bytes = reader{file.take(record_header.captured_length)};
+
+                auto record = usbmon_record{};
+                record.timestamp = std::chrono::seconds{record_header.ts_sec}
+                                   + (file_header.magic == pcap_magic_nanoseconds
+                                          ? std::chrono::nanoseconds{record_header.ts_fraction}
+                                          : std::chrono::microseconds{record_header.ts_fraction});
+                // Fields past the header size stay zero, without descriptors.
+                record.header = record_bytes.read<usbmon_packet>(header_size);
+
+                // Checked before allocating, a corrupt count could be anything.
+                if (record.header.num_descriptors > record_bytes.size() / sizeof(usbmon_iso_descriptor))
+                {
+                    throw std::runtime_error{"truncated usbmon capture"};
+                }
+                record.descriptors.resize(record.header.num_descriptors);
+                for (auto& descriptor : record.descriptors)
+                {
+                    descriptor = record_bytes.read<usbmon_iso_descriptor>();
+                }
+
+                record.data = record_bytes.take(std::min<std::size_t>(record.header.captured_length, record_bytes.size()));
+                records.push_back(std::move(record));
+            }
+
+            return records;
+        }
+
+        [[nodiscard]] auto transfer_type(std::uint8_t const usbmon_type) noexcept -> usb_transfer_type
+        {
+            switch (usbmon_type)
+            {
+            case 0:
+                return usb_transfer_type::isochronous;
+            case 1:
+                return usb_transfer_type::interrupt;
+            case 2:
+                return usb_transfer_type::control;
+            default:
+                return usb_transfer_type::bulk;
+            }
+        }
+
+        // Recorded bytes, zero-padded to the recorded length.
+        [[nodiscard]] auto payload(std::span<std::byte const> const data, std::size_t const offset, std::size_t const length)
+            -> std::vector<std::byte>
+        {
+            auto bytes = std::vector<std::byte>(length);
+            if (offset < data.size())
+            {
+                auto const available = data.subspan(offset, std::min(length, data.size() - offset));
+                std::ranges::copy(available, bytes.begin());
+            }
+
+            return bytes;
+        }
+
+        // The data a device sent or took for the completion, packet by packet for isochronous transfers.
+        void fill_data(usbmon_record const& completion, bool const in, usb_sim_response& response)
+        {
+            auto const& header = completion.header;
+            auto const num_packets = header.transfer_type == 0 && !completion.descriptors.empty()
+                                         ? static_cast<std::size_t>(std::max(header.s.iso.num_descriptors, 0))
+                                         : 0u;
+            if (num_packets == 0u)
+            {
+                response.data = in ? payload(completion.data, 0, header.length) : std::vector<std::byte>(header.length);
+                return;
+            }
+
+            // Packets past the recorded descriptors share what is left of the length.
+            auto recorded_length = std::size_t{0};
+            for (auto const& descriptor : completion.descriptors)
+            {
+                recorded_length += descriptor.length;
+            }
+            auto const num_unrecorded = num_packets - std::min(num_packets, completion.descriptors.size());
+            auto const unrecorded_length = header.length - std::min<std::size_t>(header.length, recorded_length);
+
+            for (auto i = std::size_t{0}; i < num_packets; ++i)
+            {
+                auto packet = std::vector<std::byte>{};
+                if (i < completion.descriptors.size())
+                {
+                    auto const& descriptor = completion.descriptors[i];
+                    packet = in ? payload(completion.data, descriptor.offset, descriptor.length)
+                                : std::vector<std::byte>(descriptor.length);
+                }
+                else
+                {
+                    auto const unrecorded = i - completion.descriptors.size();
+                    auto const length = unrecorded_length / num_unrecorded
+                                        + (unrecorded + 1u == num_unrecorded ? unrecorded_length % num_unrecorded : 0u);
+                    packet.resize(length);
+                }
+
+                response.packet_lengths.push_back(packet.size());
+                response.data.insert(response.data.end(), packet.begin(), packet.end());
+            }
+        }
+    }  // namespace
+
+    auto usb_sim_recording::load(
+        std::filesystem::path const& path,
+        std::uint8_t const bus_number,
+        std::uint8_t const device_address)
+        -> usb_sim_recording
+    {
+        auto const bytes = read_file(path);
+        auto const records = parse(bytes);
+
+        auto recording = usb_sim_recording{};
+        recording.bus_number_ = bus_number;
+        recording.device_address_ = device_address;
+        if (device_address == 0u)
+        {
+            auto const first = std::ranges::find_if(records, [](usbmon_record const& record) {
+                return (record.header.endpoint & 0x0fu) != 0u;
+            });
+            if (first == records.end())
+            {
+                throw std::runtime_error{"no device transfers in the capture"};
+            }
+
+            recording.bus_number_ = static_cast<std::uint8_t>(first->header.bus_number);
+            recording.device_address_ = first->header.device_address;
+        }
+
+        // Submissions are matched to their completion by id, which usbmon reuses once completed.
+        auto submissions = std::unordered_map<std::uint64_t, std::chrono::nanoseconds>{};
+        // Transfers queued on an endpoint only start being served once the previous one completed,
+        // as the simulator does.
+        auto last_completions = std::unordered_map<std::uint8_t, std::chrono::nanoseconds>{};
+        for (auto const& record : records)
+        {
+            auto const& header = record.header;
+            if (header.bus_number != recording.bus_number_ || header.device_address != recording.device_address_)
+            {
+                continue;
+            }
+
+            switch (static_cast<usbmon_event>(header.type))
+            {
+            case usbmon_event::submit:
+                submissions[header.id] = record.timestamp;
+                continue;
+            case usbmon_event::submit_error:
+                submissions.erase(header.id);
+                continue;
+            case usbmon_event::complete:
+                break;
+            default:
+                continue;
+            }
+
+            auto transfer = usb_sim_recorded_transfer{};
+            transfer.type = transfer_type(header.transfer_type);
+            transfer.endpoint = transfer.type == usb_transfer_type::control ? std::uint8_t{0} : header.endpoint;
+            auto const last_completion = last_completions.find(transfer.endpoint);
+            if (auto const submission = submissions.find(header.id); submission != submissions.end())
+            {
+                auto const start = last_completion != last_completions.end()
+                                       ? std::max(submission->second, last_completion->second)
+                                       : submission->second;
+                transfer.duration = std::max(record.timestamp - start, std::chrono::nanoseconds{0});
+                submissions.erase(submission);
+            }
+            last_completions.insert_or_assign(transfer.endpoint, record.timestamp);
+
+            auto& response = transfer.response;
+            auto const in = (header.endpoint & LIBUSB_ENDPOINT_IN) != 0u;
+            switch (header.status)
+            {
+            case 0:
+            case status_overflow:
+                response.type = usb_sim_response_type::data;
+                fill_data(record, in, response);
+                // Sent more than the transfer could take.
+                if (header.status == status_overflow && in)
+                {
+                    response.data.push_back(std::byte{0});
+                }
+                break;
+            case status_pipe:
+                response.type = usb_sim_response_type::stall;
+                break;
+            case status_no_entry:
+            case status_connection_reset:
+            case status_timed_out:
+                response.type = usb_sim_response_type::nak;
+                response.nak_duration = transfer.duration.value_or(unknown_nak_duration);
+                break;
+            default:
+                response.type = usb_sim_response_type::error;
+                break;
+            }
+
+            recording.transfers_.push_back(std::move(transfer));
+        }
+
+        return recording;
+    }
+
+    auto usb_sim_recording::device_config() const -> usb_sim_device_config
+    {
+        auto endpoints = std::map<std::uint8_t, usb_sim_endpoint>{};
+        for (auto const& transfer : transfers_)
+        {
+            if (transfer.endpoint == 0u)
+            {
+                continue;
+            }
+
+            auto const [iter, inserted] = endpoints.try_emplace(transfer.endpoint, usb_sim_endpoint{
+                .address = transfer.endpoint,
+                .type = transfer.type,
+            });
+            auto& endpoint = iter->second;
+            if (transfer.type == usb_transfer_type::isochronous)
+            {
+                // Large enough for every recorded packet.
+                if (inserted)
+                {
+                    endpoint.max_packet_size = 1;
+                }
+
+                for (auto const length : transfer.response.packet_lengths)
+                {
+                    endpoint.max_packet_size = std::max(
+                        endpoint.max_packet_size,
+                        static_cast<std::uint16_t>(std::min<std::size_t>(length, 0xffffu)));
+                }
+            }
+
+            if (transfer.type == usb_transfer_type::isochronous || transfer.type == usb_transfer_type::interrupt)
+            {
+                endpoint.interval = 1;
+            }
+        }
+
+        auto config = usb_sim_device_config{
+            .bus_number = bus_number_,
+            .interfaces = {{.number = 0}},
+        };
+        for (auto const& [address, endpoint] : endpoints)
+        {
+            config.interfaces.front().alt_settings.front().push_back(endpoint);
+        }
+
+        return config;
+    }
+
+    void usb_sim_recording::replay(usb_sim_device& device, usb_sim_replay_timing const timing) const
+    {
+        for (auto const& transfer : transfers_)
+        {
+            auto response = transfer.response;
+            if (response.type != usb_sim_response_type::nak)
+            {
+                response.duration = timing == usb_sim_replay_timing::original ? transfer.duration
+                                                                              : std::chrono::nanoseconds{0};
+            }
+
+            device.queue_response(transfer.endpoint, std::move(response));
+        }
+    }
+}  // namespace usb_asio::sim
@@ -0,0 +1,1727 @@
+#include "usb_asio/simulator/usb_simulator.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <libusb.h>
+
+// Implements the part of the libusb API that usb_asio uses, on top of simulated devices.
+//
+// Locking: the simulator's mutex guards the devices and their scripts, and the device objects
+// of every context. Each context has its own mutex for its pending transfers and events,
+// which is taken after the simulator's one. Hotplug callbacks run under the context's
+// hotplug mutex, which is taken before both. Submissions hold the serving mutex of their
+// endpoint, taken before the simulator's one, and release the latter while running sources and sinks.
+
+namespace usb_asio::sim::detail
+{
+    using clock = std::chrono::steady_clock;
+
+    struct sim_endpoint
+    {
+        usb_sim_endpoint config;
+        std::deque<usb_sim_response> responses;
+        usb_sim_in_source source;
+        usb_sim_out_sink sink;
+        clock::time_point busy_until = {};
+        // Held while a transfer is submitted, keeping the submissions in order while
+        // sources and sinks run without the simulator's mutex.
+        std::mutex serving_mutex;
+        std::atomic<std::size_t> completed = 0;
+    };
+
+    struct sim_device
+    {
+        usb_sim_device_config config;
+        std::uint8_t address = 0;
+        bool plugged = true;
+        int configuration = 0;
+        // By address, endpoint 0 standing for both control directions.
+        std::map<std::uint8_t, std::unique_ptr<sim_endpoint>> endpoints;
+        std::map<int, ::libusb_device_handle*> claimed_interfaces;
+        std::map<int, int> alt_settings;
+
+        ::libusb_device_descriptor device_descriptor = {};
+        // Indexed by interface, alt setting and endpoint.
+        std::vector<std::vector<std::vector<::libusb_endpoint_descriptor>>> endpoint_descriptors;
+        std::vector<std::vector<::libusb_interface_descriptor>> alt_setting_descriptors;
+        std::vector<::libusb_interface> interface_descriptors;
+        // SuperSpeed endpoint companion descriptors, as the extra bytes of the endpoint descriptors.
+        std::deque<std::array<unsigned char, 6>> companion_descriptors;
+        ::libusb_config_descriptor config_descriptor = {};
+
+        [[nodiscard]] auto endpoint(std::uint8_t const address) -> sim_endpoint*
+        {
+            auto const key = (address & 0x0fu) == 0u ? std::uint8_t{0} : address;
+            auto const iter = endpoints.find(key);
+            return iter != endpoints.end() ? iter->second.get() : nullptr;
+        }
+
+        [[nodiscard]] auto find_interface(int const number) const -> usb_sim_interface const*
+        {
+            auto const iter = std::ranges::find(config.interfaces, number, &usb_sim_interface::number);
+            return iter != config.interfaces.end() ? &*iter : nullptr;
+        }
+    };
+
+    struct simulator
+    {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<sim_device>> devices;
+        std::vector<::libusb_context*> contexts;
+        // The context that a null one stands for, shared by every libusb_init(nullptr).
+        ::libusb_context* default_context = nullptr;
+        int default_context_refs = 0;
+        std::uint8_t next_address = 1;
+
+        [[nodiscard]] static auto instance() -> simulator&
+        {
+            static auto instance = simulator{};
+            return instance;
+        }
+    };
+
+    struct pending_transfer
+    {
+        ::libusb_transfer* transfer = nullptr;
+        sim_device* device = nullptr;
+        sim_endpoint* endpoint = nullptr;
+        ::libusb_transfer_status status = ::LIBUSB_TRANSFER_COMPLETED;
+        int actual_length = 0;
+        bool cancelled = false;
+        // Response answering the transfer once the device stops NAKing, put back in front
+        // of the queue if the transfer is cancelled before then.
+        std::optional<usb_sim_response> after_naks = {};
+        clock::time_point naking_until = {};
+    };
+
+    // Completion time, then submission order.
+    using pending_key = std::pair<clock::time_point, std::uint64_t>;
+
+    struct hotplug_callback
+    {
+        ::libusb_hotplug_callback_handle handle;
+        int events;
+        int vendor_id;
+        int product_id;
+        int device_class;
+        ::libusb_hotplug_callback_fn callback;
+        void* user_data;
+    };
+
+    struct hotplug_event
+    {
+        ::libusb_device* device;
+        ::libusb_hotplug_event event;
+    };
+}  // namespace usb_asio::sim::detail
+
+namespace sim_detail = usb_asio::sim::detail;
+
+struct libusb_context
+{
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    // Recycles the nodes of the pending transfers, so that the simulator does not show up
+    // in the allocations of the code under test once it runs steadily.
+    std::pmr::unsynchronized_pool_resource pending_pool;
+    std::pmr::map<sim_detail::pending_key, sim_detail::pending_transfer> pending{&pending_pool};
+    std::pmr::unordered_map<::libusb_transfer*, sim_detail::pending_key> pending_keys{&pending_pool};
+    std::uint64_t next_sequence = 0;
+    std::vector<sim_detail::hotplug_event> hotplug_events;
+    bool interrupted = false;
+
+    // For event handling through poll (usb_event_reactor), written to only once asked for.
+    std::array<int, 2> wakeup_pipe = {-1, -1};
+    ::libusb_pollfd pollfd = {};
+    bool pollfd_requested = false;
+
+    // Guarded by the simulator's mutex.
+    std::map<sim_detail::sim_device*, ::libusb_device*> device_objects;
+
+    std::recursive_mutex hotplug_mutex;
+    std::vector<sim_detail::hotplug_callback> hotplug_callbacks;
+    ::libusb_hotplug_callback_handle next_hotplug_handle = 1;
+
+    // Expects mutex to be held.
+    void notify()
+    {
+        wakeup.notify_all();
+        if (pollfd_requested)
+        {
+            auto const byte = char{};
+            static_cast<void>(::write(wakeup_pipe[1], &byte, 1));
+        }
+    }
+
+    void drain_wakeup_pipe() const noexcept
+    {
+        auto bytes = std::array<char, 64>{};
+        while (::read(wakeup_pipe[0], bytes.data(), bytes.size()) > 0) { }
+    }
+};
+
+struct libusb_device
+{
+    ::libusb_context* context;
+    std::shared_ptr<sim_detail::sim_device> device;
+    // Guarded by the simulator's mutex.
+    int refs = 1;
+};
+
+struct libusb_device_handle
+{
+    ::libusb_device* device;
+};
+
+namespace usb_asio::sim::detail
+{
+    namespace
+    {
+        auto is_in(::libusb_transfer const* const transfer) -> bool
+        {
+            if (transfer->type == ::LIBUSB_TRANSFER_TYPE_CONTROL)
+            {
+                return (transfer->buffer[0] & LIBUSB_ENDPOINT_DIR_MASK) == ::LIBUSB_ENDPOINT_IN;
+            }
+
+            return (transfer->endpoint & LIBUSB_ENDPOINT_DIR_MASK) == ::LIBUSB_ENDPOINT_IN;
+        }
+
+        // Resolves a null context to the default one, like libusb does. Expects the
+        // simulator's mutex not to be held.
+        [[nodiscard]] auto resolve_context(::libusb_context* const context) -> ::libusb_context*
+        {
+            if (context != nullptr)
+            {
+                return context;
+            }
+
+            auto& sim = simulator::instance();
+            auto const lock = std::scoped_lock{sim.mutex};
+            return sim.default_context;
+        }
+
+        // Expects the simulator's mutex to be held.
+        auto device_object(::libusb_context* const context, std::shared_ptr<sim_device> const& device)
+            -> ::libusb_device*
+        {
+            auto& object = context->device_objects[device.get()];
+            if (object != nullptr)
+            {
+                ++object->refs;
+                return object;
+            }
+
+            object = new ::libusb_device{context, device};
+            return object;
+        }
+
+        // Expects the simulator's mutex to be held.
+        void unref_device_object(::libusb_device* const object) noexcept
+        {
+            if (--object->refs > 0)
+            {
+                return;
+            }
+
+            if (object->context != nullptr)
+            {
+                object->context->device_objects.erase(object->device.get());
+            }
+
+            delete object;
+        }
+
+        [[nodiscard]] auto matches(hotplug_callback const& callback, sim_device const& device, int const event) -> bool
+        {
+            return (callback.events & event) != 0
+                   && (callback.vendor_id == LIBUSB_HOTPLUG_MATCH_ANY || callback.vendor_id == device.config.vendor_id)
+                   && (callback.product_id == LIBUSB_HOTPLUG_MATCH_ANY || callback.product_id == device.config.product_id)
+                   && (callback.device_class == LIBUSB_HOTPLUG_MATCH_ANY || callback.device_class == device.config.device_class);
+        }
+
+        // Expects the simulator's mutex to be held. Arrivals and departures are reported
+        // by the event handling, like libusb does.
+        void queue_hotplug_event(std::shared_ptr<sim_device> const& device, ::libusb_hotplug_event const event)
+        {
+            for (auto* const context : simulator::instance().contexts)
+            {
+                auto const lock = std::scoped_lock{context->mutex};
+                context->hotplug_events.push_back(hotplug_event{device_object(context, device), event});
+                context->notify();
+            }
+        }
+
+        void build_descriptors(sim_device& device)
+        {
+            auto const& config = device.config;
+            auto const super_speed = config.speed >= usb_speed::super;
+
+            device.device_descriptor = ::libusb_device_descriptor{
+                .bLength = 18,
+                .bDescriptorType = 0x01,
+                .bcdUSB = static_cast<std::uint16_t>(super_speed ? 0x0300 : 0x0200),
+                .bDeviceClass = config.device_class,
+                .bDeviceSubClass = 0,
+                .bDeviceProtocol = 0,
+                .bMaxPacketSize0 = static_cast<std::uint8_t>(super_speed ? 9 : 64),
+                .idVendor = config.vendor_id,
+                .idProduct = config.product_id,
+                .bcdDevice = 0x0100,
+                .iManufacturer = 0,
+                .iProduct = 0,
+                .iSerialNumber = 0,
+                .bNumConfigurations = 1,
+            };
+
+            auto control = std::make_unique<sim_endpoint>();
+            control->config = usb_sim_endpoint{
+                .address = 0,
+                .type = usb_transfer_type::control,
+                .max_packet_size = static_cast<std::uint16_t>(super_speed ? 512 : 64),
+            };
+            device.endpoints.emplace(std::uint8_t{0}, std::move(control));
+
+            // Sized first, the descriptors point into each other.
+            device.endpoint_descriptors.resize(config.interfaces.size());
+            device.alt_setting_descriptors.resize(config.interfaces.size());
+            device.interface_descriptors.resize(config.interfaces.size());
+
+            for (auto i = std::size_t{0}; i < config.interfaces.size(); ++i)
+            {
+                auto const& interface = config.interfaces[i];
+                auto& endpoint_descriptors = device.endpoint_descriptors[i];
+                endpoint_descriptors.resize(interface.alt_settings.size());
+
+                for (auto a = std::size_t{0}; a < interface.alt_settings.size(); ++a)
+                {
+                    for (auto const& endpoint : interface.alt_settings[a])
+                    {
+                        auto descriptor = ::libusb_endpoint_descriptor{};
+                        descriptor.bLength = 7;
+                        descriptor.bDescriptorType = 0x05;
+                        descriptor.bEndpointAddress = endpoint.address;
+                        descriptor.bmAttributes = static_cast<std::uint8_t>(endpoint.type);
+                        descriptor.wMaxPacketSize = endpoint.max_packet_size;
+                        descriptor.bInterval = endpoint.interval;
+
+                        if (super_speed)
+                        {
+                            auto const bytes_per_interval = endpoint.max_packet_size * endpoint.max_burst;
+                            auto& companion = device.companion_descriptors.emplace_back(std::array<unsigned char, 6>{
+                                6,
+                                0x30,
+                                static_cast<unsigned char>(std::max(endpoint.max_burst, std::uint8_t{1}) - 1),
+                                0,
+                                static_cast<unsigned char>(bytes_per_interval & 0xff),
+                                static_cast<unsigned char>((bytes_per_interval >> 8) & 0xff),
+                            });
+                            descriptor.extra = companion.data();
+                            descriptor.extra_length = static_cast<int>(companion.size());
+                        }
+
+                        endpoint_descriptors[a].push_back(descriptor);
+
+                        auto& state = device.endpoints[endpoint.address];
+                        if (state == nullptr)
+                        {
+                            state = std::make_unique<sim_endpoint>();
+                            state->config = endpoint;
+                        }
+                    }
+                }
+
+                auto& alt_setting_descriptors = device.alt_setting_descriptors[i];
+                for (auto a = std::size_t{0}; a < interface.alt_settings.size(); ++a)
+                {
+                    auto descriptor = ::libusb_interface_descriptor{};
+                    descriptor.bLength = 9;
+                    descriptor.bDescriptorType = 0x04;
+                    descriptor.bInterfaceNumber = interface.number;
+                    descriptor.bAlternateSetting = static_cast<std::uint8_t>(a);
+                    descriptor.bNumEndpoints = static_cast<std::uint8_t>(endpoint_descriptors[a].size());
+                    descriptor.bInterfaceClass = interface.interface_class;
+                    descriptor.endpoint = endpoint_descriptors[a].data();
+                    alt_setting_descriptors.push_back(descriptor);
+                }
+
+                device.interface_descriptors[i].altsetting = alt_setting_descriptors.data();
+                device.interface_descriptors[i].num_altsetting = static_cast<int>(alt_setting_descriptors.size());
+            }
+
+            device.config_descriptor.bLength = 9;
+            device.config_descriptor.bDescriptorType = 0x02;
+            device.config_descriptor.bNumInterfaces = static_cast<std::uint8_t>(config.interfaces.size());
+            device.config_descriptor.bConfigurationValue = config.configuration_value;
+            device.config_descriptor.bmAttributes = 0x80;
+            device.config_descriptor.MaxPower = 50;
+            device.config_descriptor.interface = device.interface_descriptors.data();
+            device.configuration = config.configuration_value;
+        }
+
+        // What a transfer does, decided when it is submitted.
+        struct transfer_plan
+        {
+            clock::time_point now;
+            // Once the device stopped NAKing.
+            clock::time_point start;
+            std::optional<clock::time_point> deadline;
+            std::optional<usb_sim_response> response;
+            // Timed out while NAKing, before the data phase.
+            bool timed_out = false;
+            // Copies of the endpoint's, called without the simulator's mutex.
+            usb_sim_in_source source;
+            usb_sim_out_sink sink;
+        };
+
+        // Expects the simulator's mutex to be held. Takes the responses answering the transfer.
+        auto plan_transfer(sim_endpoint& endpoint, ::libusb_transfer* const transfer, pending_transfer& result)
+            -> transfer_plan
+        {
+            auto plan = transfer_plan{};
+            plan.now = clock::now();
+            plan.start = std::max(plan.now, endpoint.busy_until);
+            if (transfer->timeout != 0)
+            {
+                plan.deadline = plan.now + std::chrono::milliseconds{transfer->timeout};
+            }
+
+            // Responses following NAKs answer the host retrying a timed out or cancelled transfer,
+            // a transfer that does not outlast the NAKs leaves them queued.
+            auto naked = false;
+            while (!endpoint.responses.empty() && endpoint.responses.front().type == usb_sim_response_type::nak)
+            {
+                plan.start += endpoint.responses.front().nak_duration;
+                endpoint.responses.pop_front();
+                naked = true;
+
+                if (plan.deadline && plan.start >= *plan.deadline)
+                {
+                    plan.timed_out = true;
+                    return plan;
+                }
+            }
+
+            if (!endpoint.responses.empty())
+            {
+                plan.response = std::move(endpoint.responses.front());
+                endpoint.responses.pop_front();
+
+                if (naked)
+                {
+                    result.after_naks = plan.response;
+                    result.naking_until = plan.start;
+                }
+            }
+
+            if (is_in(transfer))
+            {
+                plan.source = endpoint.source;
+            }
+            else
+            {
+                plan.sink = endpoint.sink;
+            }
+
+            return plan;
+        }
+
+        // Moves the data of a transfer, or of an isochronous packet, returns the number of bytes moved.
+        auto move_data(
+            transfer_plan const& plan,
+            usb_sim_response* const response,
+            std::span<std::byte> const buffer,
+            bool const in,
+            ::libusb_transfer_status& status)
+            -> std::size_t
+        {
+            if (response != nullptr)
+            {
+                auto const size = std::min(buffer.size(), response->data.size());
+                if (in)
+                {
+                    std::copy_n(response->data.begin(), size, buffer.begin());
+                    if (response->data.size() > buffer.size())
+                    {
+                        status = ::LIBUSB_TRANSFER_OVERFLOW;
+                    }
+                }
+                else if (plan.sink)
+                {
+                    plan.sink(buffer.first(size));
+                }
+
+                return size;
+            }
+
+            if (in)
+            {
+                if (plan.source)
+                {
+                    return std::min(plan.source(buffer), buffer.size());
+                }
+
+                std::ranges::fill(buffer, std::byte{0});
+                return buffer.size();
+            }
+
+            if (plan.sink)
+            {
+                plan.sink(buffer);
+            }
+
+            return buffer.size();
+        }
+
+        // Runs without the simulator's mutex, sources and sinks may script the device.
+        // Decides the outcome of the transfer, returns the number of bytes moved.
+        auto run_transfer(::libusb_transfer* const transfer, transfer_plan& plan, pending_transfer& result)
+            -> std::size_t
+        {
+            auto const in = is_in(transfer);
+            auto bytes = std::size_t{0};
+            auto& response = plan.response;
+            result.status = ::LIBUSB_TRANSFER_COMPLETED;
+
+            if (plan.timed_out)
+            {
+                result.status = ::LIBUSB_TRANSFER_TIMED_OUT;
+                for (auto i = 0; i < transfer->num_iso_packets; ++i)
+                {
+                    transfer->iso_packet_desc[i].actual_length = 0;
+                    transfer->iso_packet_desc[i].status = ::LIBUSB_TRANSFER_COMPLETED;
+                }
+            }
+            else if (response && response->type == usb_sim_response_type::stall)
+            {
+                result.status = ::LIBUSB_TRANSFER_STALL;
+            }
+            else if (response && response->type == usb_sim_response_type::error)
+            {
+                result.status = ::LIBUSB_TRANSFER_ERROR;
+            }
+            else if (transfer->type == ::LIBUSB_TRANSFER_TYPE_ISOCHRONOUS)
+            {
+                // Scripted data is spread over the packets.
+                auto offset = std::size_t{0};
+                auto data_offset = std::size_t{0};
+                for (auto i = 0; i < transfer->num_iso_packets; ++i)
+                {
+                    auto& packet = transfer->iso_packet_desc[i];
+                    auto const packet_buffer = std::span{
+                        reinterpret_cast<std::byte*>(transfer->buffer) + offset,
+                        packet.length,
+                    };
+                    offset += packet.length;
+
+                    auto packet_status = ::LIBUSB_TRANSFER_COMPLETED;
+                    auto moved = std::size_t{0};
+                    if (response)
+                    {
+                        auto packet_response = usb_sim_response{};
+                        auto size = std::min(packet_buffer.size(), response->data.size() - data_offset);
+                        if (!response->packet_lengths.empty())
+                        {
+                            auto const packet_index = static_cast<std::size_t>(i);
+                            size = std::min(
+                                size,
+                                packet_index < response->packet_lengths.size() ? response->packet_lengths[packet_index] : 0u);
+                        }
+                        packet_response.data.assign(
+                            response->data.begin() + static_cast<std::ptrdiff_t>(data_offset),
+                            response->data.begin() + static_cast<std::ptrdiff_t>(data_offset + size));
+                        data_offset += size;
+                        moved = move_data(plan, &packet_response, packet_buffer, in, packet_status);
+                    }
+                    else
+                    {
+                        moved = move_data(plan, nullptr, packet_buffer, in, packet_status);
+                    }
+
+                    packet.actual_length = static_cast<unsigned int>(moved);
+                    packet.status = packet_status;
+                    bytes += moved;
+                }
+            }
+            else
+            {
+                auto const setup_size = transfer->type == ::LIBUSB_TRANSFER_TYPE_CONTROL
+                                            ? std::min(static_cast<int>(LIBUSB_CONTROL_SETUP_SIZE), transfer->length)
+                                            : 0;
+                auto const buffer = std::span{
+                    reinterpret_cast<std::byte*>(transfer->buffer) + std::max(setup_size, 0),
+                    static_cast<std::size_t>(std::max(transfer->length - setup_size, 0)),
+                };
+                bytes = move_data(plan, response ? &*response : nullptr, buffer, in, result.status);
+
+                if (in
+                    && result.status == ::LIBUSB_TRANSFER_COMPLETED
+                    && bytes < buffer.size()
+                    && (transfer->flags & ::LIBUSB_TRANSFER_SHORT_NOT_OK) != 0)
+                {
+                    result.status = ::LIBUSB_TRANSFER_ERROR;
+                }
+            }
+
+            result.actual_length = static_cast<int>(bytes);
+            return bytes;
+        }
+
+        // Expects the simulator's mutex to be held. Decides when the transfer completes.
+        auto schedule_transfer(
+            sim_endpoint& endpoint,
+            transfer_plan const& plan,
+            std::size_t const bytes,
+            pending_transfer& result)
+            -> clock::time_point
+        {
+            if (plan.timed_out)
+            {
+                endpoint.busy_until = *plan.deadline;
+                return *plan.deadline;
+            }
+
+            auto const& response = plan.response;
+            auto duration = std::chrono::duration_cast<clock::duration>(endpoint.config.latency);
+            if (response && response->duration)
+            {
+                duration = std::chrono::duration_cast<clock::duration>(*response->duration);
+            }
+            else if (endpoint.config.bytes_per_second != 0)
+            {
+                duration += std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds{
+                    static_cast<std::int64_t>(bytes * 1'000'000'000ull / endpoint.config.bytes_per_second),
+                });
+            }
+
+            auto completion = plan.start + duration;
+            if (plan.deadline && completion > *plan.deadline)
+            {
+                completion = *plan.deadline;
+                result.status = ::LIBUSB_TRANSFER_TIMED_OUT;
+                result.actual_length = 0;
+
+                if (result.after_naks)
+                {
+                    endpoint.responses.push_front(*std::exchange(result.after_naks, std::nullopt));
+                }
+            }
+
+            endpoint.busy_until = completion;
+            return completion;
+        }
+
+        // Expects the context's mutex to be held.
+        void reschedule(::libusb_context* const context, pending_key const key, ::libusb_transfer_status const status)
+        {
+            auto node = context->pending.extract(key);
+            node.mapped().status = status;
+            node.mapped().actual_length = 0;
+            node.key() = pending_key{clock::now(), context->next_sequence++};
+            context->pending_keys[node.mapped().transfer] = node.key();
+            context->pending.insert(std::move(node));
+        }
+
+        void dispatch_hotplug_events(::libusb_context* const context, std::vector<hotplug_event>& events)
+        {
+            auto& simulator = simulator::instance();
+            auto const hotplug_lock = std::scoped_lock{context->hotplug_mutex};
+
+            for (auto const& event : events)
+            {
+                auto& callbacks = context->hotplug_callbacks;
+                for (auto iter = callbacks.begin(); iter != callbacks.end();)
+                {
+                    if (matches(*iter, *event.device->device, event.event)
+                        && iter->callback(context, event.device, event.event, iter->user_data) != 0)
+                    {
+                        iter = callbacks.erase(iter);
+                    }
+                    else
+                    {
+                        ++iter;
+                    }
+                }
+
+                auto const lock = std::scoped_lock{simulator.mutex};
+                unref_device_object(event.device);
+            }
+        }
+
+        void dispatch_transfer(pending_transfer const& pending)
+        {
+            auto* const transfer = pending.transfer;
+            transfer->status = pending.status;
+            transfer->actual_length = pending.actual_length;
+            if (pending.status != ::LIBUSB_TRANSFER_COMPLETED)
+            {
+                for (auto i = 0; i < transfer->num_iso_packets; ++i)
+                {
+                    transfer->iso_packet_desc[i].actual_length = 0;
+                    transfer->iso_packet_desc[i].status = pending.status;
+                }
+            }
+
+            pending.endpoint->completed.fetch_add(1u, std::memory_order_relaxed);
+
+            auto const flags = transfer->flags;
+            transfer->callback(transfer);
+
+            if ((flags & ::LIBUSB_TRANSFER_FREE_BUFFER) != 0)
+            {
+                std::free(transfer->buffer);
+            }
+
+            if ((flags & ::LIBUSB_TRANSFER_FREE_TRANSFER) != 0)
+            {
+                ::libusb_free_transfer(transfer);
+            }
+        }
+
+        auto handle_events(::libusb_context* context, clock::duration const timeout, int* const completed) -> int
+        {
+            context = resolve_context(context);
+            if (context == nullptr)
+            {
+                return ::LIBUSB_ERROR_INVALID_PARAM;
+            }
+
+            auto const deadline = clock::now() + timeout;
+            // Reused by the next calls on the thread, unless a callback handles events itself.
+            thread_local auto spare_transfers = std::vector<pending_transfer>{};
+            auto ready_transfers = std::vector<pending_transfer>{};
+            auto hotplug_events = std::vector<hotplug_event>{};
+
+            {
+                auto lock = std::unique_lock{context->mutex};
+                if (context->pollfd_requested)
+                {
+                    context->drain_wakeup_pipe();
+                }
+
+                while (true)
+                {
+                    if (context->interrupted)
+                    {
+                        context->interrupted = false;
+                        return 0;
+                    }
+
+                    auto const now = clock::now();
+                    if (!context->hotplug_events.empty()
+                        || (!context->pending.empty() && context->pending.begin()->first.first <= now))
+                    {
+                        break;
+                    }
+
+                    if ((completed != nullptr && *completed != 0) || now >= deadline)
+                    {
+                        return 0;
+                    }
+
+                    auto wakeup_time = deadline;
+                    if (!context->pending.empty())
+                    {
+                        wakeup_time = std::min(wakeup_time, context->pending.begin()->first.first);
+                    }
+
+                    context->wakeup.wait_until(lock, wakeup_time);
+                }
+
+                auto const now = clock::now();
+                ready_transfers = std::exchange(spare_transfers, {});
+                while (!context->pending.empty() && context->pending.begin()->first.first <= now)
+                {
+                    auto node = context->pending.extract(context->pending.begin());
+                    context->pending_keys.erase(node.mapped().transfer);
+                    ready_transfers.push_back(std::move(node.mapped()));
+                }
+
+                std::swap(hotplug_events, context->hotplug_events);
+            }
+
+            if (!hotplug_events.empty())
+            {
+                dispatch_hotplug_events(context, hotplug_events);
+            }
+
+            for (auto const& pending : ready_transfers)
+            {
+                dispatch_transfer(pending);
+            }
+
+            ready_transfers.clear();
+            spare_transfers = std::move(ready_transfers);
+
+            return 0;
+        }
+
+        auto to_duration(::timeval const* const tv) -> clock::duration
+        {
+            return std::chrono::duration_cast<clock::duration>(
+                std::chrono::seconds{tv->tv_sec} + std::chrono::microseconds{tv->tv_usec});
+        }
+    }  // namespace
+}  // namespace usb_asio::sim::detail
+
+namespace usb_asio::sim
+{
+    usb_sim_device::usb_sim_device(usb_sim_device_config config)
+      : state_{std::make_shared<detail::sim_device>()}
+    {
+        state_->config = std::move(config);
+        detail::build_descriptors(*state_);
+
+        auto& simulator = detail::simulator::instance();
+        auto const lock = std::scoped_lock{simulator.mutex};
+
+        state_->address = simulator.next_address;
+        simulator.next_address = static_cast<std::uint8_t>(simulator.next_address % 127u + 1u);
+        simulator.devices.push_back(state_);
+        detail::queue_hotplug_event(state_, ::LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED);
+    }
+
+    usb_sim_device::~usb_sim_device() noexcept
+    {
+        unplug();
+    }
+
+    void usb_sim_device::unplug() noexcept
+    {
+        if (state_ == nullptr)
+        {
+            return;
+        }
+
+        auto& simulator = detail::simulator::instance();
+        auto const lock = std::scoped_lock{simulator.mutex};
+        if (!state_->plugged)
+        {
+            return;
+        }
+
+        state_->plugged = false;
+        std::erase(simulator.devices, state_);
+
+        for (auto* const context : simulator.contexts)
+        {
+            auto const context_lock = std::scoped_lock{context->mutex};
+
+            auto keys = std::vector<detail::pending_key>{};
+            for (auto const& [key, pending] : context->pending)
+            {
+                if (pending.device == state_.get() && !pending.cancelled)
+                {
+                    keys.push_back(key);
+                }
+            }
+
+            for (auto const& key : keys)
+            {
+                detail::reschedule(context, key, ::LIBUSB_TRANSFER_NO_DEVICE);
+            }
+        }
+
+        try
+        {
+            detail::queue_hotplug_event(state_, ::LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT);
+        }
+        catch (...)
+        {
+            // Out of memory, the departure is not reported.
+        }
+    }
+
+    auto usb_sim_device::is_plugged() const noexcept -> bool
+    {
+        auto const lock = std::scoped_lock{detail::simulator::instance().mutex};
+        return state_ != nullptr && state_->plugged;
+    }
+
+    void usb_sim_device::queue_response(std::uint8_t const endpoint_address, usb_sim_response response)
+    {
+        auto const lock = std::scoped_lock{detail::simulator::instance().mutex};
+        if (auto* const endpoint = state_->endpoint(endpoint_address); endpoint != nullptr)
+        {
+            endpoint->responses.push_back(std::move(response));
+        }
+    }
+
+    void usb_sim_device::set_in_source(std::uint8_t const endpoint_address, usb_sim_in_source source)
+    {
+        auto const lock = std::scoped_lock{detail::simulator::instance().mutex};
+        if (auto* const endpoint = state_->endpoint(endpoint_address); endpoint != nullptr)
+        {
+            endpoint->source = std::move(source);
+        }
+    }
+
+    void usb_sim_device::set_out_sink(std::uint8_t const endpoint_address, usb_sim_out_sink sink)
+    {
+        auto const lock = std::scoped_lock{detail::simulator::instance().mutex};
+        if (auto* const endpoint = state_->endpoint(endpoint_address); endpoint != nullptr)
+        {
+            endpoint->sink = std::move(sink);
+        }
+    }
+
+    auto usb_sim_device::completed_transfers(std::uint8_t const endpoint_address) const -> std::size_t
+    {
+        auto* const endpoint = state_->endpoint(endpoint_address);
+        return endpoint != nullptr ? endpoint->completed.load(std::memory_order_relaxed) : 0u;
+    }
+
+    auto usb_sim_device::operator=(usb_sim_device&& other) noexcept -> usb_sim_device&
+    {
+        if (this != &other)
+        {
+            unplug();
+            state_ = std::move(other.state_);
+        }
+
+        return *this;
+    }
+}  // namespace usb_asio::sim
+
+using usb_asio::sim::detail::simulator;
+
+extern "C"
+{
+    int libusb_init(::libusb_context** const context)
+    {
+        auto& sim = simulator::instance();
+        if (context == nullptr)
+        {
+            {
+                auto const lock = std::scoped_lock{sim.mutex};
+                if (sim.default_context != nullptr)
+                {
+                    ++sim.default_context_refs;
+                    return ::LIBUSB_SUCCESS;
+                }
+            }
+
+            auto* default_context = static_cast<::libusb_context*>(nullptr);
+            if (auto const result = ::libusb_init(&default_context); result != ::LIBUSB_SUCCESS)
+            {
+                return result;
+            }
+
+            {
+                auto const lock = std::scoped_lock{sim.mutex};
+                ++sim.default_context_refs;
+                if (sim.default_context == nullptr)
+                {
+                    sim.default_context = default_context;
+                    return ::LIBUSB_SUCCESS;
+                }
+            }
+
+            // Lost the race against another libusb_init(nullptr).
+            ::libusb_exit(default_context);
+            return ::LIBUSB_SUCCESS;
+        }
+
+        auto* const new_context = new (std::nothrow) ::libusb_context{};
+        if (new_context == nullptr)
+        {
+            return ::LIBUSB_ERROR_NO_MEM;
+        }
+
+        if (::pipe(new_context->wakeup_pipe.data()) != 0)
+        {
+            delete new_context;
+            return ::LIBUSB_ERROR_OTHER;
+        }
+
+        for (auto const fd : new_context->wakeup_pipe)
+        {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+
+        new_context->pollfd = ::libusb_pollfd{new_context->wakeup_pipe[0], POLLIN};
+
+        auto const lock = std::scoped_lock{sim.mutex};
+        sim.contexts.push_back(new_context);
+        *context = new_context;
+
+        return ::LIBUSB_SUCCESS;
+    }
+
+    void libusb_exit(::libusb_context* context)
+    {
+        {
+            auto& sim = simulator::instance();
+            auto const lock = std::scoped_lock{sim.mutex};
+            if (context == nullptr)
+            {
+                if (sim.default_context == nullptr || --sim.default_context_refs > 0)
+                {
+                    return;
+                }
+
+                context = std::exchange(sim.default_context, nullptr);
+            }
+
+            std::erase(sim.contexts, context);
+
+            for (auto const& event : context->hotplug_events)
+            {
+                usb_asio::sim::detail::unref_device_object(event.device);
+            }
+
+            // Devices still referenced outlive the context, without it.
+            for (auto const& [device, object] : context->device_objects)
+            {
+                object->context = nullptr;
+            }
+        }
+
+        ::close(context->wakeup_pipe[0]);
+        ::close(context->wakeup_pipe[1]);
+        delete context;
+    }
+
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000108
+    char const* libusb_strerror(int const error_code)
+#else
+    char const* libusb_strerror(::libusb_error const error_code)
+#endif
+    {
+        switch (error_code)
+        {
+        case ::LIBUSB_SUCCESS: return "Success";
+        case ::LIBUSB_ERROR_IO: return "Input/Output Error";
+        case ::LIBUSB_ERROR_INVALID_PARAM: return "Invalid parameter";
+        case ::LIBUSB_ERROR_ACCESS: return "Access denied (insufficient permissions)";
+        case ::LIBUSB_ERROR_NO_DEVICE: return "No such device (it may have been disconnected)";
+        case ::LIBUSB_ERROR_NOT_FOUND: return "Entity not found";
+        case ::LIBUSB_ERROR_BUSY: return "Resource busy";
+        case ::LIBUSB_ERROR_TIMEOUT: return "Operation timed out";
+        case ::LIBUSB_ERROR_OVERFLOW: return "Overflow";
+        case ::LIBUSB_ERROR_PIPE: return "Pipe error";
+        case ::LIBUSB_ERROR_INTERRUPTED: return "System call interrupted (perhaps due to signal)";
+        case ::LIBUSB_ERROR_NO_MEM: return "Insufficient memory";
+        case ::LIBUSB_ERROR_NOT_SUPPORTED: return "Operation not supported or unimplemented on this platform";
+        default: return "Other error";
+        }
+    }
+
+    int libusb_has_capability(std::uint32_t const capability)
+    {
+        return capability == ::LIBUSB_CAP_HAS_CAPABILITY || capability == ::LIBUSB_CAP_HAS_HOTPLUG ? 1 : 0;
+    }
+
+    ssize_t libusb_get_device_list(::libusb_context* context, ::libusb_device*** const list)
+    {
+        context = usb_asio::sim::detail::resolve_context(context);
+        if (context == nullptr)
+        {
+            return ::LIBUSB_ERROR_INVALID_PARAM;
+        }
+
+        auto& sim = simulator::instance();
+        auto const lock = std::scoped_lock{sim.mutex};
+
+        auto* const devices = static_cast<::libusb_device**>(
+            std::calloc(sim.devices.size() + 1u, sizeof(::libusb_device*)));
+        if (devices == nullptr)
+        {
+            return ::LIBUSB_ERROR_NO_MEM;
+        }
+
+        for (auto i = std::size_t{0}; i < sim.devices.size(); ++i)
+        {
+            devices[i] = usb_asio::sim::detail::device_object(context, sim.devices[i]);
+        }
+
+        *list = devices;
+        return static_cast<ssize_t>(sim.devices.size());
+    }
+
+    void libusb_free_device_list(::libusb_device** const list, int const unref_devices)
+    {
+        if (list == nullptr)
+        {
+            return;
+        }
+
+        if (unref_devices != 0)
+        {
+            auto const lock = std::scoped_lock{simulator::instance().mutex};
+            for (auto* device = list; *device != nullptr; ++device)
+            {
+                usb_asio::sim::detail::unref_device_object(*device);
+            }
+        }
+
+        std::free(list);
+    }
+
+    ::libusb_device* libusb_ref_device(::libusb_device* const device)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        ++device->refs;
+        return device;
+    }
+
+    void libusb_unref_device(::libusb_device* const device)
+    {
+        if (device == nullptr)
+        {
+            return;
+        }
+
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        usb_asio::sim::detail::unref_device_object(device);
+    }
+
+    std::uint8_t libusb_get_bus_number(::libusb_device* const device)
+    {
+        return device->device->config.bus_number;
+    }
+
+    std::uint8_t libusb_get_port_number(::libusb_device* const device)
+    {
+        auto const& ports = device->device->config.port_numbers;
+        return ports.empty() ? std::uint8_t{0} : ports.back();
+    }
+
+    int libusb_get_port_numbers(::libusb_device* const device, std::uint8_t* const port_numbers, int const port_numbers_len)
+    {
+        auto const& ports = device->device->config.port_numbers;
+        if (static_cast<std::size_t>(std::max(port_numbers_len, 0)) < ports.size())
+        {
+            return ::LIBUSB_ERROR_OVERFLOW;
+        }
+
+        std::ranges::copy(ports, port_numbers);
+        return static_cast<int>(ports.size());
+    }
+
+    ::libusb_device* libusb_get_parent(::libusb_device* /* device */)
+    {
+        // Hubs are not simulated.
+        return nullptr;
+    }
+
+    std::uint8_t libusb_get_device_address(::libusb_device* const device)
+    {
+        return device->device->address;
+    }
+
+    int libusb_get_device_speed(::libusb_device* const device)
+    {
+        return static_cast<int>(device->device->config.speed);
+    }
+
+    int libusb_get_max_packet_size(::libusb_device* const device, unsigned char const endpoint)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        auto const* const state = device->device->endpoint(endpoint);
+        return state != nullptr ? static_cast<int>(state->config.max_packet_size & 0x7ffu) : ::LIBUSB_ERROR_NOT_FOUND;
+    }
+
+    // Like libusb, sized after the first alt setting having the endpoint.
+    int libusb_get_max_iso_packet_size(::libusb_device* const device, unsigned char const endpoint)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        auto const* const state = device->device->endpoint(endpoint);
+        if (state == nullptr)
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        auto const& config = state->config;
+        auto const high_bandwidth_multiplier = ((config.max_packet_size >> 11) & 0x3) + 1;
+        return static_cast<int>(config.max_packet_size & 0x7ffu) * high_bandwidth_multiplier
+               * std::max(static_cast<int>(config.max_burst), 1);
+    }
+
+    int libusb_get_device_descriptor(::libusb_device* const device, ::libusb_device_descriptor* const descriptor)
+    {
+        *descriptor = device->device->device_descriptor;
+        return ::LIBUSB_SUCCESS;
+    }
+
+    // The simulated descriptors live as long as their device, freeing them does nothing.
+    int libusb_get_active_config_descriptor(::libusb_device* const device, ::libusb_config_descriptor** const config)
+    {
+        *config = &device->device->config_descriptor;
+        return ::LIBUSB_SUCCESS;
+    }
+
+    int libusb_get_config_descriptor(::libusb_device* const device, std::uint8_t const index, ::libusb_config_descriptor** const config)
+    {
+        if (index != 0u)
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        *config = &device->device->config_descriptor;
+        return ::LIBUSB_SUCCESS;
+    }
+
+    int libusb_get_config_descriptor_by_value(::libusb_device* const device, std::uint8_t const value, ::libusb_config_descriptor** const config)
+    {
+        if (value != device->device->config.configuration_value)
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        *config = &device->device->config_descriptor;
+        return ::LIBUSB_SUCCESS;
+    }
+
+    void libusb_free_config_descriptor(::libusb_config_descriptor* /* config */) { }
+
+    int libusb_get_ss_endpoint_companion_descriptor(
+        ::libusb_context* /* context */,
+        ::libusb_endpoint_descriptor const* const endpoint,
+        ::libusb_ss_endpoint_companion_descriptor** const companion)
+    {
+        if (endpoint->extra == nullptr || endpoint->extra_length < 6 || endpoint->extra[1] != 0x30)
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        auto* const descriptor = new (std::nothrow) ::libusb_ss_endpoint_companion_descriptor{};
+        if (descriptor == nullptr)
+        {
+            return ::LIBUSB_ERROR_NO_MEM;
+        }
+
+        descriptor->bLength = endpoint->extra[0];
+        descriptor->bDescriptorType = endpoint->extra[1];
+        descriptor->bMaxBurst = endpoint->extra[2];
+        descriptor->bmAttributes = endpoint->extra[3];
+        descriptor->wBytesPerInterval = static_cast<std::uint16_t>(endpoint->extra[4] | (endpoint->extra[5] << 8));
+        *companion = descriptor;
+        return ::LIBUSB_SUCCESS;
+    }
+
+    void libusb_free_ss_endpoint_companion_descriptor(::libusb_ss_endpoint_companion_descriptor* const companion)
+    {
+        delete companion;
+    }
+
+    int libusb_open(::libusb_device* const device, ::libusb_device_handle** const handle)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        if (!device->device->plugged || device->context == nullptr)
+        {
+            return ::LIBUSB_ERROR_NO_DEVICE;
+        }
+
+        auto* const new_handle = new (std::nothrow) ::libusb_device_handle{device};
+        if (new_handle == nullptr)
+        {
+            return ::LIBUSB_ERROR_NO_MEM;
+        }
+
+        ++device->refs;
+        *handle = new_handle;
+        return ::LIBUSB_SUCCESS;
+    }
+
+    void libusb_close(::libusb_device_handle* const handle)
+    {
+        if (handle == nullptr)
+        {
+            return;
+        }
+
+        {
+            auto const lock = std::scoped_lock{simulator::instance().mutex};
+            std::erase_if(handle->device->device->claimed_interfaces, [&](auto const& claimed) {
+                return claimed.second == handle;
+            });
+            usb_asio::sim::detail::unref_device_object(handle->device);
+        }
+
+        delete handle;
+    }
+
+    ::libusb_device* libusb_get_device(::libusb_device_handle* const handle)
+    {
+        return handle->device;
+    }
+
+    int libusb_get_configuration(::libusb_device_handle* const handle, int* const configuration)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        auto const& device = *handle->device->device;
+        if (!device.plugged)
+        {
+            return ::LIBUSB_ERROR_NO_DEVICE;
+        }
+
+        *configuration = device.configuration;
+        return ::LIBUSB_SUCCESS;
+    }
+
+    int libusb_set_configuration(::libusb_device_handle* const handle, int const configuration)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        auto& device = *handle->device->device;
+        if (!device.plugged)
+        {
+            return ::LIBUSB_ERROR_NO_DEVICE;
+        }
+
+        if (configuration != -1 && configuration != device.config.configuration_value)
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        if (!device.claimed_interfaces.empty())
+        {
+            return ::LIBUSB_ERROR_BUSY;
+        }
+
+        device.configuration = configuration == -1 ? 0 : configuration;
+        device.alt_settings.clear();
+        return ::LIBUSB_SUCCESS;
+    }
+
+    int libusb_claim_interface(::libusb_device_handle* const handle, int const interface_number)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        auto& device = *handle->device->device;
+        if (!device.plugged)
+        {
+            return ::LIBUSB_ERROR_NO_DEVICE;
+        }
+
+        if (device.find_interface(interface_number) == nullptr)
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        auto const [iter, inserted] = device.claimed_interfaces.try_emplace(interface_number, handle);
+        return inserted || iter->second == handle ? ::LIBUSB_SUCCESS : ::LIBUSB_ERROR_BUSY;
+    }
+
+    int libusb_release_interface(::libusb_device_handle* const handle, int const interface_number)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        auto& device = *handle->device->device;
+        auto const iter = device.claimed_interfaces.find(interface_number);
+        if (iter == device.claimed_interfaces.end() || iter->second != handle)
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        device.claimed_interfaces.erase(iter);
+        device.alt_settings.erase(interface_number);
+        return device.plugged ? ::LIBUSB_SUCCESS : ::LIBUSB_ERROR_NO_DEVICE;
+    }
+
+    int libusb_set_interface_alt_setting(::libusb_device_handle* const handle, int const interface_number, int const alt_setting)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        auto& device = *handle->device->device;
+        if (!device.plugged)
+        {
+            return ::LIBUSB_ERROR_NO_DEVICE;
+        }
+
+        auto const claimed = device.claimed_interfaces.find(interface_number);
+        auto const* const interface = device.find_interface(interface_number);
+        if (claimed == device.claimed_interfaces.end()
+            || claimed->second != handle
+            || interface == nullptr
+            || alt_setting < 0
+            || static_cast<std::size_t>(alt_setting) >= interface->alt_settings.size())
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        device.alt_settings[interface_number] = alt_setting;
+        return ::LIBUSB_SUCCESS;
+    }
+
+    int libusb_clear_halt(::libusb_device_handle* const handle, unsigned char const endpoint)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        auto& device = *handle->device->device;
+        if (!device.plugged)
+        {
+            return ::LIBUSB_ERROR_NO_DEVICE;
+        }
+
+        return device.endpoint(endpoint) != nullptr ? ::LIBUSB_SUCCESS : ::LIBUSB_ERROR_NOT_FOUND;
+    }
+
+    int libusb_reset_device(::libusb_device_handle* const handle)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        return handle->device->device->plugged ? ::LIBUSB_SUCCESS : ::LIBUSB_ERROR_NOT_FOUND;
+    }
+
+    int libusb_alloc_streams(
+        ::libusb_device_handle* const handle,
+        std::uint32_t const num_streams,
+        unsigned char* /* endpoints */,
+        int /* num_endpoints */)
+    {
+        auto const lock = std::scoped_lock{simulator::instance().mutex};
+        if (!handle->device->device->plugged)
+        {
+            return ::LIBUSB_ERROR_NO_DEVICE;
+        }
+
+        return static_cast<int>(num_streams);
+    }
+
+    int libusb_free_streams(::libusb_device_handle* /* handle */, unsigned char* /* endpoints */, int /* num_endpoints */)
+    {
+        return ::LIBUSB_SUCCESS;
+    }
+
+    unsigned char* libusb_dev_mem_alloc(::libusb_device_handle* /* handle */, std::size_t const length)
+    {
+        // Page aligned, like the mappings of usbfs.
+        auto const page_size = std::size_t{4096};
+        return static_cast<unsigned char*>(std::aligned_alloc(page_size, (length + page_size - 1u) / page_size * page_size));
+    }
+
+    int libusb_dev_mem_free(::libusb_device_handle* /* handle */, unsigned char* const buffer, std::size_t /* length */)
+    {
+        std::free(buffer);
+        return ::LIBUSB_SUCCESS;
+    }
+
+    int libusb_kernel_driver_active(::libusb_device_handle* /* handle */, int /* interface_number */)
+    {
+        return 0;
+    }
+
+    int libusb_detach_kernel_driver(::libusb_device_handle* /* handle */, int /* interface_number */)
+    {
+        return ::LIBUSB_ERROR_NOT_FOUND;
+    }
+
+    int libusb_attach_kernel_driver(::libusb_device_handle* /* handle */, int /* interface_number */)
+    {
+        return ::LIBUSB_ERROR_NOT_FOUND;
+    }
+
+    ::libusb_transfer* libusb_alloc_transfer(int const iso_packets)
+    {
+        auto const size = sizeof(::libusb_transfer)
+                          + sizeof(::libusb_iso_packet_descriptor) * static_cast<std::size_t>(std::max(iso_packets, 0));
+        auto* const transfer = static_cast<::libusb_transfer*>(std::calloc(1, size));
+        if (transfer != nullptr)
+        {
+            transfer->num_iso_packets = iso_packets;
+        }
+
+        return transfer;
+    }
+
+    void libusb_free_transfer(::libusb_transfer* const transfer)
+    {
+        std::free(transfer);
+    }
+
+    int libusb_submit_transfer(::libusb_transfer* const transfer)
+    {
+        auto* const device_object = transfer->dev_handle->device;
+        auto* const context = device_object->context;
+        auto& device = *device_object->device;
+
+        auto& sim = simulator::instance();
+        auto lock = std::unique_lock{sim.mutex};
+        if (!device.plugged || context == nullptr)
+        {
+            return ::LIBUSB_ERROR_NO_DEVICE;
+        }
+
+        // Endpoints live as long as their device.
+        auto* const endpoint = device.endpoint(transfer->endpoint);
+        if (endpoint == nullptr)
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        // Taken before the simulator's mutex, so that sources and sinks run without it.
+        lock.unlock();
+        auto const serving_lock = std::scoped_lock{endpoint->serving_mutex};
+        lock.lock();
+
+        {
+            auto const context_lock = std::scoped_lock{context->mutex};
+            if (context->pending_keys.contains(transfer))
+            {
+                return ::LIBUSB_ERROR_BUSY;
+            }
+        }
+
+        auto pending = usb_asio::sim::detail::pending_transfer{transfer, &device, endpoint};
+        auto plan = usb_asio::sim::detail::plan_transfer(*endpoint, transfer, pending);
+
+        lock.unlock();
+        auto const bytes = usb_asio::sim::detail::run_transfer(transfer, plan, pending);
+        lock.lock();
+
+        // Unplugged meanwhile.
+        if (!device.plugged)
+        {
+            return ::LIBUSB_ERROR_NO_DEVICE;
+        }
+
+        auto const completion = usb_asio::sim::detail::schedule_transfer(*endpoint, plan, bytes, pending);
+
+        auto const context_lock = std::scoped_lock{context->mutex};
+        auto const key = usb_asio::sim::detail::pending_key{completion, context->next_sequence++};
+        context->pending.emplace(key, pending);
+        context->pending_keys.emplace(transfer, key);
+        context->notify();
+
+        return ::LIBUSB_SUCCESS;
+    }
+
+    int libusb_cancel_transfer(::libusb_transfer* const transfer)
+    {
+        auto* const context = transfer->dev_handle->device->context;
+        if (context == nullptr)
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        // The endpoint's schedule is guarded by the simulator's mutex.
+        auto const lock = std::scoped_lock{simulator::instance().mutex, context->mutex};
+        auto const iter = context->pending_keys.find(transfer);
+        if (iter == context->pending_keys.end())
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        auto& pending = context->pending.at(iter->second);
+        if (pending.cancelled || pending.status == ::LIBUSB_TRANSFER_NO_DEVICE)
+        {
+            return ::LIBUSB_ERROR_NOT_FOUND;
+        }
+
+        auto const now = usb_asio::sim::detail::clock::now();
+
+        // The endpoint is free again if nothing was scheduled after the transfer.
+        if (pending.endpoint->busy_until == iter->second.first)
+        {
+            pending.endpoint->busy_until = now;
+        }
+
+        if (pending.after_naks && now < pending.naking_until)
+        {
+            pending.endpoint->responses.push_front(*std::exchange(pending.after_naks, std::nullopt));
+        }
+
+        pending.cancelled = true;
+        usb_asio::sim::detail::reschedule(context, iter->second, ::LIBUSB_TRANSFER_CANCELLED);
+        context->notify();
+
+        return ::LIBUSB_SUCCESS;
+    }
+
+    int libusb_handle_events_timeout_completed(::libusb_context* const context, ::timeval* const tv, int* const completed)
+    {
+        return usb_asio::sim::detail::handle_events(context, usb_asio::sim::detail::to_duration(tv), completed);
+    }
+
+    int libusb_handle_events_timeout(::libusb_context* const context, ::timeval* const tv)
+    {
+        return usb_asio::sim::detail::handle_events(context, usb_asio::sim::detail::to_duration(tv), nullptr);
+    }
+
+    int libusb_handle_events_completed(::libusb_context* const context, int* const completed)
+    {
+        return usb_asio::sim::detail::handle_events(context, std::chrono::seconds{60}, completed);
+    }
+
+    int libusb_handle_events(::libusb_context* const context)
+    {
+        return usb_asio::sim::detail::handle_events(context, std::chrono::seconds{60}, nullptr);
+    }
+
+    void libusb_interrupt_event_handler(::libusb_context* context)
+    {
+        context = usb_asio::sim::detail::resolve_context(context);
+        if (context == nullptr)
+        {
+            return;
+        }
+
+        auto const lock = std::scoped_lock{context->mutex};
+        context->interrupted = true;
+        context->notify();
+    }
+
+    int libusb_get_next_timeout(::libusb_context* context, ::timeval* const tv)
+    {
+        context = usb_asio::sim::detail::resolve_context(context);
+        if (context == nullptr)
+        {
+            return ::LIBUSB_ERROR_INVALID_PARAM;
+        }
+
+        auto const lock = std::scoped_lock{context->mutex};
+        if (context->hotplug_events.empty() && context->pending.empty())
+        {
+            return 0;
+        }
+
+        auto timeout = std::chrono::microseconds{0};
+        if (context->hotplug_events.empty())
+        {
+            auto const remaining = context->pending.begin()->first.first - usb_asio::sim::detail::clock::now();
+            // Rounded up, not to wake up right before the completion.
+            timeout = std::max(std::chrono::ceil<std::chrono::microseconds>(remaining), std::chrono::microseconds{0});
+        }
+
+        tv->tv_sec = static_cast<decltype(tv->tv_sec)>(timeout.count() / 1'000'000);
+        tv->tv_usec = static_cast<decltype(tv->tv_usec)>(timeout.count() % 1'000'000);
+        return 1;
+    }
+
+    int libusb_pollfds_handle_timeouts(::libusb_context* /* context */)
+    {
+        // The descriptor is signalled whenever the pending transfers change, so that
+        // libusb_get_next_timeout is asked again once events are handled.
+        return 1;
+    }
+
+    ::libusb_pollfd const** libusb_get_pollfds(::libusb_context* context)
+    {
+        context = usb_asio::sim::detail::resolve_context(context);
+        if (context == nullptr)
+        {
+            return nullptr;
+        }
+
+        auto* const pollfds = static_cast<::libusb_pollfd const**>(std::calloc(2, sizeof(::libusb_pollfd const*)));
+        if (pollfds == nullptr)
+        {
+            return nullptr;
+        }
+
+        auto const lock = std::scoped_lock{context->mutex};
+        context->pollfd_requested = true;
+        pollfds[0] = &context->pollfd;
+        return pollfds;
+    }
+
+    void libusb_free_pollfds(::libusb_pollfd const** const pollfds)
+    {
+        std::free(static_cast<void*>(pollfds));
+    }
+
+    void libusb_set_pollfd_notifiers(
+        ::libusb_context* /* context */,
+        ::libusb_pollfd_added_cb /* added_cb */,
+        ::libusb_pollfd_removed_cb /* removed_cb */,
+        void* /* user_data */)
+    {
+        // The only descriptor lives as long as the context.
+    }
+
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000109
+    int libusb_hotplug_register_callback(
+        ::libusb_context* context,
+        int const events,
+        int const flags,
+#else
+    int libusb_hotplug_register_callback(
+        ::libusb_context* context,
+        ::libusb_hotplug_event const events,
+        ::libusb_hotplug_flag const flags,
+#endif
+        int const vendor_id,
+        int const product_id,
+        int const device_class,
+        ::libusb_hotplug_callback_fn const callback,
+        void* const user_data,
+        ::libusb_hotplug_callback_handle* const callback_handle)
+    {
+        context = usb_asio::sim::detail::resolve_context(context);
+        if (context == nullptr)
+        {
+            return ::LIBUSB_ERROR_INVALID_PARAM;
+        }
+
+        auto const hotplug_lock = std::scoped_lock{context->hotplug_mutex};
+
+        auto const registration = usb_asio::sim::detail::hotplug_callback{
+            context->next_hotplug_handle++,
+            static_cast<int>(events),
+            vendor_id,
+            product_id,
+            device_class,
+            callback,
+            user_data,
+        };
+
+        if ((flags & ::LIBUSB_HOTPLUG_ENUMERATE) != 0)
+        {
+            auto plugged = std::vector<::libusb_device*>{};
+            {
+                auto& sim = simulator::instance();
+                auto const lock = std::scoped_lock{sim.mutex};
+                for (auto const& device : sim.devices)
+                {
+                    if (usb_asio::sim::detail::matches(registration, *device, ::LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED))
+                    {
+                        plugged.push_back(usb_asio::sim::detail::device_object(context, device));
+                    }
+                }
+            }
+
+            for (auto* const device : plugged)
+            {
+                callback(context, device, ::LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, user_data);
+                ::libusb_unref_device(device);
+            }
+        }
+
+        context->hotplug_callbacks.push_back(registration);
+        if (callback_handle != nullptr)
+        {
+            *callback_handle = registration.handle;
+        }
+
+        return ::LIBUSB_SUCCESS;
+    }
+
+    void libusb_hotplug_deregister_callback(::libusb_context* context, ::libusb_hotplug_callback_handle const callback_handle)
+    {
+        context = usb_asio::sim::detail::resolve_context(context);
+        if (context == nullptr)
+        {
+            return;
+        }
+
+        auto const hotplug_lock = std::scoped_lock{context->hotplug_mutex};
+        std::erase_if(context->hotplug_callbacks, [&](auto const& callback) {
+            return callback.handle == callback_handle;
+        });
+    }
+}
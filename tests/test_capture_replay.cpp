@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include <usb_asio/simulator/usb_sim_replay.hpp>
+#include "test_common.hpp"
+
+namespace usb_asio::test
+{
+    namespace
+    {
+        using namespace std::chrono_literals;
+
+        constexpr auto iso_packet_lengths = std::array<std::size_t, 4>{10, 20, 0, 30};
+
+        auto capture_path() -> std::filesystem::path
+        {
+            return std::filesystem::temp_directory_path() / "usb_asio_test_capture_replay.pcap";
+        }
+
+        // Reads count bulk responses of 16 bytes, one transfer each.
+        void read_bulk(asio::io_context& ioc, sim_test_device& sim, std::size_t const count)
+        {
+            auto buffer = std::vector<std::byte>(64);
+            for (auto i = std::size_t{0}; i < count; ++i)
+            {
+                sim.sim_device().queue_response(bulk_in_endpoint, {.data = iota_bytes(16)});
+                auto transfer = usb_in_bulk_transfer{sim.device(), bulk_in_endpoint};
+                auto size = std::size_t{0};
+                auto handler = [&](error_code const& ec, std::size_t const result_size) {
+                    USB_ASIO_CHECK(!ec);
+                    size = result_size;
+                };
+                transfer.async_read_some(asio::buffer(buffer), handler);
+                run(ioc);
+                USB_ASIO_CHECK(size == 16);
+            }
+        }
+
+        // What a session of transfers got from the device.
+        struct session_results
+        {
+            std::vector<std::byte> bulk_data;
+            error_code stall_ec;
+            error_code nak_ec;
+            std::size_t written = 0;
+            std::vector<std::byte> control_data;
+            std::vector<std::size_t> iso_lengths;
+            std::vector<std::byte> first_iso_packet;
+        };
+
+        // Scripts the device for run_session, which records it when captured.
+        void script_device(sim::usb_sim_device& device)
+        {
+            device.queue_response(bulk_in_endpoint, {.data = iota_bytes(100)});
+            device.queue_response(bulk_in_endpoint, {.type = sim::usb_sim_response_type::stall});
+            device.queue_response(
+                bulk_in_endpoint,
+                {.type = sim::usb_sim_response_type::nak, .nak_duration = 10s});
+            device.queue_response(0, {.data = iota_bytes(18, 0x40)});
+            device.queue_response(
+                iso_in_endpoint,
+                {
+                    .data = iota_bytes(60, 0x80),
+                    .packet_lengths = {iso_packet_lengths.begin(), iso_packet_lengths.end()},
+                });
+        }
+
+        // One transfer of each kind, in order: a bulk read, a stalled one, one timing out
+        // after nak_timeout, a bulk write, a control read and an isochronous read.
+        auto run_session(asio::io_context& ioc, usb_device& device, std::chrono::milliseconds const nak_timeout)
+            -> session_results
+        {
+            auto results = session_results{};
+            auto buffer = std::vector<std::byte>(iso_packet_lengths.size() * iso_packet_size);
+
+            auto read_bulk = [&](std::chrono::milliseconds const timeout) {
+                auto transfer = usb_in_bulk_transfer{device, bulk_in_endpoint, timeout};
+                auto ec = error_code{};
+                auto size = std::size_t{0};
+                auto handler = [&](error_code const& result_ec, std::size_t const result_size) {
+                    ec = result_ec;
+                    size = result_size;
+                };
+                transfer.async_read_some(asio::buffer(buffer), handler);
+                run(ioc);
+                return std::pair{ec, std::span{buffer}.first(size)};
+            };
+
+            auto const [bulk_ec, bulk_data] = read_bulk(usb_no_timeout);
+            USB_ASIO_CHECK(!bulk_ec);
+            results.bulk_data.assign(bulk_data.begin(), bulk_data.end());
+            results.stall_ec = read_bulk(usb_no_timeout).first;
+            results.nak_ec = read_bulk(nak_timeout).first;
+
+            {
+                auto transfer = usb_out_bulk_transfer{device, bulk_out_endpoint};
+                auto const data = iota_bytes(10);
+                auto handler = [&](error_code const& ec, std::size_t const size) {
+                    USB_ASIO_CHECK(!ec);
+                    results.written = size;
+                };
+                transfer.async_write_some(asio::buffer(data), handler);
+                run(ioc);
+            }
+
+            {
+                auto transfer = usb_in_control_transfer{device.get_executor(), device};
+                auto control_buffer = usb_control_transfer_buffer{18};
+                auto handler = [&](error_code const& ec, std::size_t const size) {
+                    USB_ASIO_CHECK(!ec);
+                    auto const payload = control_buffer.payload().first(size);
+                    results.control_data.assign(payload.begin(), payload.end());
+                };
+                transfer.async_control(
+                    usb_control_request_recipient::device,
+                    usb_control_request_type::vendor_request,
+                    1,
+                    0,
+                    0,
+                    control_buffer,
+                    handler);
+                run(ioc);
+            }
+
+            {
+                auto transfer = usb_in_isochronous_transfer{
+                    device.get_executor(),
+                    device,
+                    iso_in_endpoint,
+                    iso_packet_lengths.size(),
+                    iso_packet_size,
+                };
+                auto handler = [&](error_code const& ec, std::span<usb_iso_packet_transfer_result const> const packets) {
+                    USB_ASIO_CHECK(!ec);
+                    for (auto const& packet : packets)
+                    {
+                        results.iso_lengths.push_back(packet.transferred);
+                    }
+                    if (!packets.empty())
+                    {
+                        auto const first = std::span{buffer}.first(packets.front().transferred);
+                        results.first_iso_packet.assign(first.begin(), first.end());
+                    }
+                };
+                transfer.async_read_some(asio::buffer(buffer), handler);
+                run(ioc);
+            }
+
+            return results;
+        }
+
+        void check_session(session_results const& results, std::vector<std::byte> const& bulk_data)
+        {
+            USB_ASIO_CHECK(results.bulk_data == bulk_data);
+            USB_ASIO_CHECK(results.stall_ec == usb_transfer_errc::stall);
+            USB_ASIO_CHECK(results.nak_ec == usb_transfer_errc::timeout);
+            USB_ASIO_CHECK(results.written == 10);
+            USB_ASIO_CHECK(results.control_data == iota_bytes(18, 0x40));
+            USB_ASIO_CHECK(std::ranges::equal(results.iso_lengths, iso_packet_lengths));
+            USB_ASIO_CHECK(results.first_iso_packet == iota_bytes(10, 0x80));
+        }
+
+        void replays_what_was_captured()
+        {
+            constexpr auto snap_length = std::size_t{64};
+            {
+                auto const capture = std::make_shared<usb_capture>(usb_capture_options{
+                    .path = capture_path(),
+                    .snap_length = snap_length,
+                });
+                auto ioc = asio::io_context{};
+                auto sim = sim_test_device{ioc, {.capture = capture}};
+                script_device(sim.sim_device());
+
+                check_session(run_session(ioc, sim.device(), 20ms), iota_bytes(100));
+            }
+
+            // Payloads past the snap length are zeros.
+            auto expected_bulk_data = iota_bytes(100);
+            std::ranges::fill(std::span{expected_bulk_data}.subspan(snap_length), std::byte{0});
+
+            auto const recording = sim::usb_sim_recording::load(capture_path());
+            auto const transfers = recording.transfers();
+            USB_ASIO_CHECK(transfers.size() == 6);
+            if (transfers.size() == 6)
+            {
+                USB_ASIO_CHECK(transfers[0].endpoint == bulk_in_endpoint);
+                USB_ASIO_CHECK(transfers[0].response.data == expected_bulk_data);
+                USB_ASIO_CHECK(transfers[1].response.type == sim::usb_sim_response_type::stall);
+                // Timeouts are replayed as the device NAKing for as long.
+                USB_ASIO_CHECK(transfers[2].response.type == sim::usb_sim_response_type::nak);
+                USB_ASIO_CHECK(transfers[2].response.nak_duration >= 15ms);
+                USB_ASIO_CHECK(transfers[3].endpoint == bulk_out_endpoint);
+                USB_ASIO_CHECK(transfers[3].response.data.size() == 10);
+                USB_ASIO_CHECK(transfers[4].endpoint == 0);
+                USB_ASIO_CHECK(transfers[4].type == usb_transfer_type::control);
+                USB_ASIO_CHECK(transfers[4].response.data == iota_bytes(18, 0x40));
+                USB_ASIO_CHECK(transfers[5].type == usb_transfer_type::isochronous);
+                USB_ASIO_CHECK(std::ranges::equal(transfers[5].response.packet_lengths, iso_packet_lengths));
+            }
+
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            recording.replay(sim.sim_device(), sim::usb_sim_replay_timing::as_fast_as_possible);
+
+            // Timing out well within the replayed NAKs.
+            check_session(run_session(ioc, sim.device(), 5ms), expected_bulk_data);
+            std::filesystem::remove(capture_path());
+        }
+
+        void sample_every_zero_captures_nothing()
+        {
+            auto const capture = std::make_shared<usb_capture>(usb_capture_options{
+                .path = capture_path(),
+                .sample_every = 0,
+            });
+            {
+                auto ioc = asio::io_context{};
+                auto sim = sim_test_device{ioc, {.capture = capture}};
+                read_bulk(ioc, sim, 3);
+            }
+
+            USB_ASIO_CHECK(capture->captured() == 0);
+            USB_ASIO_CHECK(capture->dropped() == 0);
+        }
+
+        void sample_every_n_captures_one_transfer_in_n()
+        {
+            auto const capture = std::make_shared<usb_capture>(usb_capture_options{
+                .path = capture_path(),
+                .sample_every = 3,
+            });
+            {
+                auto ioc = asio::io_context{};
+                auto sim = sim_test_device{ioc, {.capture = capture}};
+                read_bulk(ioc, sim, 6);
+
+                // A submission and a completion for each of the two sampled transfers.
+                USB_ASIO_CHECK(capture->captured() == 4);
+
+                capture->set_sample_every(1);
+                read_bulk(ioc, sim, 2);
+                USB_ASIO_CHECK(capture->captured() == 8);
+            }
+            USB_ASIO_CHECK(capture->dropped() == 0);
+        }
+
+        void full_ring_drops_records()
+        {
+            // The writer only gets to the ring once the capture is destroyed.
+            auto const capture = std::make_shared<usb_capture>(usb_capture_options{
+                .path = capture_path(),
+                .ring_slots = 2,
+                .flush_interval = 10s,
+            });
+            {
+                auto ioc = asio::io_context{};
+                auto sim = sim_test_device{ioc, {.capture = capture}};
+                read_bulk(ioc, sim, 4);
+            }
+
+            USB_ASIO_CHECK(capture->captured() + capture->dropped() == 8);
+            USB_ASIO_CHECK(capture->dropped() >= 4);
+        }
+
+        void truncates_iso_descriptors()
+        {
+            {
+                auto const capture = std::make_shared<usb_capture>(usb_capture_options{
+                    .path = capture_path(),
+                    .snap_length = iso_packet_size + 8,
+                    .max_iso_descriptors = 2,
+                });
+                auto ioc = asio::io_context{};
+                auto sim = sim_test_device{ioc, {.capture = capture}};
+                sim.sim_device().queue_response(
+                    iso_in_endpoint,
+                    {
+                        .data = iota_bytes(60, 0x80),
+                        .packet_lengths = {iso_packet_lengths.begin(), iso_packet_lengths.end()},
+                    });
+
+                auto transfer = usb_in_isochronous_transfer{
+                    ioc.get_executor(),
+                    sim.device(),
+                    iso_in_endpoint,
+                    iso_packet_lengths.size(),
+                    iso_packet_size,
+                };
+                auto buffer = std::vector<std::byte>(iso_packet_lengths.size() * iso_packet_size);
+                auto completed = false;
+                auto handler = [&](error_code const& ec, std::span<usb_iso_packet_transfer_result const>) {
+                    USB_ASIO_CHECK(!ec);
+                    completed = true;
+                };
+                transfer.async_read_some(asio::buffer(buffer), handler);
+                run(ioc);
+                USB_ASIO_CHECK(completed);
+            }
+
+            auto const recording = sim::usb_sim_recording::load(capture_path());
+            auto const transfers = recording.transfers();
+            USB_ASIO_CHECK(transfers.size() == 1);
+            if (transfers.size() == 1)
+            {
+                // The packets past the recorded descriptors share what is left, and the data past the
+                // snap length (8 bytes into the second packet) is zeros.
+                auto const& response = transfers[0].response;
+                USB_ASIO_CHECK(std::ranges::equal(response.packet_lengths, std::array<std::size_t, 4>{10, 20, 15, 15}));
+                auto expected_data = iota_bytes(10, 0x80);
+                auto const second_packet = iota_bytes(8, 0x8a);
+                expected_data.insert(expected_data.end(), second_packet.begin(), second_packet.end());
+                expected_data.resize(60);
+                USB_ASIO_CHECK(response.data == expected_data);
+            }
+            std::filesystem::remove(capture_path());
+        }
+    }  // namespace
+}  // namespace usb_asio::test
+
+auto main() -> int
+{
+    using namespace usb_asio::test;
+
+    return run_tests({
+        {"replays_what_was_captured", &replays_what_was_captured},
+        {"sample_every_zero_captures_nothing", &sample_every_zero_captures_nothing},
+        {"sample_every_n_captures_one_transfer_in_n", &sample_every_n_captures_one_transfer_in_n},
+        {"full_ring_drops_records", &full_ring_drops_records},
+        {"truncates_iso_descriptors", &truncates_iso_descriptors},
+    });
+}
@@ -0,0 +1,69 @@
+#include "test_common.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+
+namespace usb_asio::test
+{
+    namespace
+    {
+        auto failed_checks = 0;
+    }  // namespace
+
+    void check(bool const passed, char const* const expression, char const* const file, int const line) noexcept
+    {
+        if (!passed)
+        {
+            ++failed_checks;
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+        }
+    }
+
+    auto run_tests(std::initializer_list<test_case> const tests) -> int
+    {
+        auto failed_tests = 0;
+        for (auto const& test : tests)
+        {
+            auto const failed_before = failed_checks;
+            try
+            {
+                test.run();
+            }
+            catch (std::exception const& e)
+            {
+                ++failed_checks;
+                std::fprintf(stderr, "%s: threw: %s\n", test.name, e.what());
+            }
+
+            auto const passed = failed_checks == failed_before;
+            failed_tests += passed ? 0 : 1;
+            std::fprintf(stderr, "[%s] %s\n", passed ? "pass" : "FAIL", test.name);
+        }
+
+        return failed_tests == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    void run(asio::io_context& ioc)
+    {
+        ioc.run();
+        ioc.restart();
+    }
+
+    auto iota_bytes(std::size_t const size, std::uint8_t const first) -> std::vector<std::byte>
+    {
+        auto bytes = std::vector<std::byte>(size);
+        auto value = first;
+        for (auto& byte : bytes)
+        {
+            byte = std::byte{value++};
+        }
+
+        return bytes;
+    }
+
+    sim_test_device::sim_test_device(asio::io_context& ioc, usb_service_options const& options)
+      : usb_sim_opened_device{ioc, {.first_product_id = 0x0c00, .iso_packet_size = iso_packet_size}, options}
+    {
+    }
+}  // namespace usb_asio::test
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#include <usb_asio/simulator/usb_sim_opened_device.hpp>
+#include <usb_asio/simulator/usb_simulator.hpp>
+#include <usb_asio/usb_asio.hpp>
+
+// Fails the running test, which goes on with its next checks.
+#define USB_ASIO_CHECK(...) \
+    ::usb_asio::test::check(static_cast<bool>(__VA_ARGS__), #__VA_ARGS__, __FILE__, __LINE__)
+
+namespace usb_asio::test
+{
+    // Endpoints of the simulated device, on interface 0.
+    inline constexpr auto bulk_in_endpoint = sim::usb_sim_opened_device::bulk_in_endpoint;
+    inline constexpr auto bulk_out_endpoint = sim::usb_sim_opened_device::bulk_out_endpoint;
+    inline constexpr auto iso_in_endpoint = sim::usb_sim_opened_device::iso_in_endpoint;
+    inline constexpr auto iso_packet_size = std::size_t{192};
+
+    struct test_case
+    {
+        char const* name;
+        void (*run)();
+    };
+
+    void check(bool passed, char const* expression, char const* file, int line) noexcept;
+
+    // Runs the tests in order, returns the exit code of the test executable.
+    [[nodiscard]] auto run_tests(std::initializer_list<test_case> tests) -> int;
+
+    // Runs the io_context until it runs out of work, ready to be run again.
+    void run(asio::io_context& ioc);
+
+    // Bytes counting up from first.
+    [[nodiscard]] auto iota_bytes(std::size_t size, std::uint8_t first = 0) -> std::vector<std::byte>;
+
+    // The simulated device of a test.
+    class sim_test_device : public sim::usb_sim_opened_device
+    {
+      public:
+        explicit sim_test_device(asio::io_context& ioc, usb_service_options const& options = {});
+    };
+}  // namespace usb_asio::test
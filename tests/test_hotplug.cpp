@@ -0,0 +1,273 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "test_common.hpp"
+
+namespace usb_asio::test
+{
+    namespace
+    {
+        using namespace std::chrono_literals;
+
+        constexpr auto vendor_id = std::uint16_t{0x1209};
+
+        auto next_product_id = std::uint16_t{0x0d00};
+
+        // Devices of their own, so that the filters only match them.
+        auto make_sim_device(std::uint16_t const product_id) -> sim::usb_sim_device
+        {
+            return sim::usb_sim_device{sim::usb_sim_device_config{
+                .vendor_id = vendor_id,
+                .product_id = product_id,
+            }};
+        }
+
+        // On a bus and port of its own, for the enumerator which orders devices by port path.
+        auto make_sim_device(std::uint16_t const product_id, std::uint8_t const port) -> sim::usb_sim_device
+        {
+            return sim::usb_sim_device{sim::usb_sim_device_config{
+                .vendor_id = vendor_id,
+                .product_id = product_id,
+                .bus_number = 2,
+                .port_numbers = {1, port},
+            }};
+        }
+
+        struct wait_result
+        {
+            error_code ec;
+            std::optional<usb_hotplug_event> event;
+            bool completed = false;
+        };
+
+        auto wait_event(asio::io_context& ioc, usb_hotplug_monitor& monitor) -> wait_result
+        {
+            auto result = wait_result{};
+            auto handler = [&](error_code const& ec, usb_hotplug_event event) {
+                result = {ec, std::move(event), true};
+            };
+            monitor.async_wait_event(handler);
+            run(ioc);
+
+            return result;
+        }
+
+        auto is_event(
+            wait_result const& result,
+            usb_hotplug_event_type const type,
+            std::uint16_t const product_id) -> bool
+        {
+            return result.completed
+                   && !result.ec
+                   && result.event.has_value()
+                   && result.event->type == type
+                   && result.event->device.device_descriptor().idProduct == product_id;
+        }
+
+        void reports_arrival_and_departure()
+        {
+            auto ioc = asio::io_context{};
+            auto const product_id = next_product_id++;
+            auto monitor = usb_hotplug_monitor{ioc, {.vendor_id = vendor_id, .product_id = product_id}};
+
+            auto result = wait_result{};
+            auto handler = [&](error_code const& ec, usb_hotplug_event event) {
+                result = {ec, std::move(event), true};
+            };
+            monitor.async_wait_event(handler);
+            ioc.poll();
+            USB_ASIO_CHECK(!result.completed);
+
+            auto device = make_sim_device(product_id);
+            run(ioc);
+            USB_ASIO_CHECK(is_event(result, usb_hotplug_event_type::arrived, product_id));
+
+            device.unplug();
+            auto const left = wait_event(ioc, monitor);
+            USB_ASIO_CHECK(is_event(left, usb_hotplug_event_type::left, product_id));
+            USB_ASIO_CHECK(left.event && result.event && left.event->device == result.event->device);
+        }
+
+        void queues_events_while_not_waiting()
+        {
+            auto ioc = asio::io_context{};
+            auto const product_id = next_product_id++;
+            auto monitor = usb_hotplug_monitor{ioc, {.vendor_id = vendor_id, .product_id = product_id}};
+
+            make_sim_device(product_id).unplug();
+            auto const device = make_sim_device(product_id);
+
+            USB_ASIO_CHECK(is_event(wait_event(ioc, monitor), usb_hotplug_event_type::arrived, product_id));
+            USB_ASIO_CHECK(is_event(wait_event(ioc, monitor), usb_hotplug_event_type::left, product_id));
+            USB_ASIO_CHECK(is_event(wait_event(ioc, monitor), usb_hotplug_event_type::arrived, product_id));
+        }
+
+        void filters_devices()
+        {
+            auto ioc = asio::io_context{};
+            auto const product_id = next_product_id++;
+            auto const other_product_id = next_product_id++;
+            auto monitor = usb_hotplug_monitor{ioc, {.vendor_id = vendor_id, .product_id = product_id}};
+
+            auto const other_device = make_sim_device(other_product_id);
+            auto const device = make_sim_device(product_id);
+
+            USB_ASIO_CHECK(is_event(wait_event(ioc, monitor), usb_hotplug_event_type::arrived, product_id));
+        }
+
+        void enumerate_reports_present_devices()
+        {
+            auto ioc = asio::io_context{};
+            auto const product_id = next_product_id++;
+            auto const device = make_sim_device(product_id);
+
+            auto monitor = usb_hotplug_monitor{
+                ioc,
+                {.vendor_id = vendor_id, .product_id = product_id, .enumerate = true},
+            };
+            USB_ASIO_CHECK(is_event(wait_event(ioc, monitor), usb_hotplug_event_type::arrived, product_id));
+        }
+
+        void cancel_completes_with_operation_aborted()
+        {
+            auto ioc = asio::io_context{};
+            auto const product_id = next_product_id++;
+            auto const device = make_sim_device(product_id);
+
+            // Not enumerating: the device already there is not reported.
+            auto monitor = usb_hotplug_monitor{ioc, {.vendor_id = vendor_id, .product_id = product_id}};
+            auto result = wait_result{};
+            auto handler = [&](error_code const& ec, usb_hotplug_event event) {
+                result = {ec, std::move(event), true};
+            };
+            monitor.async_wait_event(handler);
+            ioc.run_for(20ms);
+            USB_ASIO_CHECK(!result.completed);
+
+            monitor.cancel();
+            run(ioc);
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(result.ec == asio::error::operation_aborted);
+        }
+
+        auto product_ids_of(std::span<usb_device_info const> const devices) -> std::vector<std::uint16_t>
+        {
+            auto product_ids = std::vector<std::uint16_t>{};
+            for (auto const& device : devices)
+            {
+                product_ids.push_back(device.device_descriptor().idProduct);
+            }
+
+            return product_ids;
+        }
+
+        auto product_ids_of(std::span<usb_enumerated_device const> const devices) -> std::vector<std::uint16_t>
+        {
+            auto product_ids = std::vector<std::uint16_t>{};
+            for (auto const& device : devices)
+            {
+                product_ids.push_back(device.info.device_descriptor().idProduct);
+            }
+
+            return product_ids;
+        }
+
+        void enumerator_reports_added_and_removed_devices()
+        {
+            auto ioc = asio::io_context{};
+            auto enumerator = usb_device_enumerator{ioc};
+            auto const first_product_id = next_product_id++;
+            auto const second_product_id = next_product_id++;
+            auto first = make_sim_device(first_product_id, 1);
+            auto const second = make_sim_device(second_product_id, 2);
+
+            // Ordered by port path.
+            auto const initial = enumerator.rescan();
+            USB_ASIO_CHECK(product_ids_of(initial.added) == std::vector{first_product_id, second_product_id});
+            USB_ASIO_CHECK(initial.removed.empty());
+            auto const second_info = enumerator.devices()[1].info;
+
+            USB_ASIO_CHECK(enumerator.rescan().empty());
+
+            first.unplug();
+            auto const changes = enumerator.rescan();
+            USB_ASIO_CHECK(changes.added.empty());
+            USB_ASIO_CHECK(product_ids_of(changes.removed) == std::vector{first_product_id});
+
+            // Devices that did not change keep their usb_device_info.
+            USB_ASIO_CHECK(enumerator.devices().size() == 1);
+            USB_ASIO_CHECK(enumerator.devices()[0].info == second_info);
+        }
+
+        void enumerator_reports_a_replaced_device()
+        {
+            auto ioc = asio::io_context{};
+            auto enumerator = usb_device_enumerator{ioc};
+            auto const old_product_id = next_product_id++;
+            auto const new_product_id = next_product_id++;
+            auto old_device = make_sim_device(old_product_id, 3);
+            USB_ASIO_CHECK(product_ids_of(enumerator.rescan().added) == std::vector{old_product_id});
+
+            // At the same port between two rescans.
+            old_device.unplug();
+            auto const new_device = make_sim_device(new_product_id, 3);
+            auto const changes = enumerator.rescan();
+            USB_ASIO_CHECK(product_ids_of(changes.removed) == std::vector{old_product_id});
+            USB_ASIO_CHECK(product_ids_of(changes.added) == std::vector{new_product_id});
+            USB_ASIO_CHECK(product_ids_of(enumerator.devices()) == std::vector{new_product_id});
+        }
+
+        void descriptor_cache_drops_departed_devices()
+        {
+            auto ioc = asio::io_context{};
+            auto const departing_product_id = next_product_id++;
+            auto const staying_product_id = next_product_id++;
+            auto departing = make_sim_device(departing_product_id, 4);
+            auto const staying = make_sim_device(staying_product_id, 5);
+
+            auto tree_of = [&](std::uint16_t const product_id) -> std::shared_ptr<usb_descriptor_tree const> {
+                for (auto const& info : list_usb_devices(ioc))
+                {
+                    if (info.device_descriptor().idProduct == product_id)
+                    {
+                        return usb_descriptor_tree_of(ioc, info);
+                    }
+                }
+                return nullptr;
+            };
+
+            auto const departing_tree = std::weak_ptr{tree_of(departing_product_id)};
+            auto const staying_tree = std::weak_ptr{tree_of(staying_product_id)};
+            USB_ASIO_CHECK(!departing_tree.expired());
+            USB_ASIO_CHECK(!staying_tree.expired());
+
+            // Without a monitor nor an enumerator, departures are noticed when the devices are next listed.
+            departing.unplug();
+            USB_ASIO_CHECK(!departing_tree.expired());
+            USB_ASIO_CHECK(list_usb_devices(ioc).size() > 0u);
+            USB_ASIO_CHECK(departing_tree.expired());
+            USB_ASIO_CHECK(!staying_tree.expired());
+            USB_ASIO_CHECK(tree_of(staying_product_id) == staying_tree.lock());
+        }
+    }  // namespace
+}  // namespace usb_asio::test
+
+auto main() -> int
+{
+    using namespace usb_asio::test;
+
+    return run_tests({
+        {"reports_arrival_and_departure", &reports_arrival_and_departure},
+        {"queues_events_while_not_waiting", &queues_events_while_not_waiting},
+        {"filters_devices", &filters_devices},
+        {"enumerate_reports_present_devices", &enumerate_reports_present_devices},
+        {"cancel_completes_with_operation_aborted", &cancel_completes_with_operation_aborted},
+        {"enumerator_reports_added_and_removed_devices", &enumerator_reports_added_and_removed_devices},
+        {"enumerator_reports_a_replaced_device", &enumerator_reports_a_replaced_device},
+        {"descriptor_cache_drops_departed_devices", &descriptor_cache_drops_departed_devices},
+    });
+}
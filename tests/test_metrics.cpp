@@ -0,0 +1,123 @@
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+
+#include "test_common.hpp"
+
+namespace usb_asio::test
+{
+    namespace
+    {
+        using namespace std::chrono_literals;
+
+        // Answers three reads of 10, 20 and 30 bytes then stalls, each transfer taking 1 ms.
+        void read_bulk_in(asio::io_context& ioc, sim_test_device& sim)
+        {
+            for (auto const size : {10u, 20u, 30u})
+            {
+                sim.sim_device().queue_response(bulk_in_endpoint, {.data = iota_bytes(size), .duration = 1ms});
+            }
+            sim.sim_device().queue_response(
+                bulk_in_endpoint,
+                {.type = sim::usb_sim_response_type::stall, .duration = 1ms});
+
+            auto transfer = usb_in_bulk_transfer{sim.device(), bulk_in_endpoint};
+            auto buffer = std::array<std::byte, 64>{};
+            auto handler = [](error_code const& /* ec */, std::size_t const /* size */) { };
+            for (auto i = 0; i < 4; ++i)
+            {
+                transfer.async_read_some(asio::buffer(buffer), handler);
+                run(ioc);
+            }
+        }
+
+        auto bulk_in_metrics(sim_test_device& sim) -> std::optional<usb_endpoint_metrics>
+        {
+            auto* const device = ::libusb_get_device(sim.device().handle());
+            for (auto const& metrics : sim.device().service().transfer_metrics())
+            {
+                if (metrics.bus_number == ::libusb_get_bus_number(device)
+                    && metrics.device_address == ::libusb_get_device_address(device)
+                    && metrics.endpoint == bulk_in_endpoint)
+                {
+                    return metrics;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+        void counts_transfers_bytes_and_errors()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            read_bulk_in(ioc, sim);
+
+            auto const metrics = bulk_in_metrics(sim);
+            USB_ASIO_CHECK(metrics.has_value());
+            if (!metrics.has_value()) { return; }
+
+            USB_ASIO_CHECK(metrics->submitted == 4u);
+            USB_ASIO_CHECK(metrics->submit_failures == 0u);
+            USB_ASIO_CHECK(metrics->completed == 4u);
+            USB_ASIO_CHECK(metrics->bytes == 60u);
+            USB_ASIO_CHECK(metrics->errors(usb_transfer_errc::stall) == 1u);
+            USB_ASIO_CHECK(metrics->errors(usb_transfer_errc::overflow) == 0u);
+            USB_ASIO_CHECK(metrics->submit_to_complete.count() == 4u);
+            USB_ASIO_CHECK(metrics->complete_to_handler.count() == 4u);
+
+            // Every transfer took at least its 1 ms on the device.
+            auto const median = metrics->submit_to_complete.percentile(0.5);
+            USB_ASIO_CHECK(median >= 1ms);
+            USB_ASIO_CHECK(median <= metrics->submit_to_complete.max());
+            USB_ASIO_CHECK(metrics->submit_to_complete.mean() >= 1ms);
+        }
+
+        void reset_clears_the_metrics()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            read_bulk_in(ioc, sim);
+            sim.device().service().reset_transfer_metrics();
+
+            auto const metrics = bulk_in_metrics(sim);
+            USB_ASIO_CHECK(metrics.has_value());
+            if (!metrics.has_value()) { return; }
+
+            USB_ASIO_CHECK(metrics->submitted == 0u);
+            USB_ASIO_CHECK(metrics->completed == 0u);
+            USB_ASIO_CHECK(metrics->bytes == 0u);
+            USB_ASIO_CHECK(metrics->errors(usb_transfer_errc::stall) == 0u);
+            USB_ASIO_CHECK(metrics->submit_to_complete.count() == 0u);
+            USB_ASIO_CHECK(metrics->submit_to_complete.percentile(0.5) == 0ns);
+            USB_ASIO_CHECK(metrics->submit_to_complete.max() == 0ns);
+            USB_ASIO_CHECK(metrics->complete_to_handler.count() == 0u);
+        }
+#else
+        void metrics_stay_empty_when_disabled()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            read_bulk_in(ioc, sim);
+
+            USB_ASIO_CHECK(!bulk_in_metrics(sim).has_value());
+        }
+#endif
+    }  // namespace
+}  // namespace usb_asio::test
+
+auto main() -> int
+{
+    using namespace usb_asio::test;
+
+    return run_tests({
+#ifdef USB_ASIO_ENABLE_TRANSFER_METRICS
+        {"counts_transfers_bytes_and_errors", &counts_transfers_bytes_and_errors},
+        {"reset_clears_the_metrics", &reset_clears_the_metrics},
+#else
+        {"metrics_stay_empty_when_disabled", &metrics_stay_empty_when_disabled},
+#endif
+    });
+}
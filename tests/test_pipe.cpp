@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "test_common.hpp"
+
+namespace usb_asio::test
+{
+    namespace
+    {
+        using namespace std::chrono_literals;
+
+        struct pipe_result
+        {
+            error_code ec;
+            std::size_t size = 0;
+            bool completed = false;
+        };
+
+        void read_exact_fills_the_buffer_across_chunks()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            auto next_byte = std::uint8_t{0};
+            sim.sim_device().set_in_source(bulk_in_endpoint, [&](std::span<std::byte> const buffer) {
+                for (auto& byte : buffer)
+                {
+                    byte = std::byte{next_byte++};
+                }
+                return buffer.size();
+            });
+
+            auto pipe = usb_in_bulk_pipe{
+                sim.device(),
+                bulk_in_endpoint,
+                usb_pipe_options{.num_transfers = 2, .max_transfer_size = 512},
+            };
+            auto buffer = std::vector<std::byte>(2048);
+            auto result = pipe_result{};
+            auto handler = [&](error_code const& ec, std::size_t const size) {
+                result = {ec, size, true};
+            };
+            pipe.async_read_exact(asio::buffer(buffer), handler);
+            run(ioc);
+
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(!result.ec);
+            USB_ASIO_CHECK(result.size == buffer.size());
+            USB_ASIO_CHECK(buffer == iota_bytes(buffer.size()));
+        }
+
+        void read_exact_ends_on_a_short_packet()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().queue_response(bulk_in_endpoint, {.data = iota_bytes(100)});
+
+            // A single transfer, not to lose data read ahead by the next chunks.
+            auto pipe = usb_in_bulk_pipe{
+                sim.device(),
+                bulk_in_endpoint,
+                usb_pipe_options{.num_transfers = 1, .max_transfer_size = 512},
+            };
+            auto buffer = std::vector<std::byte>(1024);
+            auto result = pipe_result{};
+            auto handler = [&](error_code const& ec, std::size_t const size) {
+                result = {ec, size, true};
+            };
+            pipe.async_read_exact(asio::buffer(buffer), handler);
+            run(ioc);
+
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(result.ec == asio::error::eof);
+            USB_ASIO_CHECK(result.size == 100);
+            USB_ASIO_CHECK(std::ranges::equal(std::span{buffer}.first(100), iota_bytes(100)));
+        }
+
+        void write_all_sends_the_sequence_in_order()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            auto received = std::vector<std::byte>{};
+            sim.sim_device().set_out_sink(bulk_out_endpoint, [&](std::span<std::byte const> const data) {
+                received.insert(received.end(), data.begin(), data.end());
+            });
+
+            auto pipe = usb_out_bulk_pipe{
+                sim.device(),
+                bulk_out_endpoint,
+                usb_pipe_options{.num_transfers = 2, .max_transfer_size = 1024},
+            };
+            // Small segments are staged, the large one goes in place.
+            auto const head = iota_bytes(10);
+            auto const body = iota_bytes(3000, 10);
+            auto const tail = iota_bytes(5, static_cast<std::uint8_t>(10 + 3000));
+            auto const buffers = std::array{asio::buffer(head), asio::buffer(body), asio::buffer(tail)};
+            auto result = pipe_result{};
+            auto handler = [&](error_code const& ec, std::size_t const size) {
+                result = {ec, size, true};
+            };
+            pipe.async_write_all(buffers, handler);
+            run(ioc);
+
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(!result.ec);
+            USB_ASIO_CHECK(result.size == head.size() + body.size() + tail.size());
+            USB_ASIO_CHECK(received == iota_bytes(result.size));
+        }
+
+        void cancel_completes_with_the_data_so_far()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().queue_response(
+                bulk_in_endpoint,
+                {.type = sim::usb_sim_response_type::nak, .nak_duration = 10s});
+
+            auto pipe = usb_in_bulk_pipe{
+                sim.device(),
+                bulk_in_endpoint,
+                usb_pipe_options{.num_transfers = 2, .max_transfer_size = 512},
+            };
+            auto buffer = std::vector<std::byte>(2048);
+            auto result = pipe_result{};
+            auto handler = [&](error_code const& ec, std::size_t const size) {
+                result = {ec, size, true};
+            };
+            pipe.async_read_exact(asio::buffer(buffer), handler);
+            ioc.run_for(10ms);
+            USB_ASIO_CHECK(!result.completed);
+
+            pipe.cancel();
+            run(ioc);
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(result.ec == usb_transfer_errc::cancelled);
+            USB_ASIO_CHECK(result.size == 0);
+        }
+    }  // namespace
+}  // namespace usb_asio::test
+
+auto main() -> int
+{
+    using namespace usb_asio::test;
+
+    return run_tests({
+        {"read_exact_fills_the_buffer_across_chunks", &read_exact_fills_the_buffer_across_chunks},
+        {"read_exact_ends_on_a_short_packet", &read_exact_ends_on_a_short_packet},
+        {"write_all_sends_the_sequence_in_order", &write_all_sends_the_sequence_in_order},
+        {"cancel_completes_with_the_data_so_far", &cancel_completes_with_the_data_so_far},
+    });
+}
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "test_common.hpp"
+
+namespace usb_asio::test
+{
+    namespace
+    {
+        using namespace std::chrono_literals;
+
+        struct buffer_result
+        {
+            error_code ec;
+            std::vector<std::byte> data;
+            bool completed = false;
+        };
+
+        void bulk_stream_hands_out_buffers_in_order()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            for (auto i = std::size_t{0}; i < 8; ++i)
+            {
+                sim.sim_device().queue_response(
+                    bulk_in_endpoint,
+                    {.data = iota_bytes(i + 1, static_cast<std::uint8_t>(i))});
+            }
+
+            auto stream = usb_bulk_in_stream{sim.device(), bulk_in_endpoint, 4, 512};
+            for (auto i = std::size_t{0}; i < 8; ++i)
+            {
+                auto result = buffer_result{};
+                auto handler = [&](error_code const& ec, std::span<std::byte const> const buffer) {
+                    result = {ec, {buffer.begin(), buffer.end()}, true};
+                };
+                stream.async_read_buffer(handler);
+                run(ioc);
+
+                USB_ASIO_CHECK(result.completed);
+                USB_ASIO_CHECK(!result.ec);
+                USB_ASIO_CHECK(result.data == iota_bytes(i + 1, static_cast<std::uint8_t>(i)));
+            }
+        }
+
+        void bulk_stream_read_some_copies_the_data()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().queue_response(bulk_in_endpoint, {.data = iota_bytes(10)});
+            sim.sim_device().queue_response(bulk_in_endpoint, {.data = iota_bytes(6, 10)});
+
+            auto stream = usb_bulk_in_stream{sim.device(), bulk_in_endpoint, 2, 512};
+            auto received = std::vector<std::byte>{};
+            while (received.size() < 16)
+            {
+                auto chunk = std::array<std::byte, 4>{};
+                auto result = buffer_result{};
+                auto handler = [&](error_code const& ec, std::size_t const size) {
+                    result = {ec, {chunk.begin(), chunk.begin() + static_cast<std::ptrdiff_t>(size)}, true};
+                };
+                stream.async_read_some(asio::buffer(chunk), handler);
+                run(ioc);
+
+                USB_ASIO_CHECK(result.completed);
+                USB_ASIO_CHECK(!result.ec);
+                if (!result.completed || result.ec || result.data.empty())
+                {
+                    break;
+                }
+                received.insert(received.end(), result.data.begin(), result.data.end());
+            }
+
+            USB_ASIO_CHECK(received == iota_bytes(16));
+        }
+
+        void bulk_stream_cancel_stops_streaming()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().queue_response(
+                bulk_in_endpoint,
+                {.type = sim::usb_sim_response_type::nak, .nak_duration = 10s});
+
+            auto stream = usb_bulk_in_stream{sim.device(), bulk_in_endpoint, 2, 512};
+            auto result = buffer_result{};
+            auto handler = [&](error_code const& ec, std::span<std::byte const> const buffer) {
+                result = {ec, {buffer.begin(), buffer.end()}, true};
+            };
+            stream.async_read_buffer(handler);
+            ioc.run_for(10ms);
+            USB_ASIO_CHECK(!result.completed);
+            USB_ASIO_CHECK(stream.is_streaming());
+
+            stream.cancel();
+            run(ioc);
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(result.ec == usb_transfer_errc::cancelled);
+            USB_ASIO_CHECK(!stream.is_streaming());
+        }
+
+        void bulk_stream_destroyed_while_streaming()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().queue_response(
+                bulk_in_endpoint,
+                {.type = sim::usb_sim_response_type::nak, .nak_duration = 10s});
+
+            auto completed = false;
+            {
+                auto stream = usb_bulk_in_stream{sim.device(), bulk_in_endpoint, 4, 512};
+                auto handler = [&](error_code const&, std::span<std::byte const>) {
+                    completed = true;
+                };
+                stream.async_read_buffer(handler);
+                ioc.run_for(10ms);
+            }
+
+            // The transfers in flight are cancelled, and the pending handler dropped.
+            run(ioc);
+            USB_ASIO_CHECK(!completed);
+        }
+
+        void iso_stream_reads_packets()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().set_in_source(iso_in_endpoint, [](std::span<std::byte> const packet) {
+                std::ranges::fill(packet, std::byte{0x5a});
+                return packet.size() / 2;
+            });
+
+            constexpr auto num_packets = std::size_t{4};
+            auto stream = usb_iso_in_stream{sim.device(), iso_in_endpoint, 2, num_packets, iso_packet_size};
+            for (auto i = 0; i < 3; ++i)
+            {
+                auto ec = error_code{};
+                auto packets = std::vector<usb_iso_packet>{};
+                auto handler = [&](error_code const& result_ec, std::span<usb_iso_packet const> const result) {
+                    ec = result_ec;
+                    packets.assign(result.begin(), result.end());
+                };
+                stream.async_read_packets(handler);
+                run(ioc);
+
+                USB_ASIO_CHECK(!ec);
+                USB_ASIO_CHECK(packets.size() == num_packets);
+                for (auto const& packet : packets)
+                {
+                    USB_ASIO_CHECK(!packet.ec);
+                    USB_ASIO_CHECK(packet.payload.size() == iso_packet_size / 2);
+                    USB_ASIO_CHECK(std::ranges::all_of(packet.payload, [](auto const b) { return b == std::byte{0x5a}; }));
+                }
+            }
+
+            stream.cancel();
+            USB_ASIO_CHECK(stream.stats().transfers >= 3);
+            USB_ASIO_CHECK(stream.stats().missed_frames == 0);
+        }
+    }  // namespace
+}  // namespace usb_asio::test
+
+auto main() -> int
+{
+    using namespace usb_asio::test;
+
+    return run_tests({
+        {"bulk_stream_hands_out_buffers_in_order", &bulk_stream_hands_out_buffers_in_order},
+        {"bulk_stream_read_some_copies_the_data", &bulk_stream_read_some_copies_the_data},
+        {"bulk_stream_cancel_stops_streaming", &bulk_stream_cancel_stops_streaming},
+        {"bulk_stream_destroyed_while_streaming", &bulk_stream_destroyed_while_streaming},
+        {"iso_stream_reads_packets", &iso_stream_reads_packets},
+    });
+}
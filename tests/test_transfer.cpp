@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "test_common.hpp"
+
+namespace usb_asio::test
+{
+    namespace
+    {
+        using namespace std::chrono_literals;
+
+        struct read_result
+        {
+            error_code ec;
+            std::size_t size = 0;
+            bool completed = false;
+        };
+
+        void reads_queued_responses()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().queue_response(bulk_in_endpoint, {.data = iota_bytes(3, 1)});
+            sim.sim_device().queue_response(bulk_in_endpoint, {.data = iota_bytes(5, 10)});
+
+            auto transfer = usb_in_bulk_transfer{sim.device(), bulk_in_endpoint};
+            auto buffer = std::array<std::byte, 64>{};
+            for (auto const& expected : {iota_bytes(3, 1), iota_bytes(5, 10)})
+            {
+                auto result = read_result{};
+                auto handler = [&](error_code const& ec, std::size_t const size) {
+                    result = {ec, size, true};
+                };
+                transfer.async_read_some(asio::buffer(buffer), handler);
+                run(ioc);
+
+                USB_ASIO_CHECK(result.completed);
+                USB_ASIO_CHECK(!result.ec);
+                USB_ASIO_CHECK(std::ranges::equal(std::span{buffer}.first(result.size), expected));
+            }
+        }
+
+        void writes_reach_the_sink()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            auto received = std::vector<std::byte>{};
+            sim.sim_device().set_out_sink(bulk_out_endpoint, [&](std::span<std::byte const> const data) {
+                received.insert(received.end(), data.begin(), data.end());
+            });
+
+            auto transfer = usb_out_bulk_transfer{sim.device(), bulk_out_endpoint};
+            auto const data = iota_bytes(1000);
+            auto result = read_result{};
+            auto handler = [&](error_code const& ec, std::size_t const size) {
+                result = {ec, size, true};
+            };
+            transfer.async_write_some(asio::buffer(data), handler);
+            run(ioc);
+
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(!result.ec);
+            USB_ASIO_CHECK(result.size == data.size());
+            USB_ASIO_CHECK(received == data);
+        }
+
+        void reports_stalls_and_overflows()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().queue_response(bulk_in_endpoint, {.type = sim::usb_sim_response_type::stall});
+            sim.sim_device().queue_response(bulk_in_endpoint, {.data = iota_bytes(32)});
+
+            auto transfer = usb_in_bulk_transfer{sim.device(), bulk_in_endpoint};
+            auto buffer = std::array<std::byte, 16>{};
+            for (auto const expected : {usb_transfer_errc::stall, usb_transfer_errc::overflow})
+            {
+                auto result = read_result{};
+                auto handler = [&](error_code const& ec, std::size_t const size) {
+                    result = {ec, size, true};
+                };
+                transfer.async_read_some(asio::buffer(buffer), handler);
+                run(ioc);
+
+                USB_ASIO_CHECK(result.completed);
+                USB_ASIO_CHECK(result.ec == expected);
+            }
+        }
+
+        void timeout_during_nak_leaves_the_response()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().queue_response(
+                bulk_in_endpoint,
+                {.type = sim::usb_sim_response_type::nak, .nak_duration = 200ms});
+            sim.sim_device().queue_response(bulk_in_endpoint, {.data = iota_bytes(2, 7)});
+
+            auto buffer = std::array<std::byte, 64>{};
+            auto read = [&](std::chrono::milliseconds const timeout) {
+                auto transfer = usb_in_bulk_transfer{sim.device(), bulk_in_endpoint, timeout};
+                auto result = read_result{};
+                auto handler = [&](error_code const& ec, std::size_t const size) {
+                    result = {ec, size, true};
+                };
+                transfer.async_read_some(asio::buffer(buffer), handler);
+                run(ioc);
+                return result;
+            };
+
+            auto const timed_out = read(20ms);
+            USB_ASIO_CHECK(timed_out.completed);
+            USB_ASIO_CHECK(timed_out.ec == usb_transfer_errc::timeout);
+
+            auto const retried = read(usb_no_timeout);
+            USB_ASIO_CHECK(!retried.ec);
+            USB_ASIO_CHECK(std::ranges::equal(std::span{buffer}.first(retried.size), iota_bytes(2, 7)));
+        }
+
+        void cancel_completes_with_cancelled()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().queue_response(
+                bulk_in_endpoint,
+                {.type = sim::usb_sim_response_type::nak, .nak_duration = 10s});
+            sim.sim_device().queue_response(bulk_in_endpoint, {.data = iota_bytes(1, 5)});
+
+            auto transfer = usb_in_bulk_transfer{sim.device(), bulk_in_endpoint};
+            auto buffer = std::array<std::byte, 64>{};
+            auto result = read_result{};
+            auto handler = [&](error_code const& ec, std::size_t const size) {
+                result = {ec, size, true};
+            };
+            transfer.async_read_some(asio::buffer(buffer), handler);
+            ioc.run_for(10ms);
+            USB_ASIO_CHECK(!result.completed);
+
+            transfer.cancel();
+            run(ioc);
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(result.ec == usb_transfer_errc::cancelled);
+
+            // The response after the NAK is left to the next transfer.
+            transfer.async_read_some(asio::buffer(buffer), handler);
+            run(ioc);
+            USB_ASIO_CHECK(!result.ec);
+            USB_ASIO_CHECK(result.size == 1 && buffer[0] == std::byte{5});
+        }
+
+#ifdef USB_ASIO_HAS_CANCELLATION_SLOT
+        void cancellation_slot_cancels()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().queue_response(
+                bulk_in_endpoint,
+                {.type = sim::usb_sim_response_type::nak, .nak_duration = 10s});
+
+            auto transfer = usb_in_bulk_transfer{sim.device(), bulk_in_endpoint};
+            auto buffer = std::array<std::byte, 64>{};
+            auto signal = asio::cancellation_signal{};
+            auto result = read_result{};
+            auto handler = asio::bind_cancellation_slot(
+                signal.slot(),
+                [&](error_code const& ec, std::size_t const size) {
+                    result = {ec, size, true};
+                });
+            transfer.async_read_some(asio::buffer(buffer), handler);
+            ioc.run_for(10ms);
+
+            signal.emit(asio::cancellation_type::terminal);
+            run(ioc);
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(result.ec == usb_transfer_errc::cancelled);
+        }
+#endif
+
+        void unplug_completes_with_no_device()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            sim.sim_device().queue_response(
+                bulk_in_endpoint,
+                {.type = sim::usb_sim_response_type::nak, .nak_duration = 10s});
+
+            auto transfer = usb_in_bulk_transfer{sim.device(), bulk_in_endpoint};
+            auto buffer = std::array<std::byte, 64>{};
+            auto result = read_result{};
+            auto handler = [&](error_code const& ec, std::size_t const size) {
+                result = {ec, size, true};
+            };
+            transfer.async_read_some(asio::buffer(buffer), handler);
+            ioc.run_for(10ms);
+
+            sim.sim_device().unplug();
+            run(ioc);
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(result.ec == usb_transfer_errc::no_device);
+        }
+
+        void reactor_times_out_transfers_submitted_while_idle()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc, {.event_handling = usb_event_handling::reactor}};
+            sim.sim_device().queue_response(
+                bulk_in_endpoint,
+                {.type = sim::usb_sim_response_type::nak, .nak_duration = 10s});
+
+            auto transfer = usb_in_bulk_transfer{sim.device(), bulk_in_endpoint, 20ms};
+            auto buffer = std::array<std::byte, 64>{};
+            auto result = read_result{};
+            auto handler = [&](error_code const& ec, std::size_t const size) {
+                result = {ec, size, true};
+            };
+            transfer.async_read_some(asio::buffer(buffer), handler);
+            // The reactor keeps the io_context busy while the device is open.
+            while (!result.completed && ioc.run_one_for(2s) != 0) { }
+
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(result.ec == usb_transfer_errc::timeout);
+        }
+
+        void batch_completes_once_all_transfers_did()
+        {
+            auto ioc = asio::io_context{};
+            auto sim = sim_test_device{ioc};
+            for (auto i = 0; i < 4; ++i)
+            {
+                sim.sim_device().queue_response(bulk_in_endpoint, {.data = iota_bytes(8)});
+            }
+
+            auto transfers = std::vector<usb_in_bulk_transfer>{};
+            auto buffers = std::vector<std::array<std::byte, 64>>(4);
+            for (auto& buffer : buffers)
+            {
+                transfers.emplace_back(sim.device(), bulk_in_endpoint);
+                transfers.back().set_buffer(asio::buffer(buffer));
+            }
+
+            auto result = read_result{};
+            auto handler = [&](error_code const& ec, std::size_t const succeeded) {
+                result = {ec, succeeded, true};
+            };
+            async_submit_batch(std::span{transfers}, handler);
+            run(ioc);
+
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(!result.ec);
+            USB_ASIO_CHECK(result.size == transfers.size());
+            for (auto const& transfer : transfers)
+            {
+                USB_ASIO_CHECK(transfer.last_result() == 8);
+            }
+        }
+
+        void empty_batch_completes_on_the_executor()
+        {
+            auto ioc = asio::io_context{};
+            auto result = read_result{};
+            auto on_executor = false;
+            auto handler = [&](error_code const& ec, std::size_t const succeeded) {
+                result = {ec, succeeded, true};
+                on_executor = ioc.get_executor().running_in_this_thread();
+            };
+            async_submit_batch(
+                usb_in_bulk_transfer::executor_type{ioc.get_executor()},
+                std::span<usb_in_bulk_transfer>{},
+                handler);
+            USB_ASIO_CHECK(!result.completed);
+
+            run(ioc);
+            USB_ASIO_CHECK(result.completed);
+            USB_ASIO_CHECK(on_executor);
+            USB_ASIO_CHECK(result.size == 0);
+        }
+    }  // namespace
+}  // namespace usb_asio::test
+
+auto main() -> int
+{
+    using namespace usb_asio::test;
+
+    return run_tests({
+        {"reads_queued_responses", &reads_queued_responses},
+        {"writes_reach_the_sink", &writes_reach_the_sink},
+        {"reports_stalls_and_overflows", &reports_stalls_and_overflows},
+        {"timeout_during_nak_leaves_the_response", &timeout_during_nak_leaves_the_response},
+        {"cancel_completes_with_cancelled", &cancel_completes_with_cancelled},
+#ifdef USB_ASIO_HAS_CANCELLATION_SLOT
+        {"cancellation_slot_cancels", &cancellation_slot_cancels},
+#endif
+        {"unplug_completes_with_no_device", &unplug_completes_with_no_device},
+        {"reactor_times_out_transfers_submitted_while_idle", &reactor_times_out_transfers_submitted_while_idle},
+        {"batch_completes_once_all_transfers_did", &batch_completes_once_all_transfers_did},
+        {"empty_batch_completes_on_the_executor", &empty_batch_completes_on_the_executor},
+    });
+}